@@ -6,7 +6,6 @@
  * April 2019
  */
 
-#define ROTL8(x,shift) ((uint8_t) ((x) << (shift)) | ((x) >> (8 - (shift))))
 #define KEY_SIZE 32
 #define PT_SIZE 32
 
@@ -15,369 +14,957 @@
 #include <string.h>
 #include <math.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "aes_cache.h"
+#include "aes_coalesce.h"
+#include "aes_core.h"
+#include "aes_engine.h"
+#include "aes_gcm.h"
+#include "aes_hex.h"
+#include "aes_modes.h"
+#include "aes_stream.h"
+#include "aes_trace.h"
+#include "aes_xts.h"
 
 using namespace std;
 
-/* Reference to S-BOX table. */
-uint8_t sbox[256];
-
 /* Definition of input key */
-unsigned int key[16] = { 0x0f, 0x15, 0x71, 0xc9, 0x47, 0xd9, 0xe8, 0x59, 0x1c, 0xb7, 0xad, 0xd6, 0xaf, 0x7f, 0x67, 0x98 };
-/* Round Constant definition */
-unsigned char RC[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
-/* Expanded key, 44 4-byte words */
-unsigned int w[44];
-/* State Block, 4 4-byte words */
-unsigned int state[4] = { 0, 0, 0, 0 };
-/* Round counter */
-int count = 0;
-/* Mix Columns encryption matrix */
-unsigned int MCE[4] = { 0x02030101, 0x01020301, 0x01010203, 0x03010102 };
-
-/* Generate S-Box (taken from https://en.wikipedia.org/wiki/Rijndael_S-box) */
-void InitializeSbox() {
-    uint8_t p = 1, q = 1;
-    
-    /* Loop invariant: p * q == 1 in the Galois field */
-    do {
-        /* Multiply p by 3 */
-        p = p ^ (p << 1) ^ (p & 0x80 ? 0x1B : 0);
-
-        /* Divide q by 3 (equals multiplication by 0xf6) */
-        q ^= q << 1;
-        q ^= q << 2;
-        q ^= q << 4;
-        q ^= q & 0x80 ? 0x09 : 0;
-
-        /* Compute the affine transformation */
-        uint8_t xformed = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4);
-
-        sbox[p] = (char)(xformed ^ 0x63);
-    } while (p != 1);
-
-    /* 0 is a special case since it has no inverse */
-    sbox[0] = (char)0x63;
-}
+const uint8_t key[16] = { 0x0f, 0x15, 0x71, 0xc9, 0x47, 0xd9, 0xe8, 0x59, 0x1c, 0xb7, 0xad, 0xd6, 0xaf, 0x7f, 0x67, 0x98 };
 
-/* Given an input byte, return the corresponding output byte from the S-Box */
-unsigned int CalculateSboxValue(unsigned int input) {
-    int row = (input >> 4) & 0xF;
-    int col = input & 0xF;
+/* Parse a decimal number from min to max into *out; false for anything else, including a sign or trailing characters */
+static bool ParseCount(const char *s, unsigned long long min, unsigned long long max, unsigned long long *out) {
+    char *end;
 
-    return sbox[row * 16 + col];
-}
+    if(!isdigit((unsigned char)s[0])) {
+        return false;
+    }
 
-/* Print the calculated S-Box so it can be verified */
-void PrintSbox() {
-    printf("Calculated S-Box:\n-----------------------------------------------");
+    errno = 0;
+    *out = strtoull(s, &end, 10);
 
-    int i = 0;
-    for(; i < 256; i++) {
-        if(i % 16 == 0) {
-            printf("\n");
-        }
-        printf("%02X ", sbox[i] & 0xff);
-    }
-    printf("\n");
+    return errno == 0 && *end == '\0' && *out >= min && *out <= max;
 }
 
-/* SubWord Protocol */
-unsigned int SubWord(unsigned int w) {
-    unsigned int out = 0;
+/* Check every engine against the step-by-step protocols */
+int Verify() {
+    /* FIPS-197 Appendix B cipher example */
+    const uint8_t fipsKey[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    const unsigned int fipsIn[4] = { 0x3243f6a8, 0x885a308d, 0x313198a2, 0xe0370734 };
+    const unsigned int fipsOut[4] = { 0x3925841d, 0x02dc09fb, 0xdc118597, 0x196a0b32 };
+    uint8_t k[16];
+    unsigned int w[44];
+    unsigned int state[4];
+    unsigned int s[4];
+    int failures = 0;
+    int trial;
     int i;
 
-    /* Perform a byte substitution using the S-Box */
-    for(i = 0; i < 4; i++) {
-        /* Isolate the byte being used */
-        unsigned int tmp = (w >> (24 - i * 8)) & 0xFF;
+    ExpandKey(fipsKey, w);
 
-        /* Calculate the subsituted byte and store in out */
-        tmp = CalculateSboxValue(tmp);
-        out |= (tmp << (24 - i * 8));
+    memcpy(state, fipsIn, 16);
+    EncryptState(state, w);
+    if(memcmp(state, fipsOut, 16) != 0) {
+        printf("Step-by-step protocols do not match FIPS-197 Appendix B\n");
+        failures++;
     }
 
-    return out;
-}
+    memcpy(s, fipsIn, 16);
+    EncryptStateTTable<10>(w, s);
+    if(memcmp(s, fipsOut, 16) != 0) {
+        printf("T-table engine does not match FIPS-197 Appendix B\n");
+        failures++;
+    }
 
-/* RotWord Protocol */
-unsigned int RotWord(unsigned int w) {
-    /* Isolate B0 */
-    unsigned int tmp = (w >> 24) & 0xFF;
+    /* The inverse cipher on the same example */
+    unsigned int dw[44];
+    InvertKeySchedule(w, dw);
 
-    /* Shift w to B1 B2 B3 00 */
-    w = w << 8;
+    memcpy(state, fipsOut, 16);
+    DecryptState(state, w);
+    if(memcmp(state, fipsIn, 16) != 0) {
+        printf("Inverse protocols do not match FIPS-197 Appendix B\n");
+        failures++;
+    }
 
-    /* Complete rotation to B1 B2 B3 B0 */
-    return w | tmp;
-}
+    memcpy(s, fipsOut, 16);
+    DecryptStateTTable<10>(dw, s);
+    if(memcmp(s, fipsIn, 16) != 0) {
+        printf("T-table inverse cipher does not match FIPS-197 Appendix B\n");
+        failures++;
+    }
 
-/* Key Expansion Protocol */
-void ExpandKey() {
-    unsigned int tmp;
-    int i;
-    int counter = 1;
+    /* Random keys and blocks, a fresh key every 256 blocks */
+    srand(1);
+    for(trial = 0; trial < 65536; trial++) {
+        if(trial % 256 == 0) {
+            for(i = 0; i < 16; i++) {
+                k[i] = rand() & 0xFF;
+            }
+            ExpandKey(k, w);
+        }
 
-    /* Manually set the first 4 words in the expanded key */
-    for(i = 0; i < 4; i++) {
-        w[i] = (key[4*i] << 24) | (key[4*i + 1] << 16) | (key[4*i + 2] << 8) | key[4*i + 3];
+        for(i = 0; i < 4; i++) {
+            s[i] = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+        }
+        memcpy(state, s, 16);
+
+        EncryptState(state, w);
+        EncryptStateTTable<10>(w, s);
+
+        if(memcmp(state, s, 16) != 0) {
+            printf("T-table engine differs on trial %d: %08x%08x%08x%08x != %08x%08x%08x%08x\n", trial, s[0], s[1], s[2], s[3], state[0], state[1], state[2], state[3]);
+            failures++;
+            break;
+        }
+
+        /* Both inverse ciphers must take the ciphertext back to the same plaintext */
+        InvertKeySchedule(w, dw);
+        DecryptState(state, w);
+        DecryptStateTTable<10>(dw, s);
+        if(memcmp(state, s, 16) != 0) {
+            printf("T-table inverse cipher differs on trial %d\n", trial);
+            failures++;
+            break;
+        }
     }
 
-    printf("\nAuxiliary Function:\n--------------------------------\n");
+    /* Bulk engines against the T-table engine on a buffer with a ragged tail */
+    AesEngine engines[4] = { ENGINE_TTABLE, ENGINE_AESNI, ENGINE_BITSLICE, ENGINE_VPERM };
+    static uint8_t in[16 * 1003];
+    static uint8_t expected[16 * 1003];
+    static uint8_t out[16 * 1003];
+    AesContext ctx;
 
-    /* Generate the rest of the expanded key */
-    for(i = 4; i < 44; i++) {
-        tmp = w[i - 1];
-        if(i % 4 == 0) {
-            /* Substitute and rotate */
-            tmp = RotWord(tmp);
-            printf("RotWord (w%d) = %02hhx %02hhx %02hhx %02hhx = x%d\n", i - 1, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+    for(i = 0; i < (int)sizeof(in); i++) {
+        in[i] = rand() & 0xFF;
+    }
+    EncryptBlocksTTable<10>(w, in, expected, 1003);
 
-            tmp = SubWord(tmp);
-            printf("SubWord (x%d) = %02hhx %02hhx %02hhx %02hhx = y%d\n", counter, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+    for(i = 0; i < 4; i++) {
+        InitializeContext(&ctx, k, 16, engines[i]);
+        if(ctx.engine != engines[i]) {
+            printf("Engine %s is not available on this CPU, skipped\n", EngineName(engines[i]));
+            continue;
+        }
 
-            /* The three rightmost bytes are always 0 */
-            printf("Rcon (%d) = %02hhx 00 00 00\n", i/4, RC[i/4 - 1]);
-            tmp = tmp ^ (RC[i / 4 - 1] << 24);
-            printf("y%d ^ Rcon (%d) = %02hhx %02hhx %02hhx %02hhx = z%d\n\n", counter, RC[i/4], (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+        EncryptBlocks(&ctx, in, out, 1003);
+        if(memcmp(out, expected, sizeof(out)) != 0) {
+            printf("Engine %s differs from the T-table engine\n", EngineName(engines[i]));
+            failures++;
         }
 
-        w[i] = w[i - 4] ^ tmp;
+        DecryptBlocks(&ctx, out, out, 1003);
+        if(memcmp(out, in, sizeof(out)) != 0) {
+            printf("Engine %s does not decrypt its own output\n", EngineName(engines[i]));
+            failures++;
+        }
     }
-}
 
-/* Print the Expanded Key in a readable format */
-void PrintExpandedKey() {
-    printf("\nExpanded Key:\n-----------------\n");
+    /* On-the-fly key schedule against the expanded one, in place for a ragged last group of blocks */
+    uint8_t last[16];
 
-    int i;
-    for(i = 0; i < 44; i++) {
-        printf("w%d = %02hhx %02hhx %02hhx %02hhx\n", i, (w[i] >> 24) & 0xFF, (w[i] >> 16) & 0xFF, (w[i] >> 8) & 0xFF, w[i] & 0xFF);
-        if((i + 1) % 4 == 0 && i > 0) {
-            printf("\n");
+    LastRoundKey(k, last);
+    for(i = 0; i < 16; i++) {
+        if(last[i] != ((w[40 + i / 4] >> (24 - 8 * (i % 4))) & 0xFF)) {
+            printf("LastRoundKey() differs from ExpandKey()\n");
+            failures++;
+            break;
         }
     }
-}
+    EncryptBlocksOnTheFly(k, in, out, 1003);
+    if(memcmp(out, expected, sizeof(out)) != 0) {
+        printf("On-the-fly key schedule differs from the T-table engine\n");
+        failures++;
+    }
+    DecryptBlocksOnTheFly(last, out, out, 1003);
+    if(memcmp(out, in, sizeof(out)) != 0) {
+        printf("Reverse on-the-fly key schedule does not decrypt\n");
+        failures++;
+    }
 
-/* Print the State in a readable format */
-void PrintState() {
-    int i;
-    for(i = 0; i < 4; i++) {
-        printf("%02x %02x %02x %02x\n", (state[0] >> (24 - 8*i)) & 0xFF, (state[1] >> (24 - 8*i)) & 0xFF, (state[2] >> (24 - 8*i)) & 0xFF, (state[3] >> (24 - 8*i)) & 0xFF);
+    /* FIPS-197 Appendix C.2 and C.3: AES-192 and AES-256 through the protocols and every engine */
+    const uint8_t longKey[32] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                                  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f };
+    const uint8_t longIn[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    const uint8_t longOut[2][16] = { { 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 },
+                                     { 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 } };
+    unsigned int longW[MAX_KEY_WORDS];
+    uint8_t block[16];
+    int size;
+
+    for(size = 0; size < 2; size++) {
+        int rounds = size == 0 ? 12 : 14;
+
+        if(size == 0) {
+            ExpandKey<6>(longKey, longW);
+        }
+        else {
+            ExpandKey<8>(longKey, longW);
+        }
+        for(i = 0; i < 4; i++) {
+            state[i] = ((unsigned int)longIn[4*i] << 24) | (longIn[4*i + 1] << 16) | (longIn[4*i + 2] << 8) | longIn[4*i + 3];
+            s[i] = ((unsigned int)longOut[size][4*i] << 24) | (longOut[size][4*i + 1] << 16) | (longOut[size][4*i + 2] << 8) | longOut[size][4*i + 3];
+        }
+        EncryptState(state, longW, rounds);
+        if(memcmp(state, s, 16) != 0) {
+            printf("Step-by-step protocols do not match FIPS-197 for AES-%d\n", 64 * rounds - 512);
+            failures++;
+        }
+        DecryptState(state, longW, rounds);
+        for(i = 0; i < 4; i++) {
+            s[i] = ((unsigned int)longIn[4*i] << 24) | (longIn[4*i + 1] << 16) | (longIn[4*i + 2] << 8) | longIn[4*i + 3];
+        }
+        if(memcmp(state, s, 16) != 0) {
+            printf("Inverse protocols do not undo AES-%d\n", 64 * rounds - 512);
+            failures++;
+        }
+
+        for(i = 0; i < 4; i++) {
+            InitializeContext(&ctx, longKey, 24 + 8 * size, engines[i]);
+            if(ctx.engine != engines[i]) {
+                continue;
+            }
+
+            EncryptBlocks(&ctx, longIn, block, 1);
+            if(memcmp(block, longOut[size], 16) != 0) {
+                printf("Engine %s does not match FIPS-197 for AES-%d\n", EngineName(engines[i]), 64 * rounds - 512);
+                failures++;
+            }
+
+            EncryptBlocks(&ctx, in, out, 1003);
+            DecryptBlocks(&ctx, out, out, 1003);
+            if(memcmp(out, in, sizeof(out)) != 0) {
+                printf("Engine %s does not decrypt its own AES-%d output\n", EngineName(engines[i]), 64 * rounds - 512);
+                failures++;
+            }
+        }
     }
-    printf("\n");
-}
 
-/* Print the Round Key in a readable format */
-void PrintRoundKey() {
-    printf("\n(%d) Round Key:\n--------------\n", count);
+    /* NIST SP 800-38A F.5.1 CTR-AES128.Encrypt, whose counter carries out of the low byte */
+    const uint8_t ctrIv[16] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+    const uint8_t ctrIn[32] = { 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                                0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51 };
+    const uint8_t ctrOut[32] = { 0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+                                 0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff };
+    uint8_t ctrBlock[32];
+
+    InitializeContext(&ctx, fipsKey, 16, ENGINE_AUTO);
+    CtrCrypt(&ctx, ctrIv, 0, ctrIn, ctrBlock, 32);
+    if(memcmp(ctrBlock, ctrOut, 32) != 0) {
+        printf("CTR mode does not match SP 800-38A F.5.1\n");
+        failures++;
+    }
 
-    int i;
-    int offset = count * 4;
-    for(i = 0; i < 4; i++) {
-        printf("%02x %02x %02x %02x\n", (w[offset] >> (24 - 8*i)) & 0xFF, (w[offset + 1] >> (24 - 8*i)) & 0xFF, (w[offset + 2] >> (24 - 8*i)) & 0xFF, (w[offset + 3] >> (24 - 8*i)) & 0xFF);
+    /* Parallel CTR against serial CTR, and a seek to an unaligned offset against the same range */
+    static uint8_t big[4 * CHUNK_SIZE + 4099];
+    static uint8_t bigExpected[sizeof(big)];
+    static uint8_t bigOut[sizeof(big)];
+    ThreadPool pool(4);
+
+    for(i = 0; i < (int)sizeof(big); i++) {
+        big[i] = rand() & 0xFF;
+    }
+    CtrCrypt(&ctx, ctrIv, 0, big, bigExpected, sizeof(big));
+    CtrCryptParallel(&ctx, ctrIv, 0, big, bigOut, sizeof(big), pool);
+    if(memcmp(bigOut, bigExpected, sizeof(big)) != 0) {
+        printf("Parallel CTR mode differs from serial CTR mode\n");
+        failures++;
+    }
+    CtrCrypt(&ctx, ctrIv, 70001, big + 70001, bigOut, 1000);
+    if(memcmp(bigOut, bigExpected + 70001, 1000) != 0) {
+        printf("CTR mode seek differs from the full stream\n");
+        failures++;
     }
-    printf("\n");
-}
 
-/* AddRoundKey protocol */
-void AddRoundKey() {
-    PrintRoundKey();
+    /* NIST SP 800-38A F.2.1 CBC-AES128.Encrypt, decrypted back in place */
+    const uint8_t cbcIv[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    const uint8_t cbcOut[32] = { 0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+                                 0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2 };
+    uint8_t chain[16];
+
+    memcpy(chain, cbcIv, 16);
+    CbcEncrypt(&ctx, chain, ctrIn, ctrBlock, 2);
+    if(memcmp(ctrBlock, cbcOut, 32) != 0) {
+        printf("CBC mode does not match SP 800-38A F.2.1\n");
+        failures++;
+    }
+    memcpy(chain, cbcIv, 16);
+    CbcDecrypt(&ctx, chain, ctrBlock, ctrBlock, 2);
+    if(memcmp(ctrBlock, ctrIn, 32) != 0 || memcmp(chain, cbcOut + 16, 16) != 0) {
+        printf("CBC mode does not decrypt SP 800-38A F.2.1\n");
+        failures++;
+    }
 
-    /* XOR each byte of state[] with w[i,j] */
-    for(int i = 0; i < 4; i++) {
-        state[i] ^= w[i + count * 4];
+    /* Interleaved streams of every length from 0 to 299 bytes, more than CTR_BATCH of them, against one padded message at a time */
+    const size_t cbcStreams = 300;
+    static CbcStream streams[cbcStreams];
+    size_t offset = 0;
+    size_t plainLen;
+    size_t m;
+
+    for(m = 0; m < cbcStreams; m++) {
+        streams[m].in = big + offset;
+        streams[m].out = bigOut + offset + 16 * m;
+        streams[m].len = m;
+        memcpy(streams[m].iv, big + m, 16);
+        offset += m;
+    }
+    CbcEncryptStreams(&ctx, streams, cbcStreams, true);
+
+    offset = 0;
+    for(m = 0; m < cbcStreams; m++) {
+        memcpy(chain, big + m, 16);
+        if(CbcEncryptPadded(&ctx, chain, big + offset, bigExpected, m) != m / 16 * 16 + 16 ||
+           memcmp(bigExpected, streams[m].out, m / 16 * 16 + 16) != 0 || memcmp(chain, streams[m].iv, 16) != 0) {
+            printf("CBC stream %zu differs from CbcEncryptPadded()\n", m);
+            failures++;
+            break;
+        }
+        memcpy(chain, big + m, 16);
+        if(!CbcDecryptPadded(&ctx, chain, bigExpected, bigExpected, m / 16 * 16 + 16, &plainLen) || plainLen != m || memcmp(bigExpected, big + offset, m) != 0) {
+            printf("CBC stream %zu does not decrypt\n", m);
+            failures++;
+            break;
+        }
+        offset += m;
     }
-}
 
-/* SubstituteBytes Protocol */
-void SubstituteBytes() {
-    int i;
-    for(i = 0; i < 4; i++) {
-        state[i] = SubWord(state[i]);
+    /* Key cache: hits return the same context, a full shard evicts, and evicted contexts stay usable while held */
+    KeyCache cache(CACHE_SHARDS);
+    std::shared_ptr<const AesContext> first = cache.Get(fipsKey, 16);
+    uint8_t cacheKey[32];
+
+    if(cache.Get(fipsKey, 16) != first || cache.Get(fipsKey, 15) != NULL) {
+        printf("Key cache does not return the cached context\n");
+        failures++;
+    }
+    memcpy(cacheKey, longKey, 32);
+    for(i = 0; i < 64; i++) {
+        cacheKey[0] = i;
+        cache.Get(cacheKey, 16 + 8 * (i % 3));
+    }
+    EncryptBlocks(first.get(), longIn, block, 1);
+    InitializeContext(&ctx, fipsKey, 16, ENGINE_AUTO);
+    EncryptBlocks(&ctx, longIn, bigOut, 1);
+
+    KeyCacheStats stats = cache.Stats();
+    if(stats.hits != 1 || stats.misses != 65 || stats.evictions == 0 || memcmp(block, bigOut, 16) != 0) {
+        printf("Key cache counted %zu hits, %zu misses, %zu evictions\n", stats.hits, stats.misses, stats.evictions);
+        failures++;
     }
-}
 
-/* Shift Rows Protocol */
-void ShiftRows() {
-    int i;
-    int j;
-    unsigned int row = 0;
-    unsigned int tmp = 0;
-    unsigned int out = 0;
-    int pos = 0;
+    /* Batched key expansion and multi-key encryption against one context and one call per key; 1003 keys leave a ragged tail for every lane width */
+    const size_t batch = 1003;
+    static AesContext batchCtx[3][batch];
+    const AesContext *batchPtr[batch];
+    const uint8_t *batchKey[batch];
+    const uint8_t *batchIn[batch];
+    uint8_t *batchOut[batch];
+    int e;
+
+    for(e = 0; e < 4; e++) {
+        for(size = 0; size < 3; size++) {
+            for(i = 0; i < (int)batch; i++) {
+                batchKey[i] = big + 32 * i + size;
+            }
+            InitializeContexts(batchCtx[size], batchKey, 16 + 8 * size, batch, engines[e]);
+
+            for(i = 0; i < (int)batch; i++) {
+                AesContext *c = &batchCtx[size][i];
+
+                InitializeContext(&ctx, batchKey[i], 16 + 8 * size, engines[e]);
+                if(c->engine != ctx.engine || c->rounds != ctx.rounds || c->encrypt != ctx.encrypt || memcmp(c->w, ctx.w, sizeof(ctx.w[0]) * 4 * (ctx.rounds + 1)) != 0 ||
+                   memcmp(c->rk, ctx.rk, 16 * (ctx.rounds + 1)) != 0 || memcmp(c->dw, ctx.dw, sizeof(ctx.dw[0]) * 4 * (ctx.rounds + 1)) != 0 ||
+                   memcmp(c->drk, ctx.drk, 16 * (ctx.rounds + 1)) != 0 || (ctx.engine == ENGINE_BITSLICE && memcmp(c->sliced, ctx.sliced, sizeof(ctx.sliced[0]) * (ctx.rounds + 1)) != 0)) {
+                    printf("Batched key expansion differs from InitializeContext() for AES-%d key %d\n", 128 + 64 * size, i);
+                    failures++;
+                    break;
+                }
+            }
 
-    /* Keep track of which row is being shifted by i */
-    for(i = 1; i < 4; i++) {
-        out = 0;
+            /* The words-only batch expansion, once per key size */
+            if(e == 0 && HasAesNi()) {
+                static unsigned int batchW[batch * MAX_KEY_WORDS];
+                int words = 4 * (batchCtx[size][0].rounds + 1);
+
+                if(size == 0) {
+                    ExpandKeyWordsNi<4>(batchKey, batchW, batch);
+                }
+                else if(size == 1) {
+                    ExpandKeyWordsNi<6>(batchKey, batchW, batch);
+                }
+                else {
+                    ExpandKeyWordsNi<8>(batchKey, batchW, batch);
+                }
+                for(i = 0; i < (int)batch; i++) {
+                    if(memcmp(batchW + words * i, batchCtx[size][i].w, sizeof(unsigned int) * words) != 0) {
+                        printf("Batched ExpandKey() differs for AES-%d key %d\n", 128 + 64 * size, i);
+                        failures++;
+                        break;
+                    }
+                }
+            }
+        }
 
-        /* Find row, since it is the ith column of state matrix */
-        row = ((state[0] >> (24 - 8*i)) & 0xFF) << 24 | ((state[1] >> (24 - 8*i)) & 0xFF) << 16 | ((state[2] >> (24 - 8*i)) & 0xFF) << 8 | ((state[3] >> (24 - 8*i)) & 0xFF);
+        /* Key sizes change every few lanes, so runs of every length reach the engines; in and out overlap for half the lanes */
+        for(i = 0; i < (int)batch; i++) {
+            batchPtr[i] = &batchCtx[(i / 7 + i / 61) % 3][i];
+            batchIn[i] = big + 16 * i;
+            batchOut[i] = i % 2 ? bigOut + 16 * i : bigExpected + 16 * i;
+            if(i % 2 == 0) {
+                memcpy(batchOut[i], batchIn[i], 16);
+                batchIn[i] = batchOut[i];
+            }
+        }
+        EncryptBlocksMultiKey(batchPtr, batchIn, batchOut, batch);
+        for(i = 0; i < (int)batch; i++) {
+            EncryptBlocks(batchPtr[i], big + 16 * i, block, 1);
+            if(memcmp(block, batchOut[i], 16) != 0) {
+                printf("Multi-key engine %s differs from EncryptBlocks() at lane %d\n", EngineName(batchPtr[i]->engine), i);
+                failures++;
+                break;
+            }
+        }
+    }
 
-        /* Shift each byte accordingly */
-        for(j = 0; j < 4; j++) {
-            /* Isolate byte */
-            tmp = (row >> (24 - 8 * j)) & 0xFF;
+    /* GCM specification test case 4: AES-128 with AAD and a message that ends mid-block */
+    const uint8_t gcmKey[16] = { 0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08 };
+    const uint8_t gcmIv[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+    const uint8_t gcmAad[20] = { 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xab, 0xad, 0xda, 0xd2 };
+    const uint8_t gcmIn[60] = { 0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+                                0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+                                0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+                                0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39 };
+    const uint8_t gcmOut[60] = { 0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+                                 0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+                                 0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+                                 0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91 };
+    const uint8_t gcmTag[16] = { 0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47 };
+    /* Test case 5 is the same message under an 8-byte IV, which is hashed into the pre-counter block */
+    const uint8_t gcmTag5[16] = { 0x36, 0x12, 0xd2, 0xe7, 0x9e, 0x3b, 0x07, 0x85, 0x56, 0x1b, 0xe1, 0x4a, 0xac, 0xa2, 0xfc, 0xcb };
+    GcmKey gk;
+    GcmState gs;
+    uint8_t tag[16];
 
-            /* Shift byte */
-            pos = (3 - j + i) % 4;
-            tmp = tmp << 8 * pos;
-            out |= tmp;
+    for(i = 0; i < 4; i++) {
+        InitializeContext(&ctx, gcmKey, 16, engines[i]);
+        GcmInitialize(&gk, &ctx);
+
+        /* Fed in uneven pieces to cross the AAD and block boundaries */
+        GcmStart(&gs, &gk, gcmIv, 12);
+        GcmAad(&gs, gcmAad, 7);
+        GcmAad(&gs, gcmAad + 7, 13);
+        GcmEncrypt(&gs, gcmIn, block, 5);
+        GcmEncrypt(&gs, gcmIn + 5, bigOut, 55);
+        GcmFinish(&gs, tag);
+        memmove(bigOut + 5, bigOut, 55);
+        memcpy(bigOut, block, 5);
+        if(memcmp(bigOut, gcmOut, 60) != 0 || memcmp(tag, gcmTag, 16) != 0) {
+            printf("GCM with engine %s does not match test case 4\n", EngineName(ctx.engine));
+            failures++;
         }
 
-        /* Store as column i of state matrix */
-        unsigned int mask = 0;
-        if(i == 1) {
-            mask = 0xFF00FFFF;
+        GcmStart(&gs, &gk, gcmIv, 12);
+        GcmAad(&gs, gcmAad, 20);
+        GcmDecrypt(&gs, gcmOut, bigOut, 60);
+        if(memcmp(bigOut, gcmIn, 60) != 0 || !GcmVerify(&gs, gcmTag, 16)) {
+            printf("GCM with engine %s does not decrypt test case 4\n", EngineName(ctx.engine));
+            failures++;
         }
-        else if(i == 2) {
-            mask = 0xFFFF00FF;
+
+        GcmStart(&gs, &gk, gcmIv, 8);
+        GcmAad(&gs, gcmAad, 20);
+        GcmEncrypt(&gs, gcmIn, bigOut, 60);
+        if(!GcmVerify(&gs, gcmTag5, 16)) {
+            printf("GCM with engine %s does not match test case 5\n", EngineName(ctx.engine));
+            failures++;
         }
-        else {
-            mask = 0xFFFFFF00;
+    }
+
+    /* Fused AES-NI/PCLMULQDQ loop against the portable path on a long message, and a forged tag */
+    AesContext portable;
+    GcmKey pk;
+    const size_t gcmLen = sizeof(big) - 1234;
+
+    InitializeContext(&ctx, gcmKey, 16, ENGINE_AUTO);
+    InitializeContext(&portable, gcmKey, 16, ENGINE_TTABLE);
+    GcmInitialize(&gk, &ctx);
+    GcmInitialize(&pk, &portable);
+    pk.clmul = false;
+    pk.fused = false;
+
+    GcmStart(&gs, &gk, gcmAad, 20);
+    GcmAad(&gs, gcmAad, 20);
+    GcmEncrypt(&gs, big, bigOut, 100);
+    GcmEncrypt(&gs, big + 100, bigOut + 100, gcmLen - 100);
+    GcmFinish(&gs, tag);
+
+    GcmStart(&gs, &pk, gcmAad, 20);
+    GcmAad(&gs, gcmAad, 20);
+    GcmDecrypt(&gs, bigOut, bigExpected, gcmLen);
+    if(memcmp(bigExpected, big, gcmLen) != 0 || !GcmVerify(&gs, tag, 16)) {
+        printf("GCM fast path differs from the portable path\n");
+        failures++;
+    }
+
+    bigOut[777] ^= 1;
+    GcmStart(&gs, &gk, gcmAad, 20);
+    GcmAad(&gs, gcmAad, 20);
+    GcmDecrypt(&gs, bigOut, bigExpected, gcmLen);
+    if(GcmVerify(&gs, tag, 16)) {
+        printf("GCM accepted a modified ciphertext\n");
+        failures++;
+    }
+
+    /* IEEE 1619 XTS-AES-128 vectors 1 and 2, then 17 to 20 byte sectors, which steal ciphertext, against OpenSSL's AES-128-XTS */
+    uint8_t xtsKeyBytes[32];
+    uint8_t xtsIn[32];
+    const uint8_t xtsOut1[32] = { 0x91, 0x7c, 0xf6, 0x9e, 0xbd, 0x68, 0xb2, 0xec, 0x9b, 0x9f, 0xe9, 0xa3, 0xea, 0xdd, 0xa6, 0x92,
+                                  0xcd, 0x43, 0xd2, 0xf5, 0x95, 0x98, 0xed, 0x85, 0x8c, 0x02, 0xc2, 0x65, 0x2f, 0xbf, 0x92, 0x2e };
+    const uint8_t xtsOut2[32] = { 0xc4, 0x54, 0x18, 0x5e, 0x6a, 0x16, 0x93, 0x6e, 0x39, 0x33, 0x40, 0x38, 0xac, 0xef, 0x83, 0x8b,
+                                  0xfb, 0x18, 0x6f, 0xff, 0x74, 0x80, 0xad, 0xc4, 0x28, 0x93, 0x82, 0xec, 0xd6, 0xd3, 0x94, 0xf0 };
+    const uint8_t xtsSteal17[17] = { 0x64, 0x16, 0x10, 0x67, 0x9d, 0xcb, 0xf9, 0x2e, 0x50, 0x5c, 0x41, 0x33, 0x3f, 0xb0, 0x6c, 0x2a,
+                                     0x95 };
+    const uint8_t xtsSteal18[18] = { 0x22, 0x3a, 0x72, 0x5c, 0xbc, 0xd4, 0xdc, 0x64, 0x7b, 0x9a, 0x98, 0x26, 0xd5, 0x4c, 0x99, 0xc8,
+                                     0x95, 0xc8 };
+    const uint8_t xtsSteal19[19] = { 0x0d, 0x39, 0x80, 0x9a, 0x65, 0xc1, 0xd5, 0x55, 0x01, 0x96, 0x0b, 0x67, 0x1d, 0x4b, 0x8b, 0x6b,
+                                     0x95, 0xc8, 0x71 };
+    const uint8_t xtsSteal20[20] = { 0xa8, 0xba, 0x00, 0x48, 0xd7, 0x50, 0x84, 0x60, 0x3e, 0xb8, 0x42, 0x3a, 0x09, 0xb7, 0xbf, 0x75,
+                                     0x95, 0xc8, 0x71, 0xf6 };
+    const uint8_t *xtsStolen[4] = { xtsSteal17, xtsSteal18, xtsSteal19, xtsSteal20 };
+    XtsKey xts;
+
+    for(e = 0; e < 4; e++) {
+        memset(xtsKeyBytes, 0, 32);
+        memset(xtsIn, 0, 32);
+        XtsInitialize(&xts, xtsKeyBytes, 32, engines[e]);
+        XtsEncrypt(&xts, 0, xtsIn, bigOut, 32);
+        if(memcmp(bigOut, xtsOut1, 32) != 0) {
+            printf("XTS with engine %s does not match IEEE 1619 vector 1\n", EngineName(xts.data.engine));
+            failures++;
+        }
+
+        memset(xtsKeyBytes, 0x11, 16);
+        memset(xtsKeyBytes + 16, 0x22, 16);
+        memset(xtsIn, 0x44, 32);
+        XtsInitialize(&xts, xtsKeyBytes, 32, engines[e]);
+        XtsEncrypt(&xts, 0x3333333333ULL, xtsIn, bigOut, 32);
+        if(memcmp(bigOut, xtsOut2, 32) != 0) {
+            printf("XTS with engine %s does not match IEEE 1619 vector 2\n", EngineName(xts.data.engine));
+            failures++;
         }
-        for(j = 0; j < 4; j++) {
-            state[j] = (state[j] & mask) | (((out >> (24 - 8*j)) & 0xFF) << (24 - 8*i));
+
+        for(i = 0; i < 32; i++) {
+            xtsKeyBytes[i] = (i < 16 ? 0xff : 0xcf) - i;
+            xtsIn[i] = i;
+        }
+        XtsInitialize(&xts, xtsKeyBytes, 32, engines[e]);
+        for(i = 0; i < 4; i++) {
+            XtsEncrypt(&xts, 0x9a78563412ULL, xtsIn, bigOut, 17 + i);
+            if(memcmp(bigOut, xtsStolen[i], 17 + i) != 0) {
+                printf("XTS with engine %s does not match OpenSSL for %d bytes\n", EngineName(xts.data.engine), 17 + i);
+                failures++;
+            }
+            XtsDecrypt(&xts, 0x9a78563412ULL, bigOut, bigOut, 17 + i);
+            if(memcmp(bigOut, xtsIn, 17 + i) != 0) {
+                printf("XTS with engine %s does not decrypt %d bytes\n", EngineName(xts.data.engine), 17 + i);
+                failures++;
+            }
         }
     }
-}
 
-/* Special Matrix Multiplication given a row and column */
-unsigned int MultiplyMatrix(unsigned int row, unsigned int col) {
-    int i;
-    unsigned int m = 0x1B;
-    unsigned int r = 0;
-    unsigned int c = 0;
-    unsigned int tmp = 0;
-    unsigned int sum = 0;
+    /* Sectors of every length from 16 to 600 bytes, spread over the pool in place, against one sector at a time */
+    const size_t xtsCount = 585;
+    static XtsSector sectors[xtsCount];
+    uint8_t xtsKey256[64];
+
+    memcpy(xtsKey256, big + 100, 64);
+    XtsInitialize(&xts, xtsKey256, 64, ENGINE_AUTO);
+    memcpy(bigOut, big, sizeof(big));
+    offset = 0;
+    for(m = 0; m < xtsCount; m++) {
+        sectors[m].number = 1000 * m;
+        sectors[m].in = bigOut + offset;
+        sectors[m].out = bigOut + offset;
+        sectors[m].len = XTS_MIN_SECTOR + m;
+        offset += XTS_MIN_SECTOR + m;
+    }
+    if(!XtsEncryptSectors(&xts, sectors, xtsCount, pool)) {
+        printf("XTS refused a sector batch\n");
+        failures++;
+    }
+    offset = 0;
+    for(m = 0; m < xtsCount; m++) {
+        XtsEncrypt(&xts, 1000 * m, big + offset, bigExpected, XTS_MIN_SECTOR + m);
+        if(memcmp(bigExpected, bigOut + offset, XTS_MIN_SECTOR + m) != 0) {
+            printf("XTS sector batch differs from XtsEncrypt() for %zu bytes\n", XTS_MIN_SECTOR + m);
+            failures++;
+            break;
+        }
+        offset += XTS_MIN_SECTOR + m;
+    }
+    XtsDecryptSectors(&xts, sectors, xtsCount, pool);
+    if(memcmp(bigOut, big, offset) != 0) {
+        printf("XTS sector batch does not decrypt\n");
+        failures++;
+    }
+    if(XtsEncrypt(&xts, 0, big, bigOut, XTS_MIN_SECTOR - 1)) {
+        printf("XTS accepted a sector shorter than a block\n");
+        failures++;
+    }
 
-    /* Iterate on each element of row and col */
-    for(i = 0; i < 4; i++) {
-        /* Isolate row and col bytes */
-        r = (row >> (24 - 8 * i)) & 0xFF;
-        c = (col >> (24 - 8 * i)) & 0xFF;
-        tmp = c;
-
-        /* Store the multiplication c * r into sum */
-        if(r == 0x02 || r == 0x03) {
-            if(c & 0x80) {
-                c = (c << 1) ^ m;
+    /* Requests of 0 to 300 bytes from the pool's threads, coalesced, against CTR one message at a time */
+    const size_t coalesceCount = 800;
+    std::atomic<size_t> coalesced(0);
+    CoalesceStats coalesceStats;
+
+    {
+        Coalescer coalescer(&ctx, 500);
+
+        pool.ParallelFor(coalesceCount, [&](size_t n) {
+            uint8_t nonce[16];
+
+            memcpy(nonce, ctrIv, 16);
+            nonce[0] ^= (uint8_t)n;
+            nonce[1] ^= (uint8_t)(n >> 8);
+            coalescer.Submit(nonce, big + 301 * n, bigOut + 301 * n, n % 301, [](void *arg) {
+                ((std::atomic<size_t> *)arg)->fetch_add(1);
+            }, &coalesced);
+        });
+        coalescer.Flush();
+        coalesceStats = coalescer.Stats();
+    }
+    for(m = 0; m < coalesceCount; m++) {
+        uint8_t nonce[16];
+
+        memcpy(nonce, ctrIv, 16);
+        nonce[0] ^= (uint8_t)m;
+        nonce[1] ^= (uint8_t)(m >> 8);
+        CtrCrypt(&ctx, nonce, 0, big + 301 * m, bigExpected, m % 301);
+        if(memcmp(bigExpected, bigOut + 301 * m, m % 301) != 0) {
+            printf("Coalesced CTR differs from CTR mode for %zu bytes\n", m % 301);
+            failures++;
+            break;
+        }
+    }
+    if(coalesced.load() != coalesceCount || coalesceStats.requests + coalesceStats.direct != coalesceCount) {
+        printf("Coalescer completed %zu of %zu requests\n", coalesced.load(), coalesceCount);
+        failures++;
+    }
+
+    /* Vector hex codec against the scalar one at every length and alignment, in both cases */
+    static char hex[2 * 200 + 1];
+    static char hexExpected[sizeof(hex)];
+    const char bad[] = { 'g', 'G', '/', ':', '@', '`', ' ', '\0', (char)0xb0 };
+    size_t hexLen;
+    size_t j;
+
+    for(hexLen = 0; hexLen <= 130; hexLen++) {
+        for(i = 0; i < 3; i++) {
+            EncodeHex(big + i, hex, hexLen);
+            EncodeHexScalar(big + i, hexExpected, hexLen);
+            if(memcmp(hex, hexExpected, 2 * hexLen) != 0 || !DecodeHex(hex, bigOut, hexLen) || memcmp(bigOut, big + i, hexLen) != 0) {
+                printf("Hex codec fails for %zu bytes at offset %d\n", hexLen, i);
+                failures++;
+            }
+            for(j = 0; j < 2 * hexLen; j++) {
+                hex[j] = toupper(hex[j]);
             }
-            else {
-                c = c << 1;
+            if(!DecodeHex(hex, bigOut, hexLen) || memcmp(bigOut, big + i, hexLen) != 0) {
+                printf("Hex decoding of uppercase digits fails for %zu bytes\n", hexLen);
+                failures++;
             }
         }
-        if(r == 0x03) {
-            c = c ^ tmp;
+    }
+
+    EncodeHex(big, hex, 100);
+    for(j = 0; j < 200; j++) {
+        for(i = 0; i < (int)sizeof(bad); i++) {
+            char saved = hex[j];
+            hex[j] = bad[i];
+            if(DecodeHex(hex, bigOut, 100) || DecodeHexScalar(hex, bigOut, 100)) {
+                printf("Hex decoding accepted 0x%02x at digit %zu\n", (uint8_t)bad[i], j);
+                failures++;
+            }
+            hex[j] = saved;
         }
-        sum ^= c;
     }
 
-    return sum & 0xFF;
+    printf("%s\n", failures ? "Verification FAILED" : "Verification passed");
+    return failures ? 1 : 0;
 }
 
-/* Mix Columns Protocol */
-void MixColumns() {
+/* Print how to use the file and stream mode */
+void PrintStreamUsage() {
+    fprintf(stderr, "\nPlease use the format './encrypt -in <file> -out <file> -mode ctr|cbc|ecb [-decrypt] [-key <32, 48 or 64 hex digits>] [-iv <32 hex digits>] [-engine auto|ttable|aesni|bitslice|vperm]'.\n");
+    fprintf(stderr, "With -hex instead of -mode, each input line is one block of 32 hex digits, written back as one line of hex.\n");
+    fprintf(stderr, "Use - as the file name for standard input or output.\n\n");
+}
+
+/* File and stream mode: ./encrypt -in <file> -out <file> -mode <mode> ... */
+int StreamMain(int argc, char *argv[]) {
+    StreamOptions options;
+    AesEngine engine = ENGINE_AUTO;
+    uint8_t k[32];
+    size_t keyBytes = 16;
+    const char *mode = NULL;
+    bool hex = false;
+    AesContext ctx;
     int i;
-    int j;
-    unsigned int tmp;
-    unsigned int calculated[4] = { 0, 0, 0, 0 };
 
-    /* Traverse each row of MCE */
-    for(i = 0; i < 4; i++) {
-        /* Traverse each column of state */
-        for(j = 0; j < 4; j++) {
-            /* Store isolated byte */
-            tmp = MultiplyMatrix(MCE[i], state[j]);
+    memcpy(k, key, 16);
+    memset(&options, 0, sizeof(options));
 
-            /* Move byte and store in new state */
-            calculated[j] |= tmp << (24 - 8 * i);
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-decrypt") == 0) {
+            options.decrypt = true;
+            continue;
+        }
+        if(strcmp(argv[i], "-hex") == 0) {
+            hex = true;
+            continue;
+        }
+
+        if(i + 1 >= argc) {
+            PrintStreamUsage();
+            return 1;
+        }
+
+        if(strcmp(argv[i], "-in") == 0) {
+            options.in = argv[++i];
+        }
+        else if(strcmp(argv[i], "-out") == 0) {
+            options.out = argv[++i];
+        }
+        else if(strcmp(argv[i], "-mode") == 0) {
+            mode = argv[++i];
+        }
+        else if(strcmp(argv[i], "-key") == 0) {
+            /* 128, 192 or 256-bit keys */
+            keyBytes = strlen(argv[++i]) / 2;
+            if((keyBytes != 16 && keyBytes != 24 && keyBytes != 32) || !DecodeHexString(argv[i], k, keyBytes)) {
+                fprintf(stderr, "The key must be 32, 48 or 64 hex digits.\n");
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-iv") == 0) {
+            if(!DecodeHexString(argv[++i], options.iv, 16)) {
+                fprintf(stderr, "The IV must be 32 hex digits.\n");
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-engine") == 0) {
+            i++;
+            if(strcmp(argv[i], "ttable") == 0) {
+                engine = ENGINE_TTABLE;
+            }
+            else if(strcmp(argv[i], "aesni") == 0) {
+                engine = ENGINE_AESNI;
+            }
+            else if(strcmp(argv[i], "bitslice") == 0) {
+                engine = ENGINE_BITSLICE;
+            }
+            else if(strcmp(argv[i], "vperm") == 0) {
+                engine = ENGINE_VPERM;
+            }
+            else if(strcmp(argv[i], "auto") != 0) {
+                PrintStreamUsage();
+                return 1;
+            }
+        }
+        else {
+            PrintStreamUsage();
+            return 1;
         }
     }
 
-    /* Copy calculated matrix to state */
-    memcpy(state, calculated, 16);
-}
+    if(options.in == NULL || options.out == NULL || (mode == NULL) == !hex) {
+        PrintStreamUsage();
+        return 1;
+    }
 
-int main(int argc, char *argv[])
-{
-    if(argc != 2) {
-        printf("\nPlease enter a plaintext to encrypt in the format of './encrypt <16-character plaintext>'. Please try again.\n\nExiting Program.\n\n");
+    if(hex) {
+        InitializeContext(&ctx, k, keyBytes, engine);
+        return EncryptHexLines(&ctx, options.in, options.out, options.decrypt) == 0 ? 0 : 1;
+    }
+
+    if(strcmp(mode, "ctr") == 0) {
+        options.mode = STREAM_CTR;
+    }
+    else if(strcmp(mode, "cbc") == 0) {
+        options.mode = STREAM_CBC;
+    }
+    else if(strcmp(mode, "ecb") == 0) {
+        options.mode = STREAM_ECB;
+    }
+    else {
+        PrintStreamUsage();
         return 1;
     }
 
+    InitializeContext(&ctx, k, keyBytes, engine);
+    return EncryptStream(&ctx, &options) == 0 ? 0 : 1;
+}
+
+/* Print how to use the binary trace mode */
+void PrintTraceUsage() {
+    fprintf(stderr, "\nPlease use the format './encrypt -trace -out <trace file> [-in <file of 32-hex-digit lines>] [-key <32, 48 or 64 hex digits>] [-records <n>]'\n");
+    fprintf(stderr, "or './encrypt -tracedump <trace file>'. The trace keeps the last <n> steps,\nfrom 1 to %zu (default 1048576).\n\n", TRACE_MAX_RECORDS);
+}
+
+/* Binary trace mode: ./encrypt -trace -out <file> ... runs the reference protocols over every line into a TraceRing */
+int TraceMain(int argc, char *argv[]) {
+    const char *in = "-";
+    const char *out = NULL;
+    uint8_t k[32];
+    uint8_t block[16];
+    size_t keyBytes = 16;
+    size_t records = 1 << 20;
+    unsigned long long value = 0;
+    unsigned int w[MAX_KEY_WORDS];
+    unsigned int state[4];
+    char line[256];
+    size_t len;
+    TraceRing ring;
+    FILE *f;
+    int rounds;
     int i;
-    char *input = new char[PT_SIZE + 1];
-    strncpy(input, argv[1], PT_SIZE);
-    input[PT_SIZE] = '\0';
 
-    /* Parse plaintext */
-    unsigned int pt[PT_SIZE / 2];
-    for(i = 0; i < PT_SIZE; i += 2) {
-        char s[2] = { input[i], input[i + 1] };
-        sscanf(s, "%x", &(pt[i / 2])); 
+    memcpy(k, key, 16);
+    for(i = 2; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "-in") == 0) {
+            in = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "-out") == 0) {
+            out = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "-key") == 0) {
+            keyBytes = strlen(argv[i + 1]) / 2;
+            if((keyBytes != 16 && keyBytes != 24 && keyBytes != 32) || !DecodeHexString(argv[i + 1], k, keyBytes)) {
+                fprintf(stderr, "The key must be 32, 48 or 64 hex digits.\n");
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-records") == 0 && ParseCount(argv[i + 1], 1, TRACE_MAX_RECORDS, &value)) {
+            records = value;
+        }
+        else {
+            break;
+        }
     }
-
-    printf("\nThe plaintext you entered was: ");
-    for(i = 0; i < PT_SIZE / 2; i++) {
-        printf("%02x ", pt[i]);
+    if(i != argc || out == NULL) {
+        PrintTraceUsage();
+        return 1;
     }
-    printf("\n\n");
 
-    /* Initialize S-Box */
-    InitializeSbox();
-    PrintSbox();
+    if(keyBytes == 32) {
+        ExpandKey<8>(k, w);
+    }
+    else if(keyBytes == 24) {
+        ExpandKey<6>(k, w);
+    }
+    else {
+        ExpandKey<4>(k, w);
+    }
+    rounds = keyBytes / 4 + 6;
 
-    /* Expand Key */
-    ExpandKey();
-    PrintExpandedKey();
+    f = strcmp(in, "-") == 0 ? stdin : fopen(in, "r");
+    if(f == NULL) {
+        perror(in);
+        return 1;
+    }
+    if(!CreateTraceRing(&ring, records, rounds)) {
+        fprintf(stderr, "Out of memory for %zu trace records\n", records);
+        return 1;
+    }
 
-    /* Parse plaintext into block */
-    for(i = 0; i < 4; i++) {
-        state[i] = (pt[4*i] << 24) | (pt[4*i + 1] << 16) | (pt[4*i + 2] << 8) | pt[4*i + 3];
+    /* The ring is allocated up front, so tracing costs a few stores per step */
+    while(fgets(line, sizeof(line), f) != NULL) {
+        len = strcspn(line, "\r\n");
+        if(len != 32 || !DecodeHex(line, block, 16)) {
+            fprintf(stderr, "Line %u is not 32 hex digits.\n", ring.block + 1);
+            DestroyTraceRing(&ring);
+            return 1;
+        }
+        for(i = 0; i < 4; i++) {
+            state[i] = (block[4*i] << 24) | (block[4*i + 1] << 16) | (block[4*i + 2] << 8) | block[4*i + 3];
+        }
+        EncryptStateTraced(state, w, rounds, ring);
+        ring.block++;
+    }
+    if(f != stdin) {
+        fclose(f);
     }
-    PrintState();
 
-    /* Initial step into AES chain */
-    AddRoundKey();
-    count++;
+    bool ok = WriteTrace(&ring, out);
+    DestroyTraceRing(&ring);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc == 2 && strcmp(argv[1], "-verify") == 0) {
+        return Verify();
+    }
 
-    /* Start the AES chain */
-    for(i = 0; i < 9; i++) {
-        printf("\n(%d) Start of Round:\n-------------------\n", count);
-        PrintState();
+    if(argc >= 2 && strcmp(argv[1], "-trace") == 0) {
+        return TraceMain(argc, argv);
+    }
 
-        SubstituteBytes();
-        printf("\n(%d) Substitute Bytes:\n---------------------\n", count);
-        PrintState();
+    if(argc == 3 && strcmp(argv[1], "-tracedump") == 0) {
+        return PrintTrace(argv[2]) ? 0 : 1;
+    }
 
-        ShiftRows();
-        printf("\n(%d) Shift Rows:\n---------------\n", count);
-        PrintState();
+    if(argc >= 2 && argv[1][0] == '-') {
+        return StreamMain(argc, argv);
+    }
 
-        MixColumns();
-        printf("\n(%d) Mix Columns:\n----------------\n", count);
-        PrintState();
+    uint8_t k[32];
+    uint8_t pt[PT_SIZE / 2];
+    size_t keyBytes = argc == 3 ? strlen(argv[2]) / 2 : 16;
 
-        AddRoundKey();
-        count++;
+    /* Plaintexts longer than PT_SIZE digits are cut to PT_SIZE */
+    memcpy(k, key, 16);
+    if((argc != 2 && argc != 3) || strlen(argv[1]) < PT_SIZE || !DecodeHex(argv[1], pt, PT_SIZE / 2) || (argc == 3 && ((keyBytes != 16 && keyBytes != 24 && keyBytes != 32) || !DecodeHexString(argv[2], k, keyBytes)))) {
+        printf("\nPlease enter a plaintext to encrypt in the format of './encrypt <16-character plaintext> [<32, 48 or 64 hex digit key>]'. Please try again.\n\nExiting Program.\n\n");
+        return 1;
     }
 
-    printf("\n(%d) Start of Round:\n-------------------\n", count);
-    PrintState();
+    unsigned int w[MAX_KEY_WORDS];
+    unsigned int state[4];
+    int rounds = keyBytes / 4 + 6;
+    int i;
+    TextTrace trace;
+    char text[3 * PT_SIZE / 2 + 1];
 
-    SubstituteBytes();
-    printf("\n(%d) Substitute Bytes:\n---------------------\n", count);
-    PrintState();
+    EncodeHexSpaced(pt, text, PT_SIZE / 2);
+    printf("\nThe plaintext you entered was: %s\n\n", text);
 
-    ShiftRows();
-    printf("\n(%d) Shift Rows:\n---------------\n", count);
-    PrintState();
+    /* Print the compile-time S-Box */
+    PrintSbox();
 
-    AddRoundKey();
-    count++;
+    /* Expand Key */
+    if(keyBytes == 32) {
+        ExpandKey<8>(k, w, true);
+    }
+    else if(keyBytes == 24) {
+        ExpandKey<6>(k, w, true);
+    }
+    else {
+        ExpandKey<4>(k, w, true);
+    }
+    PrintExpandedKey(w, 4 * (rounds + 1));
+
+    /* Parse plaintext into block */
+    for(i = 0; i < 4; i++) {
+        state[i] = (pt[4*i] << 24) | (pt[4*i + 1] << 16) | (pt[4*i + 2] << 8) | pt[4*i + 3];
+    }
 
-    printf("\n(%d) Final Output:\n------------------\n", count);
-    PrintState();
+    /* Run the AES chain, printing every step */
+    trace.rounds = rounds;
+    EncryptStateTraced(state, w, rounds, trace);
 
     return 0;
 }
@@ -0,0 +1,187 @@
+/*
+ * C interface for the AES Encryption project
+ *
+ * Thin wrappers over the C++ interfaces; a key carries its GCM hash key so
+ * no call has to derive it again.
+ *
+ * AES Encryption
+ */
+
+#include <string.h>
+
+#include <new>
+
+#include "aes_api.h"
+#include "aes_coalesce.h"
+#include "aes_engine.h"
+#include "aes_gcm.h"
+#include "aes_modes.h"
+
+static_assert((int)AES_ENGINE_AUTO == (int)ENGINE_AUTO && (int)AES_ENGINE_TTABLE == (int)ENGINE_TTABLE && (int)AES_ENGINE_AESNI == (int)ENGINE_AESNI && (int)AES_ENGINE_BITSLICE == (int)ENGINE_BITSLICE &&
+              (int)AES_ENGINE_VPERM == (int)ENGINE_VPERM, "aes_engine mirrors AesEngine");
+
+struct aes_key {
+    AesContext ctx;
+    GcmKey gcm;
+};
+
+struct aes_coalescer {
+    Coalescer coalescer;
+
+    aes_coalescer(const AesContext *ctx, unsigned int latency) : coalescer(ctx, latency) {}
+};
+
+/* Overwrite a buffer in a way the compiler may not drop as a dead store */
+static void SecureZero(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while(len--) {
+        *v++ = 0;
+    }
+}
+
+int aes_api_version(void) {
+    return AES_API_VERSION;
+}
+
+int aes_key_new(const uint8_t *key, size_t key_len, aes_engine engine, aes_key **out) {
+    aes_key *k;
+
+    if(key_len != 16 && key_len != 24 && key_len != 32) {
+        return AES_EINVAL;
+    }
+    if(engine < AES_ENGINE_AUTO || engine > AES_ENGINE_VPERM) {
+        return AES_EINVAL;
+    }
+
+    k = new(std::nothrow) aes_key;
+    if(k == NULL) {
+        return AES_ENOMEM;
+    }
+
+    InitializeContext(&k->ctx, key, key_len, (AesEngine)engine);
+    GcmInitialize(&k->gcm, &k->ctx);
+    *out = k;
+
+    return AES_OK;
+}
+
+void aes_key_free(aes_key *key) {
+    if(key == NULL) {
+        return;
+    }
+
+    SecureZero(key, sizeof(aes_key));
+    delete key;
+}
+
+const char *aes_key_engine(const aes_key *key) {
+    return EngineName(key->ctx.engine);
+}
+
+void aes_encrypt_blocks(const aes_key *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+    EncryptBlocks(&key->ctx, in, out, blocks);
+}
+
+void aes_decrypt_blocks(const aes_key *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+    DecryptBlocks(&key->ctx, in, out, blocks);
+}
+
+void aes_ctr(const aes_key *key, const uint8_t iv[16], uint64_t offset, const uint8_t *in, uint8_t *out, size_t len) {
+    CtrCrypt(&key->ctx, iv, offset, in, out, len);
+}
+
+int aes_cbc_encrypt(const aes_key *key, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, size_t *out_len) {
+    uint8_t chain[16];
+
+    memcpy(chain, iv, 16);
+    *out_len = CbcEncryptPadded(&key->ctx, chain, in, out, len);
+
+    return AES_OK;
+}
+
+int aes_cbc_decrypt(const aes_key *key, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, size_t *out_len) {
+    uint8_t chain[16];
+
+    if(len == 0 || len % 16 != 0) {
+        return AES_EINVAL;
+    }
+
+    memcpy(chain, iv, 16);
+    if(!CbcDecryptPadded(&key->ctx, chain, in, out, len, out_len)) {
+        return AES_EAUTH;
+    }
+
+    return AES_OK;
+}
+
+int aes_gcm_seal(const aes_key *key, const uint8_t *iv, size_t iv_len, const uint8_t *aad, size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, uint8_t tag[16]) {
+    GcmState g;
+
+    if(iv_len == 0) {
+        return AES_EINVAL;
+    }
+
+    GcmStart(&g, &key->gcm, iv, iv_len);
+    GcmAad(&g, aad, aad_len);
+    GcmEncrypt(&g, in, out, len);
+    GcmFinish(&g, tag);
+
+    return AES_OK;
+}
+
+int aes_gcm_open(const aes_key *key, const uint8_t *iv, size_t iv_len, const uint8_t *aad, size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag, size_t tag_len) {
+    GcmState g;
+
+    if(iv_len == 0 || tag_len < 4 || tag_len > 16) {
+        return AES_EINVAL;
+    }
+
+    GcmStart(&g, &key->gcm, iv, iv_len);
+    GcmAad(&g, aad, aad_len);
+    GcmDecrypt(&g, in, out, len);
+    if(!GcmVerify(&g, tag, tag_len)) {
+        SecureZero(out, len);
+        return AES_EAUTH;
+    }
+
+    return AES_OK;
+}
+
+int aes_coalescer_new(const aes_key *key, unsigned int latency_us, aes_coalescer **out) {
+    aes_coalescer *c;
+
+    try {
+        c = new aes_coalescer(&key->ctx, latency_us);
+    }
+    catch(const std::exception &) {
+        /* bad_alloc, or system_error when the thread cannot start */
+        return AES_ENOMEM;
+    }
+    *out = c;
+
+    return AES_OK;
+}
+
+int aes_coalescer_submit(aes_coalescer *c, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, aes_done_fn done, void *arg) {
+    if(done == NULL) {
+        return AES_EINVAL;
+    }
+
+    try {
+        c->coalescer.Submit(iv, in, out, len, done, arg);
+    }
+    catch(const std::bad_alloc &) {
+        return AES_ENOMEM;
+    }
+
+    return AES_OK;
+}
+
+void aes_coalescer_flush(aes_coalescer *c) {
+    c->coalescer.Flush();
+}
+
+void aes_coalescer_free(aes_coalescer *c) {
+    delete c;
+}
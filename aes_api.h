@@ -0,0 +1,108 @@
+/*
+ * C interface for the AES Encryption project
+ *
+ * The stable interface of libaes.a and libaes.so (make lib); the shared
+ * library exports these functions and nothing else. A key is expanded
+ * once into an opaque handle that any number of threads may then use at
+ * the same time. Functions that can fail return AES_OK or a negative
+ * AES_E code, and leave their outputs untouched on AES_EINVAL.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_API_H
+#define AES_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AES_API __attribute__((visibility("default")))
+
+/* Bumped when a declaration below changes incompatibly */
+#define AES_API_VERSION 1
+
+#define AES_OK 0
+#define AES_EINVAL -1
+#define AES_ENOMEM -2
+#define AES_EAUTH -3
+
+typedef enum {
+    AES_ENGINE_AUTO,
+    AES_ENGINE_TTABLE,
+    AES_ENGINE_AESNI,
+    AES_ENGINE_BITSLICE,
+    AES_ENGINE_VPERM
+} aes_engine;
+
+typedef struct aes_key aes_key;
+typedef struct aes_coalescer aes_coalescer;
+
+/* Completion callback of aes_coalescer_submit() */
+typedef void (*aes_done_fn)(void *arg);
+
+/* AES_API_VERSION of the library, to compare with the header a program was built against */
+AES_API int aes_api_version(void);
+
+/* Expand a 16, 24 or 32-byte key; an engine the CPU lacks falls back as AES_ENGINE_AUTO would */
+AES_API int aes_key_new(const uint8_t *key, size_t key_len, aes_engine engine, aes_key **out);
+
+/* Zeroize and free a key; NULL is ignored */
+AES_API void aes_key_free(aes_key *key);
+
+/* Name of the engine the key runs on */
+AES_API const char *aes_key_engine(const aes_key *key);
+
+/* ECB over whole blocks; in and out may be the same buffer */
+AES_API void aes_encrypt_blocks(const aes_key *key, const uint8_t *in, uint8_t *out, size_t blocks);
+AES_API void aes_decrypt_blocks(const aes_key *key, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* CTR over len bytes starting offset bytes into the keystream of counter block iv; encrypts and decrypts */
+AES_API void aes_ctr(const aes_key *key, const uint8_t iv[16], uint64_t offset, const uint8_t *in, uint8_t *out, size_t len);
+
+/*
+ * CBC with PKCS#7 padding. Encryption writes len / 16 * 16 + 16 bytes;
+ * decryption takes a nonzero multiple of 16 and returns AES_EAUTH if the
+ * padding is invalid. out may be in, iv is not changed, and *out_len
+ * receives the output length.
+ */
+AES_API int aes_cbc_encrypt(const aes_key *key, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, size_t *out_len);
+AES_API int aes_cbc_decrypt(const aes_key *key, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, size_t *out_len);
+
+/*
+ * GCM over one message with a 16-byte tag. aes_gcm_open() checks the first
+ * tag_len (4 to 16) bytes of tag and, when they do not match, zeroes out
+ * and returns AES_EAUTH.
+ */
+AES_API int aes_gcm_seal(const aes_key *key, const uint8_t *iv, size_t iv_len, const uint8_t *aad, size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, uint8_t tag[16]);
+AES_API int aes_gcm_open(const aes_key *key, const uint8_t *iv, size_t iv_len, const uint8_t *aad, size_t aad_len, const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag, size_t tag_len);
+
+/*
+ * Batch small CTR requests from many threads into full engine calls, as
+ * described in aes_coalesce.h. No request waits much longer than
+ * latency_us before it is sent. key must outlive the coalescer.
+ */
+AES_API int aes_coalescer_new(const aes_key *key, unsigned int latency_us, aes_coalescer **out);
+
+/*
+ * Queue len bytes of CTR under counter block iv, as aes_ctr() with offset
+ * 0. done(arg) runs, on the coalescer's thread, once out is written; in and
+ * out must stay valid until then. Requests over 256 bytes run at once on
+ * the calling thread.
+ */
+AES_API int aes_coalescer_submit(aes_coalescer *c, const uint8_t iv[16], const uint8_t *in, uint8_t *out, size_t len, aes_done_fn done, void *arg);
+
+/* Send everything queued without waiting out the latency bound, and wait for it */
+AES_API void aes_coalescer_flush(aes_coalescer *c);
+
+/* Finish every queued request and free the coalescer; NULL is ignored */
+AES_API void aes_coalescer_free(aes_coalescer *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
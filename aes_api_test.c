@@ -0,0 +1,211 @@
+/*
+ * Checks of the C interface for the AES Encryption project
+ *
+ * Built as C and linked against libaes.so by make lib, so it sees only
+ * what aes_api.h exports. Checks the FIPS-197 example on every engine,
+ * the AES_EINVAL and AES_EAUTH contracts, and a coalescer from creation
+ * to free. Exits nonzero if any check fails.
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "aes_api.h"
+
+/* Requests queued on the coalescer; the last one is over the 256-byte direct limit */
+#define API_TEST_REQUESTS 8
+
+static int failures = 0;
+
+static void Check(int ok, const char *what) {
+    if(!ok) {
+        printf("C API check failed: %s\n", what);
+        failures++;
+    }
+}
+
+/* Completion callback; runs on the coalescer's thread */
+static void Done(void *arg) {
+    __atomic_fetch_add((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+static int IsZero(const uint8_t *p, size_t len) {
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        if(p[i] != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* FIPS-197 Appendix C.1 on every engine, and the arguments aes_key_new() must refuse */
+static void CheckKeys(void) {
+    const uint8_t key[32] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    const uint8_t in[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    const uint8_t expected[16] = { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+    aes_key *sentinel = (aes_key *)&failures;
+    aes_key *k;
+    uint8_t out[16];
+    int engine;
+
+    for(engine = AES_ENGINE_AUTO; engine <= AES_ENGINE_VPERM; engine++) {
+        k = NULL;
+        Check(aes_key_new(key, 16, (aes_engine)engine, &k) == AES_OK && k != NULL, "aes_key_new on a valid key");
+        if(k == NULL) {
+            continue;
+        }
+        aes_encrypt_blocks(k, in, out, 1);
+        Check(memcmp(out, expected, 16) == 0, aes_key_engine(k));
+        aes_decrypt_blocks(k, out, out, 1);
+        Check(memcmp(out, in, 16) == 0, "aes_decrypt_blocks inverts aes_encrypt_blocks");
+        aes_key_free(k);
+    }
+
+    /* *out is left alone on AES_EINVAL */
+    k = sentinel;
+    Check(aes_key_new(key, 0, AES_ENGINE_AUTO, &k) == AES_EINVAL, "aes_key_new refuses a 0-byte key");
+    Check(aes_key_new(key, 20, AES_ENGINE_AUTO, &k) == AES_EINVAL, "aes_key_new refuses a 20-byte key");
+    Check(aes_key_new(key, 16, (aes_engine)(AES_ENGINE_VPERM + 1), &k) == AES_EINVAL, "aes_key_new refuses an unknown engine");
+    Check(aes_key_new(key, 16, (aes_engine)-1, &k) == AES_EINVAL, "aes_key_new refuses a negative engine");
+    Check(k == sentinel, "aes_key_new leaves *out alone on AES_EINVAL");
+
+    aes_key_free(NULL);
+}
+
+/* CBC round trip, then the lengths aes_cbc_decrypt() refuses and a bad padding */
+static void CheckCbc(const aes_key *k) {
+    const uint8_t iv[16] = { 0x01 };
+    uint8_t in[40];
+    uint8_t out[48];
+    uint8_t back[48];
+    size_t outLen = 0;
+    size_t backLen = 0;
+    size_t i;
+
+    for(i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)(i * 7);
+    }
+
+    Check(aes_cbc_encrypt(k, iv, in, out, sizeof(in), &outLen) == AES_OK && outLen == 48, "aes_cbc_encrypt pads to 48 bytes");
+    Check(aes_cbc_decrypt(k, iv, out, back, outLen, &backLen) == AES_OK && backLen == sizeof(in) && memcmp(back, in, sizeof(in)) == 0, "aes_cbc_decrypt round trip");
+
+    memset(back, 0x5C, sizeof(back));
+    backLen = 12345;
+    Check(aes_cbc_decrypt(k, iv, out, back, 0, &backLen) == AES_EINVAL, "aes_cbc_decrypt refuses 0 bytes");
+    Check(aes_cbc_decrypt(k, iv, out, back, 40, &backLen) == AES_EINVAL, "aes_cbc_decrypt refuses a partial block");
+    Check(backLen == 12345 && back[0] == 0x5C && back[47] == 0x5C, "aes_cbc_decrypt leaves its outputs alone on AES_EINVAL");
+
+    /* A plaintext block of 0x00 padding is invalid */
+    memset(back, 0, 16);
+    aes_cbc_encrypt(k, iv, back, out, 16, &outLen);
+    Check(aes_cbc_decrypt(k, iv, out, back, 16, &backLen) == AES_EAUTH, "aes_cbc_decrypt reports bad padding as AES_EAUTH");
+}
+
+/* GCM test case 2 of the GCM specification, then a forged tag and the arguments aes_gcm_open() refuses */
+static void CheckGcm(void) {
+    const uint8_t key[16] = { 0 };
+    const uint8_t iv[12] = { 0 };
+    const uint8_t in[16] = { 0 };
+    const uint8_t expected[16] = { 0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78 };
+    const uint8_t expectedTag[16] = { 0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd, 0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf };
+    aes_key *k = NULL;
+    uint8_t out[16];
+    uint8_t back[16];
+    uint8_t tag[16];
+
+    if(aes_key_new(key, 16, AES_ENGINE_AUTO, &k) != AES_OK) {
+        Check(0, "aes_key_new for GCM");
+        return;
+    }
+
+    Check(aes_gcm_seal(k, iv, 12, NULL, 0, in, out, 16, tag) == AES_OK, "aes_gcm_seal");
+    Check(memcmp(out, expected, 16) == 0 && memcmp(tag, expectedTag, 16) == 0, "aes_gcm_seal matches GCM test case 2");
+    Check(aes_gcm_open(k, iv, 12, NULL, 0, out, back, 16, tag, 16) == AES_OK && memcmp(back, in, 16) == 0, "aes_gcm_open round trip");
+    Check(aes_gcm_open(k, iv, 12, NULL, 0, out, back, 16, tag, 4) == AES_OK, "aes_gcm_open with a 4-byte tag");
+
+    memset(back, 0x5C, sizeof(back));
+    Check(aes_gcm_seal(k, iv, 0, NULL, 0, in, back, 16, tag) == AES_EINVAL, "aes_gcm_seal refuses an empty IV");
+    Check(aes_gcm_open(k, iv, 0, NULL, 0, out, back, 16, tag, 16) == AES_EINVAL, "aes_gcm_open refuses an empty IV");
+    Check(aes_gcm_open(k, iv, 12, NULL, 0, out, back, 16, tag, 3) == AES_EINVAL, "aes_gcm_open refuses a 3-byte tag");
+    Check(aes_gcm_open(k, iv, 12, NULL, 0, out, back, 16, tag, 17) == AES_EINVAL, "aes_gcm_open refuses a 17-byte tag");
+    Check(back[0] == 0x5C && back[15] == 0x5C, "aes_gcm_open leaves out alone on AES_EINVAL");
+
+    /* A forged tag must not release any plaintext */
+    tag[0] ^= 1;
+    memset(back, 0x5C, sizeof(back));
+    Check(aes_gcm_open(k, iv, 12, NULL, 0, out, back, 16, tag, 16) == AES_EAUTH, "aes_gcm_open reports a forged tag as AES_EAUTH");
+    Check(IsZero(back, sizeof(back)), "aes_gcm_open zeroes out on AES_EAUTH");
+
+    aes_key_free(k);
+}
+
+/* A coalescer from aes_coalescer_new() to aes_coalescer_free(), against aes_ctr() */
+static void CheckCoalescer(const aes_key *k) {
+    static uint8_t in[API_TEST_REQUESTS][512];
+    static uint8_t out[API_TEST_REQUESTS][512];
+    static uint8_t expected[API_TEST_REQUESTS][512];
+    uint8_t iv[API_TEST_REQUESTS][16];
+    aes_coalescer *c = NULL;
+    int done = 0;
+    size_t len;
+    int i;
+
+    if(aes_coalescer_new(k, 1000, &c) != AES_OK || c == NULL) {
+        Check(0, "aes_coalescer_new");
+        return;
+    }
+
+    Check(aes_coalescer_submit(c, iv[0], in[0], out[0], 16, NULL, NULL) == AES_EINVAL, "aes_coalescer_submit refuses a NULL callback");
+
+    for(i = 0; i < API_TEST_REQUESTS; i++) {
+        len = i + 1 < API_TEST_REQUESTS ? (size_t)(i + 1) * 16 + i : 512;
+        memset(iv[i], i, 16);
+        memset(in[i], 0xA0 + i, len);
+        aes_ctr(k, iv[i], 0, in[i], expected[i], len);
+        Check(aes_coalescer_submit(c, iv[i], in[i], out[i], len, Done, &done) == AES_OK, "aes_coalescer_submit");
+    }
+    aes_coalescer_flush(c);
+    Check(__atomic_load_n(&done, __ATOMIC_RELAXED) == API_TEST_REQUESTS, "aes_coalescer_flush waits for every callback");
+
+    for(i = 0; i < API_TEST_REQUESTS; i++) {
+        len = i + 1 < API_TEST_REQUESTS ? (size_t)(i + 1) * 16 + i : 512;
+        Check(memcmp(out[i], expected[i], len) == 0, "coalesced CTR matches aes_ctr");
+    }
+
+    /* Freeing finishes what is still queued */
+    Check(aes_coalescer_submit(c, iv[0], in[0], out[0], 16, Done, &done) == AES_OK, "aes_coalescer_submit before free");
+    aes_coalescer_free(c);
+    Check(__atomic_load_n(&done, __ATOMIC_RELAXED) == API_TEST_REQUESTS + 1, "aes_coalescer_free finishes queued requests");
+
+    aes_coalescer_free(NULL);
+}
+
+int main(void) {
+    const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    aes_key *k = NULL;
+
+    Check(aes_api_version() == AES_API_VERSION, "aes_api_version matches aes_api.h");
+
+    CheckKeys();
+    CheckGcm();
+
+    if(aes_key_new(key, 16, AES_ENGINE_AUTO, &k) == AES_OK) {
+        CheckCbc(k);
+        CheckCoalescer(k);
+        aes_key_free(k);
+    }
+    else {
+        Check(0, "aes_key_new");
+    }
+
+    if(failures == 0) {
+        printf("C API checks passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,532 @@
+/*
+ * Avalanche statistics for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <emmintrin.h>
+
+#include <mutex>
+#include <vector>
+
+#include "aes_avalanche.h"
+#include "aes_core.h"
+#include "aes_engine.h"
+
+static inline uint64_t Rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/* SplitMix64 step, used to spread a seed over the generator state */
+static uint64_t SplitMix(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void SeedRng(Rng *rng, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ SplitMix(&stream);
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        rng->s[i] = SplitMix(&x);
+    }
+}
+
+uint64_t NextRandom(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = Rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Rotl64(s[3], 45);
+
+    return result;
+}
+
+/*
+ * XOR, then count bits with the SWAR sums of 2, 4 and 8 bits and a SAD
+ * against zero to add the 16 byte counts. SSE2 only, so no CPU check.
+ */
+int StateDistance(const unsigned int *a, const unsigned int *b) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+
+    x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(0x55)));
+    x = _mm_add_epi8(_mm_and_si128(x, _mm_set1_epi8(0x33)), _mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi8(0x33)));
+    x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), _mm_set1_epi8(0x0F));
+    x = _mm_sad_epu8(x, _mm_setzero_si128());
+
+    return _mm_cvtsi128_si32(x) + _mm_extract_epi16(x, 4);
+}
+
+/* Trace state through the rounds: states[0] is the input, states[r + 1] the state after round r */
+static inline void TraceRounds(const unsigned int *w, const unsigned int *state, unsigned int (*states)[4]) {
+    memcpy(states[0], state, 16);
+    TraceStateTTable<10>(w, state, states + 1);
+}
+
+/* Flip bit b of a state, counting from the most significant bit of the first byte */
+static inline void FlipBit(unsigned int *state, int b) {
+    state[b / 32] ^= 0x80000000u >> (b % 32);
+}
+
+/* Random plaintexts traced once each, then flips trials against the cached reference */
+static void AvalancheTask(const unsigned int *w, const AvalancheOptions *options, uint64_t trials, Rng *rng, AvalancheStats *local) {
+    unsigned int reference[AVALANCHE_STATES][4];
+    unsigned int states[AVALANCHE_STATES][4];
+    unsigned int input[4];
+    uint64_t done = 0;
+    unsigned int f;
+    int s;
+
+    while(done < trials) {
+        uint64_t r0 = NextRandom(rng);
+        uint64_t r1 = NextRandom(rng);
+
+        input[0] = r0 >> 32;
+        input[1] = (unsigned int)r0;
+        input[2] = r1 >> 32;
+        input[3] = (unsigned int)r1;
+        TraceRounds(w, input, reference);
+
+        for(f = 0; f < options->flips && done < trials; f++, done++) {
+            int b = NextRandom(rng) >> 57;
+
+            FlipBit(input, b);
+            TraceRounds(w, input, states);
+            FlipBit(input, b);
+
+            for(s = 0; s < AVALANCHE_STATES; s++) {
+                local->histogram[s][StateDistance(reference[s], states[s])]++;
+            }
+        }
+    }
+
+    local->trials += trials;
+}
+
+/* Add the histograms of one task into the totals */
+static void MergeHistograms(uint64_t (*total)[129], const uint64_t (*part)[129], int rows) {
+    int s;
+    int d;
+
+    for(s = 0; s < rows; s++) {
+        for(d = 0; d <= 128; d++) {
+            total[s][d] += part[s][d];
+        }
+    }
+}
+
+void RunAvalanche(const unsigned int *w, const AvalancheOptions *options, AvalancheStats *stats, ThreadPool &pool) {
+    size_t tasks = (options->trials + AVALANCHE_TASK_TRIALS - 1) / AVALANCHE_TASK_TRIALS;
+    std::mutex lock;
+
+    memset(stats, 0, sizeof(AvalancheStats));
+
+    /* Task t always draws from stream t, so the thread count does not change the result */
+    pool.ParallelFor(tasks, [&](size_t task) {
+        uint64_t first = task * AVALANCHE_TASK_TRIALS;
+        uint64_t trials = options->trials - first < AVALANCHE_TASK_TRIALS ? options->trials - first : AVALANCHE_TASK_TRIALS;
+        AvalancheStats local;
+        Rng rng;
+
+        memset(&local, 0, sizeof(local));
+        SeedRng(&rng, options->seed, task);
+        AvalancheTask(w, options, trials, &rng, &local);
+
+        std::lock_guard<std::mutex> guard(lock);
+        stats->trials += local.trials;
+        MergeHistograms(stats->histogram, local.histogram, AVALANCHE_STATES);
+    });
+}
+
+/* Mean and variance of each row's histogram, then the histograms side by side; row r is labelled r + label */
+static void PrintHistograms(const uint64_t (*histogram)[129], int rows, int label, uint64_t trials) {
+    int first = 128;
+    int last = 0;
+    int s;
+    int d;
+
+    printf("Round      Mean  Variance  Std dev\n");
+
+    for(s = 0; s < rows; s++) {
+        double sum = 0;
+        double squares = 0;
+        double mean;
+        double variance;
+
+        for(d = 0; d <= 128; d++) {
+            sum += (double)d * histogram[s][d];
+            squares += (double)d * d * histogram[s][d];
+            if(histogram[s][d]) {
+                first = d < first ? d : first;
+                last = d > last ? d : last;
+            }
+        }
+        mean = trials ? sum / trials : 0;
+        variance = trials ? squares / trials - mean * mean : 0;
+
+        printf("%5d  %8.3f  %8.3f  %7.3f\n", s + label, mean, variance, variance > 0 ? sqrt(variance) : 0);
+    }
+
+    /* Rows are bits changed, columns are rounds */
+    printf("\nBits");
+    for(s = 0; s < rows; s++) {
+        printf(" %10d", s + label);
+    }
+    printf("\n");
+    for(d = first; d <= last; d++) {
+        printf("%4d", d);
+        for(s = 0; s < rows; s++) {
+            printf(" %10llu", (unsigned long long)histogram[s][d]);
+        }
+        printf("\n");
+    }
+}
+
+void PrintAvalanche(const AvalancheStats *stats) {
+    printf("\n%llu trials\n\n", (unsigned long long)stats->trials);
+
+    /* Round -1 is the input */
+    PrintHistograms(stats->histogram, AVALANCHE_STATES, -1, stats->trials);
+}
+
+/* Key bit b flipped, counting from the most significant bit of the first byte */
+static inline void FlipKeyBit(uint8_t *key, int b) {
+    key[b / 8] ^= 0x80 >> (b % 8);
+}
+
+/*
+ * ExpandKey() of a key differing from an expanded key in bit b only. The
+ * key words before the flipped one are unchanged, and so are w[4] for a
+ * flip in word 1 or 2 and w[5] for a flip in word 2, since they depend on
+ * w[0], w[1] and w[3] alone; the recurrence restarts at the first word
+ * that changes. Used when the batched expansion is not available.
+ */
+static void ExpandFlippedKey(const unsigned int *base, int b, unsigned int *w) {
+    int q = b / 32;
+    int start = q == 1 || q == 2 ? 4 + q : 4;
+    int i;
+
+    memcpy(w, base, sizeof(unsigned int) * start);
+    w[q] ^= 0x80000000u >> (b % 32);
+
+    for(i = start; i < 44; i++) {
+        unsigned int tmp = w[i - 1];
+
+        if(i % 4 == 0) {
+            tmp = SubWord(RotWord(tmp)) ^ (RC[i / 4 - 1] << 24);
+        }
+        w[i] = w[i - 4] ^ tmp;
+    }
+}
+
+/*
+ * One batch of KEYFLIP_GROUP random keys and plaintexts. Each key is
+ * followed in the batch by its flips perturbed copies, and all of them are
+ * expanded together before any is used.
+ */
+static void KeyFlipGroup(const AvalancheOptions *options, uint64_t trials, Rng *rng, KeyAvalancheStats *local,
+                         uint8_t (*keys)[16], const uint8_t **keyPtrs, int *bits, unsigned int (*w)[44]) {
+    const unsigned int stride = options->flips + 1;
+    unsigned int reference[AVALANCHE_STATES][4];
+    unsigned int states[AVALANCHE_STATES][4];
+    unsigned int input[KEYFLIP_GROUP][4];
+    size_t count = 0;
+    uint64_t done;
+    unsigned int f;
+    int g;
+    int s;
+
+    /* Lay out each random key, then its perturbed copies, until trials are covered */
+    for(g = 0, done = 0; g < KEYFLIP_GROUP && done < trials; g++) {
+        uint64_t r0 = NextRandom(rng);
+        uint64_t r1 = NextRandom(rng);
+        uint64_t k0 = NextRandom(rng);
+        uint64_t k1 = NextRandom(rng);
+
+        input[g][0] = r0 >> 32;
+        input[g][1] = (unsigned int)r0;
+        input[g][2] = r1 >> 32;
+        input[g][3] = (unsigned int)r1;
+        memcpy(keys[count], &k0, 8);
+        memcpy(keys[count] + 8, &k1, 8);
+        bits[count++] = -1;
+
+        for(f = 0; f < options->flips && done < trials; f++, done++) {
+            memcpy(keys[count], keys[g * stride], 16);
+            bits[count] = NextRandom(rng) >> 57;
+            FlipKeyBit(keys[count], bits[count]);
+            count++;
+        }
+    }
+
+    if(HasAesNi()) {
+        for(size_t n = 0; n < count; n++) {
+            keyPtrs[n] = keys[n];
+        }
+        ExpandKeyWordsNi<4>(keyPtrs, &w[0][0], count);
+    }
+    else {
+        for(size_t n = 0; n < count; n++) {
+            if(bits[n] < 0) {
+                ExpandKey<4>(keys[n], w[n]);
+            }
+            else {
+                ExpandFlippedKey(w[n - n % stride], bits[n], w[n]);
+            }
+        }
+    }
+
+    /* The original key's trace is cached and compared with each flip */
+    for(size_t n = 0; n < count; n++) {
+        const unsigned int *base = w[n - n % stride];
+
+        g = n / stride;
+        if(bits[n] < 0) {
+            TraceRounds(w[n], input[g], reference);
+            continue;
+        }
+
+        TraceRounds(w[n], input[g], states);
+        for(s = 0; s < AVALANCHE_STATES; s++) {
+            local->states.histogram[s][StateDistance(reference[s], states[s])]++;
+        }
+        for(s = 0; s < AVALANCHE_ROUND_KEYS; s++) {
+            local->keyHistogram[s][StateDistance(base + 4 * s, w[n] + 4 * s)]++;
+        }
+        local->states.trials++;
+    }
+}
+
+void RunKeyAvalanche(const AvalancheOptions *options, KeyAvalancheStats *stats, ThreadPool &pool) {
+    size_t tasks = (options->trials + AVALANCHE_TASK_TRIALS - 1) / AVALANCHE_TASK_TRIALS;
+    std::mutex lock;
+
+    memset(stats, 0, sizeof(KeyAvalancheStats));
+
+    /* No flips would never finish a trial; too many would size every task's batch past reason */
+    if(options->flips == 0 || options->flips > AVALANCHE_MAX_FLIPS) {
+        return;
+    }
+
+    pool.ParallelFor(tasks, [&](size_t task) {
+        uint64_t first = task * AVALANCHE_TASK_TRIALS;
+        uint64_t trials = options->trials - first < AVALANCHE_TASK_TRIALS ? options->trials - first : AVALANCHE_TASK_TRIALS;
+        size_t batch = (size_t)KEYFLIP_GROUP * ((size_t)options->flips + 1);
+        std::vector<uint8_t> keyBytes(16 * batch);
+        std::vector<const uint8_t *> keyPtrs(batch);
+        std::vector<int> bits(batch);
+        std::vector<unsigned int> words(44 * batch);
+        KeyAvalancheStats *local = new KeyAvalancheStats;
+        Rng rng;
+
+        memset(local, 0, sizeof(KeyAvalancheStats));
+        SeedRng(&rng, options->seed, task);
+
+        while(local->states.trials < trials) {
+            KeyFlipGroup(options, trials - local->states.trials, &rng, local, (uint8_t (*)[16])keyBytes.data(), keyPtrs.data(),
+                         bits.data(), (unsigned int (*)[44])words.data());
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stats->states.trials += local->states.trials;
+            MergeHistograms(stats->states.histogram, local->states.histogram, AVALANCHE_STATES);
+            MergeHistograms(stats->keyHistogram, local->keyHistogram, AVALANCHE_ROUND_KEYS);
+        }
+        delete local;
+    });
+}
+
+void PrintKeyAvalanche(const KeyAvalancheStats *stats) {
+    printf("\n%llu key bit flips\n\nRound keys\n\n", (unsigned long long)stats->states.trials);
+    PrintHistograms(stats->keyHistogram, AVALANCHE_ROUND_KEYS, 0, stats->states.trials);
+
+    printf("\nCipher states\n\n");
+    PrintHistograms(stats->states.histogram, AVALANCHE_STATES, -1, stats->states.trials);
+}
+
+static_assert(SAC_TASK_INPUTS < (1 << SAC_PLANES), "A task must not overflow its vertical counters");
+
+/*
+ * Vertical counters: plane p of counter [r][i] holds bit p of the count
+ * for each of the 128 output bits, so one trial adds a whole difference
+ * vector with a ripple-carry over the planes. The carry rarely passes the
+ * first few planes.
+ */
+struct SacPlanes {
+    __m128i planes[SAC_ROUNDS][128][SAC_PLANES];
+};
+
+static inline void AddVertical(__m128i *planes, __m128i carry) {
+    const __m128i zero = _mm_setzero_si128();
+    int p;
+
+    for(p = 0; p < SAC_PLANES && _mm_movemask_epi8(_mm_cmpeq_epi8(carry, zero)) != 0xFFFF; p++) {
+        __m128i t = _mm_and_si128(planes[p], carry);
+        planes[p] = _mm_xor_si128(planes[p], carry);
+        carry = t;
+    }
+}
+
+/* Add the vertical counters of one task into the matrix */
+static void FlushVertical(const SacPlanes *v, SacMatrix *sac) {
+    unsigned int plane[SAC_PLANES][4];
+    int r;
+    int i;
+    int j;
+    int p;
+
+    for(r = 0; r < SAC_ROUNDS; r++) {
+        for(i = 0; i < 128; i++) {
+            memcpy(plane, v->planes[r][i], sizeof(plane));
+            for(j = 0; j < 128; j++) {
+                uint64_t count = 0;
+                for(p = 0; p < SAC_PLANES; p++) {
+                    count |= (uint64_t)((plane[p][j / 32] >> (31 - j % 32)) & 1) << p;
+                }
+                sac->counts[r][i][j] += count;
+            }
+        }
+    }
+}
+
+void RunSac(const unsigned int *w, const AvalancheOptions *options, SacMatrix *sac, ThreadPool &pool) {
+    uint64_t inputs = (options->trials + 127) / 128;
+    size_t tasks = (inputs + SAC_TASK_INPUTS - 1) / SAC_TASK_INPUTS;
+    std::mutex lock;
+
+    memset(sac, 0, sizeof(SacMatrix));
+    sac->trialsPerBit = inputs;
+
+    pool.ParallelFor(tasks, [&](size_t task) {
+        uint64_t first = task * SAC_TASK_INPUTS;
+        uint64_t count = inputs - first < SAC_TASK_INPUTS ? inputs - first : SAC_TASK_INPUTS;
+        unsigned int reference[AVALANCHE_STATES][4];
+        unsigned int states[AVALANCHE_STATES][4];
+        unsigned int input[4];
+        SacPlanes *v = new SacPlanes;
+        uint64_t n;
+        Rng rng;
+        int i;
+        int r;
+
+        memset(v, 0, sizeof(SacPlanes));
+        SeedRng(&rng, options->seed, task);
+
+        for(n = 0; n < count; n++) {
+            uint64_t r0 = NextRandom(&rng);
+            uint64_t r1 = NextRandom(&rng);
+
+            input[0] = r0 >> 32;
+            input[1] = (unsigned int)r0;
+            input[2] = r1 >> 32;
+            input[3] = (unsigned int)r1;
+            TraceRounds(w, input, reference);
+
+            for(i = 0; i < 128; i++) {
+                FlipBit(input, i);
+                TraceRounds(w, input, states);
+                FlipBit(input, i);
+
+                /* State 0 is the input itself, which is not part of the matrix */
+                for(r = 0; r < SAC_ROUNDS; r++) {
+                    __m128i diff = _mm_xor_si128(_mm_loadu_si128((const __m128i *)reference[r + 1]), _mm_loadu_si128((const __m128i *)states[r + 1]));
+                    AddVertical(v->planes[r][i], diff);
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            FlushVertical(v, sac);
+        }
+        delete v;
+    });
+}
+
+void PrintSac(const SacMatrix *sac) {
+    int r;
+    int i;
+    int j;
+
+    printf("\n%llu trials per input bit\n\n", (unsigned long long)sac->trialsPerBit);
+    printf("Round  Min prob  Max prob  Mean |p - 1/2|  Max |p - 1/2|\n");
+
+    for(r = 0; r < SAC_ROUNDS; r++) {
+        double low = 1;
+        double high = 0;
+        double deviation = 0;
+        double worst = 0;
+
+        for(i = 0; i < 128; i++) {
+            for(j = 0; j < 128; j++) {
+                double p = sac->trialsPerBit ? (double)sac->counts[r][i][j] / sac->trialsPerBit : 0;
+                double d = fabs(p - 0.5);
+
+                low = p < low ? p : low;
+                high = p > high ? p : high;
+                deviation += d;
+                worst = d > worst ? d : worst;
+            }
+        }
+
+        printf("%5d  %8.5f  %8.5f  %14.5f  %13.5f\n", r, low, high, deviation / (128 * 128), worst);
+    }
+}
+
+bool WriteSacCsv(const SacMatrix *sac, const char *path) {
+    FILE *f = fopen(path, "w");
+    int r;
+    int i;
+    int j;
+
+    if(f == NULL) {
+        return false;
+    }
+
+    fprintf(f, "round,input_bit,output_bit,probability\n");
+    for(r = 0; r < SAC_ROUNDS; r++) {
+        for(i = 0; i < 128; i++) {
+            for(j = 0; j < 128; j++) {
+                fprintf(f, "%d,%d,%d,%.6f\n", r, i, j, sac->trialsPerBit ? (double)sac->counts[r][i][j] / sac->trialsPerBit : 0);
+            }
+        }
+    }
+
+    return fclose(f) == 0;
+}
+
+bool WriteSacBinary(const SacMatrix *sac, const char *path) {
+    FILE *f = fopen(path, "wb");
+    double row[128];
+    bool ok = true;
+    int r;
+    int i;
+    int j;
+
+    if(f == NULL) {
+        return false;
+    }
+
+    for(r = 0; r < SAC_ROUNDS; r++) {
+        for(i = 0; i < 128; i++) {
+            for(j = 0; j < 128; j++) {
+                row[j] = sac->trialsPerBit ? (double)sac->counts[r][i][j] / sac->trialsPerBit : 0;
+            }
+            ok = ok && fwrite(row, sizeof(row), 1, f) == 1;
+        }
+    }
+
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,117 @@
+/*
+ * Avalanche statistics for the AES Encryption project
+ *
+ * aes_multiple.cpp traces one input and three copies with a bit flipped
+ * through the rounds. The functions here run the same experiment as many
+ * independent trials spread over a thread pool, and accumulate how many
+ * state bits each flip changed after every round.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_AVALANCHE_H
+#define AES_AVALANCHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_pool.h"
+
+/* States compared per trial: the input, then the state after rounds 0 to 10 */
+#define AVALANCHE_STATES 12
+
+/* Trials run by one pool task, each task with its own generator */
+#define AVALANCHE_TASK_TRIALS (1 << 16)
+
+/* xoshiro256** generator; streams from one seed do not overlap in practice */
+struct Rng {
+    uint64_t s[4];
+};
+
+/* Seed stream number stream of seed */
+void SeedRng(Rng *rng, uint64_t seed, uint64_t stream);
+
+uint64_t NextRandom(Rng *rng);
+
+/* Most bits flipped against one random input */
+#define AVALANCHE_MAX_FLIPS 128
+
+struct AvalancheOptions {
+    uint64_t trials;
+    uint64_t seed;
+    /* Bits flipped, one trial each, against every random input; 1 to AVALANCHE_MAX_FLIPS */
+    unsigned int flips;
+};
+
+struct AvalancheStats {
+    uint64_t trials;
+    /* histogram[s][d]: trials whose state s differed from the reference in d bits */
+    uint64_t histogram[AVALANCHE_STATES][129];
+};
+
+/* Number of differing bits between two 128-bit states */
+int StateDistance(const unsigned int *a, const unsigned int *b);
+
+/* Round keys compared per key-flip trial: rounds 0 to 10 of AES-128 */
+#define AVALANCHE_ROUND_KEYS 11
+
+/* Random keys whose perturbed copies are expanded in one batch */
+#define KEYFLIP_GROUP 8
+
+struct KeyAvalancheStats {
+    /* Cipher states under the original and the flipped key, for the same plaintext */
+    AvalancheStats states;
+    /* keyHistogram[r][d]: trials whose round key r differed in d bits */
+    uint64_t keyHistogram[AVALANCHE_ROUND_KEYS][129];
+};
+
+/* Round states in a strict avalanche criterion matrix: after rounds 0 to 10 */
+#define SAC_ROUNDS 11
+
+/* Bit planes of the vertical counters; a counter holds up to 2^SAC_PLANES - 1 trials */
+#define SAC_PLANES 16
+
+/* Random inputs per pool task; each is flipped in all 128 bits */
+#define SAC_TASK_INPUTS 8192
+
+/*
+ * counts[r][i][j]: trials in which flipping input bit i flipped bit j of
+ * the state after round r. Every input bit gets the same trialsPerBit
+ * trials, so counts / trialsPerBit is the flip probability. Bits count from
+ * the most significant bit of the first byte. About 1.4 MB; allocate it on
+ * the heap.
+ */
+struct SacMatrix {
+    uint64_t trialsPerBit;
+    uint64_t counts[SAC_ROUNDS][128][128];
+};
+
+/* Run options->trials plaintext bit flips under the AES-128 schedule w; the result depends only on the options, not on the pool size */
+void RunAvalanche(const unsigned int *w, const AvalancheOptions *options, AvalancheStats *stats, ThreadPool &pool);
+
+/* Mean and variance of the bits changed in each state, then the histograms */
+void PrintAvalanche(const AvalancheStats *stats);
+
+/*
+ * Run options->trials AES-128 key bit flips, options->flips against each
+ * random key and plaintext, comparing the round keys and the cipher states
+ * of the two keys. Deterministic like RunAvalanche().
+ */
+void RunKeyAvalanche(const AvalancheOptions *options, KeyAvalancheStats *stats, ThreadPool &pool);
+
+/* Round key diffusion, then cipher state diffusion, as PrintAvalanche() */
+void PrintKeyAvalanche(const KeyAvalancheStats *stats);
+
+/* Fill the SAC matrix from options->trials bit flips, rounded up to whole inputs of 128 flips; deterministic like RunAvalanche() */
+void RunSac(const unsigned int *w, const AvalancheOptions *options, SacMatrix *sac, ThreadPool &pool);
+
+/* Per-round spread of the flip probabilities around 1/2 */
+void PrintSac(const SacMatrix *sac);
+
+/* One "round,input_bit,output_bit,probability" row per matrix entry, for heatmap tools */
+bool WriteSacCsv(const SacMatrix *sac, const char *path);
+
+/* The probabilities as SAC_ROUNDS x 128 x 128 native-endian doubles, round-major */
+bool WriteSacBinary(const SacMatrix *sac, const char *path);
+
+#endif
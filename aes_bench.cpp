@@ -0,0 +1,695 @@
+/*
+ * Benchmark program for the AES Encryption project
+ *
+ * Measures key setup, single-block latency and bulk throughput of every
+ * round engine and mode, with the step-by-step protocols from aes_core as
+ * the baseline. Each measurement is warmed up, calibrated so one sample
+ * lasts at least BENCH_SAMPLE_NS, and repeated; the median and 99th
+ * percentile of the samples are reported. Cycles are TSC ticks, which run
+ * at a fixed rate on current CPUs whatever the core clock is doing.
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "aes_core.h"
+#include "aes_engine.h"
+#include "aes_gcm.h"
+#include "aes_modes.h"
+#include "aes_coalesce.h"
+#include "aes_pool.h"
+#include "aes_xts.h"
+
+/* Shortest sample; quick operations are repeated until a sample lasts this long */
+#define BENCH_SAMPLE_NS 1000000.0
+
+/* Fewest samples taken for a measurement, however long they run */
+#define BENCH_MIN_SAMPLES 5
+
+/* Keys expanded per call when timing InitializeContexts() */
+#define BENCH_KEY_BATCH 256
+
+/* Independent messages the buffer is split into for the cbc-streams mode */
+#define BENCH_CBC_STREAMS 16
+
+/* Messages per coalesce sample and their length */
+#define BENCH_MESSAGES 1024
+#define BENCH_MESSAGE 64
+
+/* Sector size for the xts mode and the sector latency */
+#define BENCH_SECTOR 4096
+
+/* The step-by-step protocols are timed on messages up to this size only */
+#define BENCH_STEPS_MAX (1024 * 1024)
+
+/* Largest -min or -max, so the buffer size arithmetic cannot wrap */
+#define BENCH_MAX_SIZE ((size_t)1 << 40)
+
+/* Most threads -threads may ask for */
+#define BENCH_MAX_THREADS 1024
+
+struct BenchOptions {
+    size_t minSize;
+    size_t maxSize;
+    unsigned int maxThreads;
+    int reps;
+    double budget;
+    size_t keyBytes;
+    const char *csv;
+    const char *json;
+};
+
+struct BenchResult {
+    const char *test;
+    const char *engine;
+    const char *mode;
+    size_t bytes;
+    unsigned int threads;
+    /* TSC ticks per call */
+    double cyclesMedian;
+    double cyclesP99;
+    /* Wall-clock nanoseconds per call, median */
+    double ns;
+};
+
+/* Engines timed; ENGINE_AUTO stands for the step-by-step protocols */
+static const AesEngine benchEngines[5] = { ENGINE_AUTO, ENGINE_TTABLE, ENGINE_AESNI, ENGINE_BITSLICE, ENGINE_VPERM };
+
+static const char *BenchEngineName(AesEngine engine) {
+    return engine == ENGINE_AUTO ? "steps" : EngineName(engine);
+}
+
+/* Value at fraction p of the sorted samples */
+static double Percentile(const std::vector<double> &sorted, double p) {
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+/*
+ * Time op. One warmup call, then the number of calls per sample is doubled
+ * until a sample lasts BENCH_SAMPLE_NS. Samples are taken until there are
+ * options->reps of them or options->budget seconds have passed, but never
+ * fewer than BENCH_MIN_SAMPLES.
+ */
+static BenchResult Measure(const BenchOptions *options, const std::function<void()> &op) {
+    std::vector<double> ticks;
+    std::vector<double> nanos;
+    BenchResult result;
+    size_t calls = 1;
+    double spent = 0;
+    size_t i;
+
+    op();
+
+    for(;;) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t t0 = __rdtsc();
+        for(i = 0; i < calls; i++) {
+            op();
+        }
+        uint64_t t1 = __rdtsc();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        /* Calibration samples are discarded */
+        if(ns < BENCH_SAMPLE_NS && ticks.empty()) {
+            calls *= 2;
+            continue;
+        }
+
+        ticks.push_back((double)(t1 - t0) / calls);
+        nanos.push_back(ns / calls);
+        spent += ns;
+
+        if((int)ticks.size() >= options->reps || (ticks.size() >= BENCH_MIN_SAMPLES && spent > options->budget * 1e9)) {
+            break;
+        }
+    }
+
+    std::sort(ticks.begin(), ticks.end());
+    std::sort(nanos.begin(), nanos.end());
+
+    memset(&result, 0, sizeof(result));
+    result.cyclesMedian = Percentile(ticks, 0.5);
+    result.cyclesP99 = Percentile(ticks, 0.99);
+    result.ns = Percentile(nanos, 0.5);
+
+    return result;
+}
+
+/* Encrypt consecutive blocks with EncryptState(), loading each as big-endian column words */
+static void EncryptBlocksSteps(const unsigned int *w, int rounds, const uint8_t *in, uint8_t *out, size_t blocks) {
+    unsigned int state[4];
+    size_t n;
+    int i;
+
+    for(n = 0; n < blocks; n++) {
+        for(i = 0; i < 4; i++) {
+            state[i] = ((unsigned int)in[4*i] << 24) | (in[4*i + 1] << 16) | (in[4*i + 2] << 8) | in[4*i + 3];
+        }
+
+        EncryptState(state, w, rounds);
+
+        for(i = 0; i < 4; i++) {
+            out[4*i] = state[i] >> 24;
+            out[4*i + 1] = state[i] >> 16;
+            out[4*i + 2] = state[i] >> 8;
+            out[4*i + 3] = state[i];
+        }
+
+        in += 16;
+        out += 16;
+    }
+}
+
+/* Expand a key with the step-by-step ExpandKey() for its length */
+static void ExpandKeySteps(const uint8_t *key, size_t keyBytes, unsigned int *w) {
+    if(keyBytes == 16) {
+        ExpandKey<4>(key, w);
+    }
+    else if(keyBytes == 24) {
+        ExpandKey<6>(key, w);
+    }
+    else {
+        ExpandKey<8>(key, w);
+    }
+}
+
+class Bench {
+public:
+    explicit Bench(const BenchOptions *options) : options(options) {
+        size_t i;
+
+        /* In-place operation keeps a 1 GiB sweep within one buffer; the batched key setup takes its keys from it too */
+        bufferSize = std::max(options->maxSize + 64 * BENCH_CBC_STREAMS, (size_t)16 * BENCH_KEY_BATCH + 32);
+        buffer = (uint8_t *)aligned_alloc(64, (bufferSize + 63) & ~(size_t)63);
+        if(buffer == NULL) {
+            return;
+        }
+        for(i = 0; i < bufferSize; i++) {
+            buffer[i] = (uint8_t)(i * 131 + 7);
+        }
+        for(i = 0; i < sizeof(key); i++) {
+            key[i] = (uint8_t)(i * 17 + 1);
+        }
+        memset(iv, 0xA5, sizeof(iv));
+    }
+
+    ~Bench() {
+        free(buffer);
+    }
+
+    /* False when the buffer could not be allocated, in which case nothing may be run */
+    bool Allocated() const {
+        return buffer != NULL;
+    }
+
+    size_t BufferSize() const {
+        return bufferSize;
+    }
+
+    void KeySetup();
+    void Latency();
+    void Throughput();
+    void Coalesce();
+
+    std::vector<BenchResult> results;
+
+private:
+    void Record(BenchResult result, const char *test, const char *engine, const char *mode, size_t bytes, unsigned int threads);
+    void ThroughputMode(const char *mode, AesEngine engine, const AesContext *ctx, const unsigned int *w, size_t size);
+
+    const BenchOptions *options;
+    uint8_t *buffer;
+    size_t bufferSize;
+    uint8_t key[32];
+    uint8_t iv[16];
+};
+
+void Bench::Record(BenchResult result, const char *test, const char *engine, const char *mode, size_t bytes, unsigned int threads) {
+    result.test = test;
+    result.engine = engine;
+    result.mode = mode;
+    result.bytes = bytes;
+    result.threads = threads;
+    results.push_back(result);
+
+    printf("%-10s %-9s %-11s %11zu %7u %14.1f %14.1f %9.2f %9.2f %9.3f\n", test, engine, mode, bytes, threads,
+           result.cyclesMedian, result.cyclesP99, result.cyclesMedian / bytes, result.cyclesP99 / bytes, bytes / result.ns);
+    fflush(stdout);
+}
+
+/* Key setup: ExpandKey(), InitializeContext() per engine, and InitializeContexts() per key */
+void Bench::KeySetup() {
+    static AesContext batch[BENCH_KEY_BATCH];
+    std::vector<const uint8_t *> keys(BENCH_KEY_BATCH);
+    const size_t keyBytes = options->keyBytes;
+    unsigned int w[MAX_KEY_WORDS];
+    AesContext ctx;
+    BenchResult r;
+    int i;
+
+    r = Measure(options, [&]() { ExpandKeySteps(key, keyBytes, w); });
+    Record(r, "keysetup", "steps", "expand", keyBytes, 1);
+
+    for(i = 0; i < BENCH_KEY_BATCH; i++) {
+        keys[i] = buffer + 16 * i;
+    }
+
+    for(i = 1; i < 5; i++) {
+        AesEngine engine = benchEngines[i];
+
+        r = Measure(options, [&]() { InitializeContext(&ctx, key, keyBytes, engine); });
+        Record(r, "keysetup", EngineName(engine), "context", keyBytes, 1);
+
+        r = Measure(options, [&]() { InitializeContexts(batch, keys.data(), keyBytes, BENCH_KEY_BATCH, engine); });
+        r.cyclesMedian /= BENCH_KEY_BATCH;
+        r.cyclesP99 /= BENCH_KEY_BATCH;
+        r.ns /= BENCH_KEY_BATCH;
+        Record(r, "keysetup", EngineName(engine), "batch", keyBytes, 1);
+    }
+}
+
+/* Single-block latency: each block is the previous block's output, so no two calls overlap */
+void Bench::Latency() {
+    unsigned int w[MAX_KEY_WORDS];
+    unsigned int state[4] = { 0 };
+    uint8_t block[16] = { 0 };
+    uint8_t xtsKey[64];
+    AesContext ctx;
+    XtsKey xk;
+    BenchResult r;
+    int i;
+
+    ExpandKeySteps(key, options->keyBytes, w);
+    r = Measure(options, [&]() { EncryptState(state, w, options->keyBytes / 4 + 6); });
+    Record(r, "latency", "steps", "block", 16, 1);
+
+    /* AES-128 straight from the key, deriving the round keys as it goes */
+    if(options->keyBytes == 16) {
+        r = Measure(options, [&]() { EncryptBlocksOnTheFly(key, block, block, 1); });
+        Record(r, "latency", "ttable", "onthefly", 16, 1);
+    }
+
+    for(i = 1; i < 5; i++) {
+        InitializeContext(&ctx, key, options->keyBytes, benchEngines[i]);
+        if(ctx.engine != benchEngines[i]) {
+            continue;
+        }
+
+        r = Measure(options, [&]() { EncryptBlocks(&ctx, block, block, 1); });
+        Record(r, "latency", EngineName(ctx.engine), "block", 16, 1);
+
+        /* One sector, whose blocks the XTS batches can overlap */
+        if(options->keyBytes != 24 && bufferSize >= BENCH_SECTOR) {
+            memcpy(xtsKey, key, options->keyBytes);
+            memcpy(xtsKey + options->keyBytes, key, options->keyBytes);
+            xtsKey[options->keyBytes] ^= 1;
+            XtsInitialize(&xk, xtsKey, 2 * options->keyBytes, ctx.engine);
+            r = Measure(options, [&]() { XtsEncrypt(&xk, 0, buffer, buffer, BENCH_SECTOR); });
+            Record(r, "latency", EngineName(ctx.engine), "xts", BENCH_SECTOR, 1);
+        }
+    }
+}
+
+/* Small CTR messages one call each, against the same messages submitted to a Coalescer and flushed */
+void Bench::Coalesce() {
+    const size_t bytes = BENCH_MESSAGES * BENCH_MESSAGE;
+    AesContext ctx;
+    BenchResult r;
+    size_t n;
+    int i;
+
+    if(bufferSize < bytes) {
+        return;
+    }
+
+    for(i = 1; i < 5; i++) {
+        InitializeContext(&ctx, key, options->keyBytes, benchEngines[i]);
+        if(ctx.engine != benchEngines[i]) {
+            continue;
+        }
+
+        r = Measure(options, [&]() {
+            for(n = 0; n < BENCH_MESSAGES; n++) {
+                CtrCrypt(&ctx, iv, 0, buffer + n * BENCH_MESSAGE, buffer + n * BENCH_MESSAGE, BENCH_MESSAGE);
+            }
+        });
+        Record(r, "coalesce", EngineName(ctx.engine), "direct", bytes, 1);
+
+        Coalescer coalescer(&ctx, 1000);
+        r = Measure(options, [&]() {
+            for(n = 0; n < BENCH_MESSAGES; n++) {
+                coalescer.Submit(iv, buffer + n * BENCH_MESSAGE, buffer + n * BENCH_MESSAGE, BENCH_MESSAGE, [](void *) {}, NULL);
+            }
+            coalescer.Flush();
+        });
+        Record(r, "coalesce", EngineName(ctx.engine), "batched", bytes, 1);
+    }
+}
+
+/* One mode over size bytes of the buffer at every thread count the mode supports */
+void Bench::ThroughputMode(const char *mode, AesEngine engine, const AesContext *ctx, const unsigned int *w, size_t size) {
+    const size_t blocks = size / 16;
+    const char *name = BenchEngineName(engine);
+    uint8_t chain[16];
+    GcmKey gk;
+    GcmState gs;
+    uint8_t tag[16];
+    unsigned int threads;
+    BenchResult r;
+
+    if(engine == ENGINE_AUTO) {
+        r = Measure(options, [&]() { EncryptBlocksSteps(w, options->keyBytes / 4 + 6, buffer, buffer, blocks); });
+        Record(r, "bulk", name, mode, size, 1);
+        return;
+    }
+
+    if(strcmp(mode, "ecb") == 0 || strcmp(mode, "ctr") == 0 || strcmp(mode, "xts") == 0) {
+        bool ecb = strcmp(mode, "ecb") == 0;
+        bool xts = strcmp(mode, "xts") == 0;
+        std::vector<XtsSector> sectors;
+        XtsKey xk;
+        size_t i;
+
+        /* XTS has no AES-192 variant; the tweak key is the data key with one bit flipped */
+        if(xts) {
+            uint8_t xtsKey[64];
+
+            if(options->keyBytes == 24 || size < XTS_MIN_SECTOR) {
+                return;
+            }
+            memcpy(xtsKey, key, options->keyBytes);
+            memcpy(xtsKey + options->keyBytes, key, options->keyBytes);
+            xtsKey[options->keyBytes] ^= 1;
+            XtsInitialize(&xk, xtsKey, 2 * options->keyBytes, engine);
+            for(i = 0; i * BENCH_SECTOR < size; i++) {
+                sectors.push_back({ i, buffer + i * BENCH_SECTOR, buffer + i * BENCH_SECTOR, std::min((size_t)BENCH_SECTOR, size - i * BENCH_SECTOR) });
+            }
+        }
+
+        /* 1, 2, 4, ... threads and then the maximum */
+        for(threads = 1; ; threads = std::min(2 * threads, options->maxThreads)) {
+            if(threads == 1) {
+                if(ecb) {
+                    r = Measure(options, [&]() { EncryptBlocks(ctx, buffer, buffer, blocks); });
+                }
+                else if(xts) {
+                    r = Measure(options, [&]() {
+                        for(i = 0; i < sectors.size(); i++) {
+                            XtsEncrypt(&xk, sectors[i].number, sectors[i].in, sectors[i].out, sectors[i].len);
+                        }
+                    });
+                }
+                else {
+                    r = Measure(options, [&]() { CtrCrypt(ctx, iv, 0, buffer, buffer, size); });
+                }
+            }
+            else {
+                ThreadPool pool(threads);
+                if(ecb) {
+                    r = Measure(options, [&]() { EcbEncryptParallel(ctx, buffer, buffer, blocks, pool); });
+                }
+                else if(xts) {
+                    r = Measure(options, [&]() { XtsEncryptSectors(&xk, sectors.data(), sectors.size(), pool); });
+                }
+                else {
+                    r = Measure(options, [&]() { CtrCryptParallel(ctx, iv, 0, buffer, buffer, size, pool); });
+                }
+            }
+            Record(r, "bulk", name, mode, size, threads);
+
+            if(threads == options->maxThreads) {
+                break;
+            }
+        }
+        return;
+    }
+
+    if(strcmp(mode, "cbc-enc") == 0) {
+        r = Measure(options, [&]() { memcpy(chain, iv, 16); CbcEncrypt(ctx, chain, buffer, buffer, blocks); });
+    }
+    else if(strcmp(mode, "cbc-streams") == 0) {
+        /*
+         * The same bytes as cbc-enc, as BENCH_CBC_STREAMS equal messages
+         * encrypted together. The messages are a cache line apart so they
+         * do not all map to the same L1 sets when size is a power of two.
+         */
+        CbcStream streams[BENCH_CBC_STREAMS];
+        size_t count = std::min((size_t)BENCH_CBC_STREAMS, blocks);
+        size_t i;
+
+        if(count == 0) {
+            return;
+        }
+        r = Measure(options, [&]() {
+            for(i = 0; i < count; i++) {
+                streams[i].in = buffer + i * ((blocks / count) * 16 + 64);
+                streams[i].out = buffer + i * ((blocks / count) * 16 + 64);
+                streams[i].len = (blocks / count) * 16;
+                memcpy(streams[i].iv, iv, 16);
+            }
+            CbcEncryptStreams(ctx, streams, count, false);
+        });
+    }
+    else if(strcmp(mode, "cbc-dec") == 0) {
+        r = Measure(options, [&]() { memcpy(chain, iv, 16); CbcDecrypt(ctx, chain, buffer, buffer, blocks); });
+    }
+    else {
+        GcmInitialize(&gk, ctx);
+        r = Measure(options, [&]() {
+            GcmStart(&gs, &gk, iv, 12);
+            GcmEncrypt(&gs, buffer, buffer, size);
+            GcmFinish(&gs, tag);
+        });
+    }
+    Record(r, "bulk", name, mode, size, 1);
+}
+
+/* Bulk throughput over message sizes growing by 4x from minSize to maxSize */
+void Bench::Throughput() {
+    const char *modes[7] = { "ecb", "cbc-enc", "cbc-streams", "cbc-dec", "ctr", "xts", "gcm" };
+    unsigned int w[MAX_KEY_WORDS];
+    AesContext ctx;
+    size_t size;
+    int e;
+    int m;
+
+    ExpandKeySteps(key, options->keyBytes, w);
+
+    for(size = options->minSize; size <= options->maxSize; size *= 4) {
+        for(e = 0; e < 5; e++) {
+            if(benchEngines[e] == ENGINE_AUTO) {
+                if(size <= BENCH_STEPS_MAX) {
+                    ThroughputMode("ecb", ENGINE_AUTO, NULL, w, size);
+                }
+                continue;
+            }
+
+            InitializeContext(&ctx, key, options->keyBytes, benchEngines[e]);
+            if(ctx.engine != benchEngines[e]) {
+                continue;
+            }
+            for(m = 0; m < 7; m++) {
+                ThroughputMode(modes[m], ctx.engine, &ctx, w, size);
+            }
+        }
+    }
+}
+
+static bool WriteCsv(const char *path, const std::vector<BenchResult> &results) {
+    FILE *f = fopen(path, "w");
+
+    if(f == NULL) {
+        return false;
+    }
+
+    fprintf(f, "test,engine,mode,bytes,threads,cycles_median,cycles_p99,cpb_median,cpb_p99,gbps\n");
+    for(const BenchResult &r : results) {
+        fprintf(f, "%s,%s,%s,%zu,%u,%.1f,%.1f,%.4f,%.4f,%.4f\n", r.test, r.engine, r.mode, r.bytes, r.threads,
+                r.cyclesMedian, r.cyclesP99, r.cyclesMedian / r.bytes, r.cyclesP99 / r.bytes, r.bytes / r.ns);
+    }
+
+    return fclose(f) == 0;
+}
+
+static bool WriteJson(const char *path, const std::vector<BenchResult> &results) {
+    FILE *f = fopen(path, "w");
+    size_t i;
+
+    if(f == NULL) {
+        return false;
+    }
+
+    fprintf(f, "[\n");
+    for(i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        fprintf(f, "  {\"test\": \"%s\", \"engine\": \"%s\", \"mode\": \"%s\", \"bytes\": %zu, \"threads\": %u, "
+                   "\"cycles_median\": %.1f, \"cycles_p99\": %.1f, \"cpb_median\": %.4f, \"cpb_p99\": %.4f, \"gbps\": %.4f}%s\n",
+                r.test, r.engine, r.mode, r.bytes, r.threads, r.cyclesMedian, r.cyclesP99,
+                r.cyclesMedian / r.bytes, r.cyclesP99 / r.bytes, r.bytes / r.ns, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+
+    return fclose(f) == 0;
+}
+
+/* Parse a decimal number from min to max into *out; false for anything else, including a sign or trailing characters */
+static bool ParseCount(const char *s, unsigned long long min, unsigned long long max, unsigned long long *out) {
+    char *end;
+
+    if(!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+
+    errno = 0;
+    *out = strtoull(s, &end, 10);
+
+    return errno == 0 && *end == '\0' && *out >= min && *out <= max;
+}
+
+/* Parse a byte count with an optional K, M or G suffix, up to BENCH_MAX_SIZE */
+static bool ParseSize(const char *s, size_t *size) {
+    char *end;
+    unsigned long long value;
+    int shift = 0;
+
+    if(!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+    errno = 0;
+    value = strtoull(s, &end, 10);
+    if(errno != 0) {
+        return false;
+    }
+
+    if(*end == 'K' || *end == 'k') {
+        shift = 10;
+        end++;
+    }
+    else if(*end == 'M' || *end == 'm') {
+        shift = 20;
+        end++;
+    }
+    else if(*end == 'G' || *end == 'g') {
+        shift = 30;
+        end++;
+    }
+
+    /* Compared before shifting, so a value the shift would overflow is rejected */
+    if(*end != '\0' || value > (BENCH_MAX_SIZE >> shift)) {
+        return false;
+    }
+
+    *size = value << shift;
+    return true;
+}
+
+static void PrintUsage() {
+    printf("\nUsage: ./bench [-min <bytes>] [-max <bytes>] [-threads <n>] [-reps <n>] [-budget <seconds>] [-key 128|192|256] [-csv <file>] [-json <file>]\n");
+    printf("Sizes take a K, M or G suffix and run from -min to -max in steps of 4x (default 16 to 1G, at most 1T).\n");
+    printf("Parallel modes run with 1, 2, 4, ... up to -threads threads (default: every hardware thread, at most %d).\n", BENCH_MAX_THREADS);
+    printf("Each measurement takes up to -reps samples (default 101) or -budget seconds (default 1).\n\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    unsigned long long value = 0;
+    int i;
+
+    options.minSize = 16;
+    options.maxSize = (size_t)1 << 30;
+    options.maxThreads = std::min((unsigned int)BENCH_MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+    options.reps = 101;
+    options.budget = 1.0;
+    options.keyBytes = 16;
+    options.csv = NULL;
+    options.json = NULL;
+
+    for(i = 1; i < argc; i++) {
+        if(i + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+
+        bool ok = true;
+        if(strcmp(argv[i], "-min") == 0) {
+            ok = ParseSize(argv[++i], &options.minSize);
+        }
+        else if(strcmp(argv[i], "-max") == 0) {
+            ok = ParseSize(argv[++i], &options.maxSize);
+        }
+        else if(strcmp(argv[i], "-threads") == 0) {
+            ok = ParseCount(argv[++i], 1, BENCH_MAX_THREADS, &value);
+            options.maxThreads = value;
+        }
+        else if(strcmp(argv[i], "-reps") == 0) {
+            ok = ParseCount(argv[++i], 1, INT_MAX, &value);
+            options.reps = value;
+        }
+        else if(strcmp(argv[i], "-budget") == 0) {
+            options.budget = atof(argv[++i]);
+            ok = options.budget > 0;
+        }
+        else if(strcmp(argv[i], "-key") == 0) {
+            ok = ParseCount(argv[++i], 128, 256, &value) && value % 64 == 0;
+            options.keyBytes = value / 8;
+        }
+        else if(strcmp(argv[i], "-csv") == 0) {
+            options.csv = argv[++i];
+        }
+        else if(strcmp(argv[i], "-json") == 0) {
+            options.json = argv[++i];
+        }
+        else {
+            ok = false;
+        }
+
+        if(!ok) {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    /* Whole blocks only */
+    options.minSize = std::max<size_t>(16, options.minSize & ~(size_t)15);
+    options.maxSize = std::max<size_t>(options.minSize, options.maxSize & ~(size_t)15);
+
+    Bench bench(&options);
+    if(!bench.Allocated()) {
+        fprintf(stderr, "Out of memory for a %zu-byte buffer; try a smaller -max\n", bench.BufferSize());
+        return 1;
+    }
+
+    printf("%-10s %-9s %-11s %11s %7s %14s %14s %9s %9s %9s\n", "test", "engine", "mode", "bytes", "threads",
+           "cycles", "cycles p99", "c/B", "c/B p99", "GB/s");
+
+    bench.KeySetup();
+    bench.Latency();
+    bench.Throughput();
+    bench.Coalesce();
+
+    if(options.csv != NULL && !WriteCsv(options.csv, bench.results)) {
+        fprintf(stderr, "Could not write %s\n", options.csv);
+        return 1;
+    }
+    if(options.json != NULL && !WriteJson(options.json, bench.results)) {
+        fprintf(stderr, "Could not write %s\n", options.json);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Bitsliced round engine for the AES Encryption project
+ *
+ * Eight blocks (SSE2) or sixteen blocks (AVX2) are transposed into bit
+ * planes so Substitute Bytes becomes a Boolean circuit and the other steps
+ * become register shuffles and XORs. No step reads memory at an address
+ * that depends on the key or the data.
+ *
+ * AES Encryption
+ */
+
+#include <cpuid.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "aes_engine.h"
+
+namespace sse2 {
+
+typedef __m128i V;
+
+/* Block m of a group of 8 */
+static inline V LoadBlocks(const uint8_t *in, int m) {
+    return _mm_loadu_si128((const __m128i *)(in + 16 * m));
+}
+
+static inline void StoreBlocks(uint8_t *out, int m, V v) {
+    _mm_storeu_si128((__m128i *)(out + 16 * m), v);
+}
+
+static inline V LoadPlane(const uint8_t *p) {
+    return _mm_load_si128((const __m128i *)p);
+}
+
+static inline V Splat(uint8_t x) {
+    return _mm_set1_epi8(x);
+}
+
+static inline V Splat32(unsigned int x) {
+    return _mm_set1_epi32(x);
+}
+
+static inline V ShiftRight64(V v, int n) {
+    return _mm_srli_epi64(v, n);
+}
+
+static inline V ShiftLeft64(V v, int n) {
+    return _mm_slli_epi64(v, n);
+}
+
+/* Rotate every 32-bit column right by n bits, i.e. by n / 8 rows */
+static inline V RotateColumns(V v, int n) {
+    return _mm_srli_epi32(v, n) | _mm_slli_epi32(v, 32 - n);
+}
+
+#define SHUFFLE_COLUMNS(v, imm) _mm_shuffle_epi32(v, imm)
+
+#include "aes_bitslice.h"
+
+#undef SHUFFLE_COLUMNS
+
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace avx2 {
+
+typedef __m256i V;
+
+/* Blocks m and m + 8 of a group of 16: the low lane holds 0-7, the high lane 8-15 */
+static inline V LoadBlocks(const uint8_t *in, int m) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(in + 16 * m));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(in + 16 * (m + 8)));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+static inline void StoreBlocks(uint8_t *out, int m, V v) {
+    _mm_storeu_si128((__m128i *)(out + 16 * m), _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)(out + 16 * (m + 8)), _mm256_extracti128_si256(v, 1));
+}
+
+/* Round key planes are stored once and shared by both lanes */
+static inline V LoadPlane(const uint8_t *p) {
+    return _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)p));
+}
+
+static inline V Splat(uint8_t x) {
+    return _mm256_set1_epi8(x);
+}
+
+static inline V Splat32(unsigned int x) {
+    return _mm256_set1_epi32(x);
+}
+
+static inline V ShiftRight64(V v, int n) {
+    return _mm256_srli_epi64(v, n);
+}
+
+static inline V ShiftLeft64(V v, int n) {
+    return _mm256_slli_epi64(v, n);
+}
+
+static inline V RotateColumns(V v, int n) {
+    return _mm256_srli_epi32(v, n) | _mm256_slli_epi32(v, 32 - n);
+}
+
+#define SHUFFLE_COLUMNS(v, imm) _mm256_shuffle_epi32(v, imm)
+
+#include "aes_bitslice.h"
+
+#undef SHUFFLE_COLUMNS
+
+/* Full groups of 16 blocks; returns how many blocks were done */
+template<int Nr>
+static size_t EncryptBlocks16(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    size_t n;
+
+    for(n = 0; n + 16 <= blocks; n += 16) {
+        EncryptGroup<Nr>(sliced, in + 16 * n, out + 16 * n);
+    }
+
+    return n;
+}
+
+template<int Nr>
+static size_t DecryptBlocks16(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    size_t n;
+
+    for(n = 0; n + 16 <= blocks; n += 16) {
+        DecryptGroup<Nr>(sliced, in + 16 * n, out + 16 * n);
+    }
+
+    return n;
+}
+
+}
+
+#pragma GCC pop_options
+
+static bool ProbeAvx2() {
+    unsigned int a;
+    unsigned int b;
+    unsigned int c;
+    unsigned int d;
+    unsigned int lo;
+    unsigned int hi;
+
+    /* OSXSAVE and AVX, then the OS must be saving the YMM registers */
+    if(!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return false;
+    }
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+
+    return (lo & 0x6) == 0x6 && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2);
+}
+
+/* Probed once by the initialization of a local static, which is safe from any thread */
+bool HasAvx2() {
+    static const bool has = ProbeAvx2();
+
+    return has;
+}
+
+void SliceRoundKeys(const uint8_t (*rk)[16], uint8_t (*sliced)[8][16], int rounds) {
+    int round;
+    int b;
+    int k;
+
+    /* Plane b of a round key is 0xFF wherever bit b of the key byte is set */
+    for(round = 0; round <= rounds; round++) {
+        for(b = 0; b < 8; b++) {
+            for(k = 0; k < 16; k++) {
+                sliced[round][b][k] = (rk[round][k] >> b) & 1 ? 0xFF : 0x00;
+            }
+        }
+    }
+}
+
+template<int Nr>
+void EncryptBlocksBitslice(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    uint8_t tail[16 * 8];
+    size_t n = 0;
+
+    if(HasAvx2()) {
+        n = avx2::EncryptBlocks16<Nr>(sliced, in, out, blocks);
+    }
+
+    for(; n + 8 <= blocks; n += 8) {
+        sse2::EncryptGroup<Nr>(sliced, in + 16 * n, out + 16 * n);
+    }
+
+    /* A short final group is padded so every call runs the same circuit */
+    if(n < blocks) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, in + 16 * n, 16 * (blocks - n));
+        sse2::EncryptGroup<Nr>(sliced, tail, tail);
+        memcpy(out + 16 * n, tail, 16 * (blocks - n));
+    }
+}
+
+template<int Nr>
+void DecryptBlocksBitslice(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    uint8_t tail[16 * 8];
+    size_t n = 0;
+
+    if(HasAvx2()) {
+        n = avx2::DecryptBlocks16<Nr>(sliced, in, out, blocks);
+    }
+
+    for(; n + 8 <= blocks; n += 8) {
+        sse2::DecryptGroup<Nr>(sliced, in + 16 * n, out + 16 * n);
+    }
+
+    if(n < blocks) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, in + 16 * n, 16 * (blocks - n));
+        sse2::DecryptGroup<Nr>(sliced, tail, tail);
+        memcpy(out + 16 * n, tail, 16 * (blocks - n));
+    }
+}
+
+/*
+ * Gather the inputs and round keys of one group of lanes into contiguous
+ * buffers, and encrypt them with group. A ragged final group repeats the
+ * last lane and discards the copies.
+ */
+template<int Nr, int lanes>
+static void EncryptMultiKeyGroup(void (*group)(const uint8_t *keys, const uint8_t *in, uint8_t *out), const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    alignas(32) uint8_t keys[Nr + 1][lanes][16];
+    alignas(32) uint8_t blocks[lanes][16];
+    size_t n;
+    int round;
+    int l;
+
+    for(n = 0; n < count; n += lanes) {
+        for(l = 0; l < lanes; l++) {
+            size_t i = n + l < count ? n + l : count - 1;
+
+            memcpy(blocks[l], in[i], 16);
+            for(round = 0; round <= Nr; round++) {
+                memcpy(keys[round][l], ctxs[i]->rk[round], 16);
+            }
+        }
+
+        group(&keys[0][0][0], &blocks[0][0], &blocks[0][0]);
+
+        for(l = 0; l < lanes && n + l < count; l++) {
+            memcpy(out[n + l], blocks[l], 16);
+        }
+    }
+}
+
+/* The round keys are re-sliced per group, so the per-key sliced planes are not used */
+template<int Nr>
+void EncryptMultiKeyBitslice(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    if(HasAvx2()) {
+        EncryptMultiKeyGroup<Nr, 16>(avx2::EncryptGroupKeys<Nr>, ctxs, in, out, count);
+    }
+    else {
+        EncryptMultiKeyGroup<Nr, 8>(sse2::EncryptGroupKeys<Nr>, ctxs, in, out, count);
+    }
+}
+
+template void EncryptBlocksBitslice<10>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksBitslice<12>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksBitslice<14>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksBitslice<10>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksBitslice<12>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksBitslice<14>(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptMultiKeyBitslice<10>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyBitslice<12>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyBitslice<14>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
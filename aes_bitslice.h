@@ -0,0 +1,414 @@
+/*
+ * Bitsliced round functions for the AES Encryption project
+ *
+ * This file is included by aes_bitslice.cpp once per instruction set. The
+ * includer defines the vector type V and the helpers LoadBlocks,
+ * StoreBlocks, LoadPlane, Splat, Splat32, ShiftRight64, ShiftLeft64,
+ * RotateColumns and SHUFFLE_COLUMNS before including it.
+ *
+ * State layout: q[b] holds bit b of every state byte. Byte k of q[b] is
+ * state byte k, and bit m of that byte belongs to block m of the group.
+ *
+ * AES Encryption
+ */
+
+/* Exchange the bits of b selected by mask with the bits of a selected by mask << n */
+#define SWAPMOVE(a, b, n, mask) \
+    do { \
+        V t = (ShiftRight64(a, n) ^ (b)) & (mask); \
+        (b) ^= t; \
+        (a) ^= ShiftLeft64(t, n); \
+    } while(0)
+
+/* Transpose the 8x8 bit matrix in each byte position; its own inverse */
+static inline void Transpose(V *q) {
+    const V m1 = Splat(0x55);
+    const V m2 = Splat(0x33);
+    const V m4 = Splat(0x0F);
+
+    SWAPMOVE(q[0], q[1], 1, m1);
+    SWAPMOVE(q[2], q[3], 1, m1);
+    SWAPMOVE(q[4], q[5], 1, m1);
+    SWAPMOVE(q[6], q[7], 1, m1);
+
+    SWAPMOVE(q[0], q[2], 2, m2);
+    SWAPMOVE(q[1], q[3], 2, m2);
+    SWAPMOVE(q[4], q[6], 2, m2);
+    SWAPMOVE(q[5], q[7], 2, m2);
+
+    SWAPMOVE(q[0], q[4], 4, m4);
+    SWAPMOVE(q[1], q[5], 4, m4);
+    SWAPMOVE(q[2], q[6], 4, m4);
+    SWAPMOVE(q[3], q[7], 4, m4);
+}
+
+#undef SWAPMOVE
+
+/* Substitute Bytes as the Boyar-Peralta depth-16 circuit (113 gates) */
+static inline void SubBytesSliced(V *q) {
+    V x0 = q[7];
+    V x1 = q[6];
+    V x2 = q[5];
+    V x3 = q[4];
+    V x4 = q[3];
+    V x5 = q[2];
+    V x6 = q[1];
+    V x7 = q[0];
+
+    /* Top linear transformation */
+    V y14 = x3 ^ x5;
+    V y13 = x0 ^ x6;
+    V y9 = x0 ^ x3;
+    V y8 = x0 ^ x5;
+    V t0 = x1 ^ x2;
+    V y1 = t0 ^ x7;
+    V y4 = y1 ^ x3;
+    V y12 = y13 ^ y14;
+    V y2 = y1 ^ x0;
+    V y5 = y1 ^ x6;
+    V y3 = y5 ^ y8;
+    V t1 = x4 ^ y12;
+    V y15 = t1 ^ x5;
+    V y20 = t1 ^ x1;
+    V y6 = y15 ^ x7;
+    V y10 = y15 ^ t0;
+    V y11 = y20 ^ y9;
+    V y7 = x7 ^ y11;
+    V y17 = y10 ^ y11;
+    V y19 = y10 ^ y8;
+    V y16 = t0 ^ y11;
+    V y21 = y13 ^ y16;
+    V y18 = x0 ^ y16;
+
+    /* Shared non-linear middle: inversion in GF(2^4)^2 */
+    V t2 = y12 & y15;
+    V t3 = y3 & y6;
+    V t4 = t3 ^ t2;
+    V t5 = y4 & x7;
+    V t6 = t5 ^ t2;
+    V t7 = y13 & y16;
+    V t8 = y5 & y1;
+    V t9 = t8 ^ t7;
+    V t10 = y2 & y7;
+    V t11 = t10 ^ t7;
+    V t12 = y9 & y11;
+    V t13 = y14 & y17;
+    V t14 = t13 ^ t12;
+    V t15 = y8 & y10;
+    V t16 = t15 ^ t12;
+    V t17 = t4 ^ t14;
+    V t18 = t6 ^ t16;
+    V t19 = t9 ^ t14;
+    V t20 = t11 ^ t16;
+    V t21 = t17 ^ y20;
+    V t22 = t18 ^ y19;
+    V t23 = t19 ^ y21;
+    V t24 = t20 ^ y18;
+
+    V t25 = t21 ^ t22;
+    V t26 = t21 & t23;
+    V t27 = t24 ^ t26;
+    V t28 = t25 & t27;
+    V t29 = t28 ^ t22;
+    V t30 = t23 ^ t24;
+    V t31 = t22 ^ t26;
+    V t32 = t31 & t30;
+    V t33 = t32 ^ t24;
+    V t34 = t23 ^ t33;
+    V t35 = t27 ^ t33;
+    V t36 = t24 & t35;
+    V t37 = t36 ^ t34;
+    V t38 = t27 ^ t36;
+    V t39 = t29 & t38;
+    V t40 = t25 ^ t39;
+
+    V t41 = t40 ^ t37;
+    V t42 = t29 ^ t33;
+    V t43 = t29 ^ t40;
+    V t44 = t33 ^ t37;
+    V t45 = t42 ^ t41;
+    V z0 = t44 & y15;
+    V z1 = t37 & y6;
+    V z2 = t33 & x7;
+    V z3 = t43 & y16;
+    V z4 = t40 & y1;
+    V z5 = t29 & y7;
+    V z6 = t42 & y11;
+    V z7 = t45 & y17;
+    V z8 = t41 & y10;
+    V z9 = t44 & y12;
+    V z10 = t37 & y3;
+    V z11 = t33 & y4;
+    V z12 = t43 & y13;
+    V z13 = t40 & y5;
+    V z14 = t29 & y2;
+    V z15 = t42 & y9;
+    V z16 = t45 & y14;
+    V z17 = t41 & y8;
+
+    /* Bottom linear transformation, including the affine constant 0x63 */
+    V t46 = z15 ^ z16;
+    V t47 = z10 ^ z11;
+    V t48 = z5 ^ z13;
+    V t49 = z9 ^ z10;
+    V t50 = z2 ^ z12;
+    V t51 = z2 ^ z5;
+    V t52 = z7 ^ z8;
+    V t53 = z0 ^ z3;
+    V t54 = z6 ^ z7;
+    V t55 = z16 ^ z17;
+    V t56 = z12 ^ t48;
+    V t57 = t50 ^ t53;
+    V t58 = z4 ^ t46;
+    V t59 = z3 ^ t54;
+    V t60 = t46 ^ t57;
+    V t61 = z14 ^ t57;
+    V t62 = t52 ^ t58;
+    V t63 = t49 ^ t58;
+    V t64 = z4 ^ t59;
+    V t65 = t61 ^ t62;
+    V t66 = z1 ^ t63;
+    V s0 = t59 ^ t63;
+    V s6 = t56 ^ ~t62;
+    V s7 = t48 ^ ~t60;
+    V t67 = t64 ^ t65;
+    V s3 = t53 ^ t66;
+    V s4 = t51 ^ t66;
+    V s5 = t47 ^ t65;
+    V s1 = t64 ^ ~s3;
+    V s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/*
+ * Inverse Substitute Bytes as L(S(L(x))), where L undoes the S-Box affine
+ * step: L(x)_i = x_(i+2) ^ x_(i+5) ^ x_(i+7) ^ bit i of 0x05. The forward
+ * circuit supplies the field inversion, so the inverse stays constant time.
+ */
+static inline void InverseAffineSliced(V *q) {
+    V x[8];
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        x[b] = q[b];
+    }
+    for(b = 0; b < 8; b++) {
+        q[b] = x[(b + 2) % 8] ^ x[(b + 5) % 8] ^ x[(b + 7) % 8];
+    }
+    q[0] = ~q[0];
+    q[2] = ~q[2];
+}
+
+static inline void InvSubBytesSliced(V *q) {
+    InverseAffineSliced(q);
+    SubBytesSliced(q);
+    InverseAffineSliced(q);
+}
+
+/* Shift Rows: row r of each column comes from column c + r, as 32-bit lane shuffles */
+static inline void ShiftRowsSliced(V *q) {
+    const V row0 = Splat32(0x000000FF);
+    const V row1 = Splat32(0x0000FF00);
+    const V row2 = Splat32(0x00FF0000);
+    const V row3 = Splat32(0xFF000000);
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        V v = q[b];
+        q[b] = (v & row0) | (SHUFFLE_COLUMNS(v, 0x39) & row1) | (SHUFFLE_COLUMNS(v, 0x4E) & row2) | (SHUFFLE_COLUMNS(v, 0x93) & row3);
+    }
+}
+
+/* Mix Columns: out = xtime(a ^ rot1(a)) ^ rot1(a) ^ rot2(a ^ rot1(a)) on every plane */
+static inline void MixColumnsSliced(V *q) {
+    V r1[8];
+    V t[8];
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        r1[b] = RotateColumns(q[b], 8);
+        t[b] = q[b] ^ r1[b];
+    }
+
+    /* xtime moves every plane up one bit and folds bit 7 back in as 0x1B */
+    q[0] = t[7] ^ r1[0] ^ RotateColumns(t[0], 16);
+    q[1] = t[0] ^ t[7] ^ r1[1] ^ RotateColumns(t[1], 16);
+    q[2] = t[1] ^ r1[2] ^ RotateColumns(t[2], 16);
+    q[3] = t[2] ^ t[7] ^ r1[3] ^ RotateColumns(t[3], 16);
+    q[4] = t[3] ^ t[7] ^ r1[4] ^ RotateColumns(t[4], 16);
+    q[5] = t[4] ^ r1[5] ^ RotateColumns(t[5], 16);
+    q[6] = t[5] ^ r1[6] ^ RotateColumns(t[6], 16);
+    q[7] = t[6] ^ r1[7] ^ RotateColumns(t[7], 16);
+}
+
+/* Inverse Shift Rows: row r of each column comes from column c - r */
+static inline void InvShiftRowsSliced(V *q) {
+    const V row0 = Splat32(0x000000FF);
+    const V row1 = Splat32(0x0000FF00);
+    const V row2 = Splat32(0x00FF0000);
+    const V row3 = Splat32(0xFF000000);
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        V v = q[b];
+        q[b] = (v & row0) | (SHUFFLE_COLUMNS(v, 0x93) & row1) | (SHUFFLE_COLUMNS(v, 0x4E) & row2) | (SHUFFLE_COLUMNS(v, 0x39) & row3);
+    }
+}
+
+/* Multiply every byte by 0x04: xtime twice across the planes */
+static inline void Times4Sliced(V *t) {
+    V u[8];
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        u[0] = t[7];
+        u[1] = t[0] ^ t[7];
+        u[2] = t[1];
+        u[3] = t[2] ^ t[7];
+        u[4] = t[3] ^ t[7];
+        u[5] = t[4];
+        u[6] = t[5];
+        u[7] = t[6];
+        t[0] = u[0];
+        t[1] = u[1];
+        t[2] = u[2];
+        t[3] = u[3];
+        t[4] = u[4];
+        t[5] = u[5];
+        t[6] = u[6];
+        t[7] = u[7];
+    }
+}
+
+/* Inverse Mix Columns: the MCD matrix is MCE times the circulant (05 00 04 00), so a ^ 4 (a ^ rot2(a)) then Mix Columns */
+static inline void InvMixColumnsSliced(V *q) {
+    V t[8];
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        t[b] = q[b] ^ RotateColumns(q[b], 16);
+    }
+    Times4Sliced(t);
+    for(b = 0; b < 8; b++) {
+        q[b] ^= t[b];
+    }
+
+    MixColumnsSliced(q);
+}
+
+/* Add Round Key against the pre-sliced planes of one round key */
+static inline void AddRoundKeySliced(V *q, const uint8_t (*planes)[16]) {
+    int b;
+
+    for(b = 0; b < 8; b++) {
+        q[b] ^= LoadPlane(planes[b]);
+    }
+}
+
+/* Encrypt one group of blocks (8 per 128 bits of V) from in to out */
+template<int Nr>
+static inline void EncryptGroup(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out) {
+    V q[8];
+    int round;
+    int m;
+
+    for(m = 0; m < 8; m++) {
+        q[m] = LoadBlocks(in, m);
+    }
+    Transpose(q);
+
+    AddRoundKeySliced(q, sliced[0]);
+    for(round = 1; round < Nr; round++) {
+        SubBytesSliced(q);
+        ShiftRowsSliced(q);
+        MixColumnsSliced(q);
+        AddRoundKeySliced(q, sliced[round]);
+    }
+    SubBytesSliced(q);
+    ShiftRowsSliced(q);
+    AddRoundKeySliced(q, sliced[Nr]);
+
+    Transpose(q);
+    for(m = 0; m < 8; m++) {
+        StoreBlocks(out, m, q[m]);
+    }
+}
+
+/*
+ * Encrypt one group with a different key for every block. keys holds, for
+ * each round, that round's key of every block in block order, so the same
+ * Transpose() that slices the data slices the round keys.
+ */
+template<int Nr>
+static inline void EncryptGroupKeys(const uint8_t *keys, const uint8_t *in, uint8_t *out) {
+    const size_t stride = 16 * (sizeof(V) / 2);
+    V q[8];
+    V k[8];
+    int round;
+    int m;
+
+    for(m = 0; m < 8; m++) {
+        q[m] = LoadBlocks(in, m);
+    }
+    Transpose(q);
+
+    for(round = 0; round <= Nr; round++) {
+        for(m = 0; m < 8; m++) {
+            k[m] = LoadBlocks(keys + stride * round, m);
+        }
+        Transpose(k);
+
+        if(round > 0) {
+            SubBytesSliced(q);
+            ShiftRowsSliced(q);
+            if(round < Nr) {
+                MixColumnsSliced(q);
+            }
+        }
+        for(m = 0; m < 8; m++) {
+            q[m] ^= k[m];
+        }
+    }
+
+    Transpose(q);
+    for(m = 0; m < 8; m++) {
+        StoreBlocks(out, m, q[m]);
+    }
+}
+
+/* Decrypt one group of blocks, running the forward round keys backwards */
+template<int Nr>
+static inline void DecryptGroup(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out) {
+    V q[8];
+    int round;
+    int m;
+
+    for(m = 0; m < 8; m++) {
+        q[m] = LoadBlocks(in, m);
+    }
+    Transpose(q);
+
+    AddRoundKeySliced(q, sliced[Nr]);
+    for(round = Nr - 1; round > 0; round--) {
+        InvShiftRowsSliced(q);
+        InvSubBytesSliced(q);
+        AddRoundKeySliced(q, sliced[round]);
+        InvMixColumnsSliced(q);
+    }
+    InvShiftRowsSliced(q);
+    InvSubBytesSliced(q);
+    AddRoundKeySliced(q, sliced[0]);
+
+    Transpose(q);
+    for(m = 0; m < 8; m++) {
+        StoreBlocks(out, m, q[m]);
+    }
+}
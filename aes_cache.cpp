@@ -0,0 +1,142 @@
+/*
+ * Key schedule cache for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#include <string.h>
+
+#include <random>
+
+#include "aes_cache.h"
+
+/* Overwrite a buffer in a way the compiler may not drop as a dead store */
+static void SecureZero(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while(len--) {
+        *v++ = 0;
+    }
+}
+
+/* Deleter for cached contexts: wipe the round keys before the memory is reused */
+static void DestroyContext(const AesContext *ctx) {
+    SecureZero((void *)ctx, sizeof(AesContext));
+    delete ctx;
+}
+
+/* True when ctx was built from key; the first keyBytes bytes of the round keys are the key itself */
+static bool KeyMatches(const AesContext *ctx, const uint8_t *key, size_t keyBytes) {
+    const uint8_t *rk = &ctx->rk[0][0];
+    uint8_t diff = 0;
+    size_t i;
+
+    if(ctx->rounds != (int)(keyBytes / 4 + 6)) {
+        return false;
+    }
+    for(i = 0; i < keyBytes; i++) {
+        diff |= rk[i] ^ key[i];
+    }
+
+    return diff == 0;
+}
+
+KeyCache::KeyCache(size_t capacity, AesEngine engine) : engine(engine) {
+    std::random_device random;
+    int i;
+
+    perShard = capacity / CACHE_SHARDS ? capacity / CACHE_SHARDS : 1;
+    seed = ((uint64_t)random() << 32) ^ random();
+
+    for(i = 0; i < CACHE_SHARDS; i++) {
+        memset(&shards[i].stats, 0, sizeof(KeyCacheStats));
+        shards[i].index.reserve(perShard);
+    }
+}
+
+/* Seeded 64-bit mix of the key words (the MurmurHash3 finalizer after each word) */
+uint64_t KeyCache::Fingerprint(const uint8_t *key, size_t keyBytes) const {
+    uint64_t h = seed ^ keyBytes;
+    uint64_t word;
+    size_t i;
+
+    for(i = 0; i < keyBytes; i += 8) {
+        memcpy(&word, key + i, 8);
+        h ^= word;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+    }
+
+    return h;
+}
+
+std::shared_ptr<const AesContext> KeyCache::Get(const uint8_t *key, size_t keyBytes) {
+    if(keyBytes != 16 && keyBytes != 24 && keyBytes != 32) {
+        return NULL;
+    }
+
+    uint64_t fingerprint = Fingerprint(key, keyBytes);
+    Shard &shard = shards[(fingerprint >> 32) & (CACHE_SHARDS - 1)];
+
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.index.find(fingerprint);
+        if(found != shard.index.end() && KeyMatches(found->second->ctx.get(), key, keyBytes)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            shard.stats.hits++;
+            return found->second->ctx;
+        }
+        shard.stats.misses++;
+    }
+
+    /* Expand outside the lock so other keys in this shard are not held up */
+    AesContext *ctx = new AesContext;
+    InitializeContext(ctx, key, keyBytes, engine);
+    std::shared_ptr<const AesContext> entry(ctx, DestroyContext);
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    /* Another thread may have added this key, or a colliding one, in the meantime */
+    auto found = shard.index.find(fingerprint);
+    if(found != shard.index.end()) {
+        shard.lru.erase(found->second);
+        shard.index.erase(found);
+    }
+    else if(shard.lru.size() >= perShard) {
+        shard.index.erase(shard.lru.back().fingerprint);
+        shard.lru.pop_back();
+        shard.stats.evictions++;
+    }
+
+    shard.lru.push_front({ fingerprint, entry });
+    shard.index[fingerprint] = shard.lru.begin();
+
+    return entry;
+}
+
+KeyCacheStats KeyCache::Stats() {
+    KeyCacheStats total = { 0, 0, 0 };
+    int i;
+
+    for(i = 0; i < CACHE_SHARDS; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        total.hits += shards[i].stats.hits;
+        total.misses += shards[i].stats.misses;
+        total.evictions += shards[i].stats.evictions;
+    }
+
+    return total;
+}
+
+void KeyCache::Clear() {
+    int i;
+
+    for(i = 0; i < CACHE_SHARDS; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        shards[i].index.clear();
+        shards[i].lru.clear();
+    }
+}
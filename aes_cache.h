@@ -0,0 +1,77 @@
+/*
+ * Key schedule cache for the AES Encryption project
+ *
+ * Services that see many keys and small messages would otherwise spend
+ * most of their time in InitializeContext(). KeyCache keeps the contexts of
+ * recently used keys, split into independently locked shards so threads
+ * working on different keys rarely meet on the same lock.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_CACHE_H
+#define AES_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "aes_engine.h"
+
+/* Independently locked parts of a cache; a power of two */
+#define CACHE_SHARDS 16
+
+struct KeyCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+class KeyCache {
+public:
+    /* Hold up to capacity contexts (at least one per shard), all built for engine */
+    explicit KeyCache(size_t capacity, AesEngine engine = ENGINE_AUTO);
+
+    /*
+     * Context for a 16, 24 or 32-byte key, built on a miss; NULL for any
+     * other length. The context stays valid for as long as the caller holds
+     * the pointer, even if the cache evicts it meanwhile. A context is
+     * zeroized when the cache and every caller have let go of it.
+     */
+    std::shared_ptr<const AesContext> Get(const uint8_t *key, size_t keyBytes);
+
+    /* Counters summed over the shards */
+    KeyCacheStats Stats();
+
+    /* Drop every cached context */
+    void Clear();
+
+private:
+    struct Entry {
+        uint64_t fingerprint;
+        std::shared_ptr<const AesContext> ctx;
+    };
+
+    /* Each shard on its own cache lines so their locks do not false-share */
+    struct alignas(64) Shard {
+        std::mutex lock;
+        /* Most recently used first */
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        KeyCacheStats stats;
+    };
+
+    uint64_t Fingerprint(const uint8_t *key, size_t keyBytes) const;
+
+    Shard shards[CACHE_SHARDS];
+    size_t perShard;
+    AesEngine engine;
+    /* Per-cache secret mixed into every fingerprint, so chosen keys cannot pile into one shard */
+    uint64_t seed;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Request coalescer for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "aes_coalesce.h"
+#include "aes_modes.h"
+
+/* out = in ^ keystream for len bytes, whole blocks with 16-byte loads */
+static inline void XorKeystream(uint8_t *out, const uint8_t *in, const uint8_t *keystream, size_t len) {
+    size_t i = 0;
+
+    for(; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + i)), _mm_load_si128((const __m128i *)(keystream + i))));
+    }
+    for(; i < len; i++) {
+        out[i] = in[i] ^ keystream[i];
+    }
+}
+
+Coalescer::Coalescer(const AesContext *ctx, unsigned int latencyMicros) : ctx(ctx), latency(latencyMicros), pendingBlocks(0), queued(0), completed(0), flushing(0), stopping(false) {
+    memset(&stats, 0, sizeof(stats));
+    worker = std::thread(&Coalescer::Work, this);
+}
+
+Coalescer::~Coalescer() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void Coalescer::Submit(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, CoalesceDone done, void *arg) {
+    Request r;
+    bool notify;
+
+    if(len > COALESCE_MAX_BYTES) {
+        CtrCrypt(ctx, iv, 0, in, out, len);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stats.direct++;
+        }
+        done(arg);
+        return;
+    }
+
+    memcpy(r.iv, iv, 16);
+    r.in = in;
+    r.out = out;
+    r.len = len;
+    r.done = done;
+    r.arg = arg;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(pending.empty()) {
+            window = std::chrono::steady_clock::now();
+        }
+        pending.push_back(r);
+        pendingBlocks += (len + 15) / 16;
+        queued++;
+        /* The thread needs to hear of the first request, to start its clock, and of a full batch */
+        notify = pending.size() == 1 || pendingBlocks >= COALESCE_BATCH;
+    }
+    if(notify) {
+        wake.notify_one();
+    }
+}
+
+void Coalescer::Flush() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t target = queued;
+
+    flushing++;
+    wake.notify_one();
+    finished.wait(guard, [&] { return completed >= target; });
+    flushing--;
+}
+
+CoalesceStats Coalescer::Stats() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    return stats;
+}
+
+/* Encrypt the counter blocks of a batch in one engine call, then finish each request */
+void Coalescer::Run(const std::vector<Request> &batch, size_t blocks) {
+    size_t offset = 0;
+
+    for(const Request &r : batch) {
+        CtrCounters(r.iv, keystream + 16 * offset, (r.len + 15) / 16);
+        offset += (r.len + 15) / 16;
+    }
+
+    EncryptBlocks(ctx, keystream, keystream, blocks);
+
+    offset = 0;
+    for(const Request &r : batch) {
+        XorKeystream(r.out, r.in, keystream + 16 * offset, r.len);
+        offset += (r.len + 15) / 16;
+        r.done(r.arg);
+    }
+}
+
+void Coalescer::Work() {
+    std::unique_lock<std::mutex> guard(lock);
+    std::vector<Request> batch;
+    size_t blocks;
+    size_t n;
+
+    batch.reserve(COALESCE_BATCH);
+
+    for(;;) {
+        wake.wait(guard, [&] { return stopping || !pending.empty(); });
+        if(pending.empty()) {
+            return;
+        }
+
+        /*
+         * Wait for a full batch, but not past the deadline of the window.
+         * Requests left over from the last batch keep that batch's window,
+         * so they go out early rather than late.
+         */
+        wake.wait_until(guard, window + latency, [&] {
+            return stopping || flushing > 0 || pendingBlocks >= COALESCE_BATCH;
+        });
+
+        /* Requests are never split, so a batch may end short of COALESCE_BATCH */
+        blocks = 0;
+        while(!pending.empty()) {
+            n = (pending.front().len + 15) / 16;
+            if(blocks + n > COALESCE_BATCH) {
+                break;
+            }
+            batch.push_back(pending.front());
+            pending.pop_front();
+            blocks += n;
+        }
+        pendingBlocks -= blocks;
+        stats.requests += batch.size();
+        stats.batches++;
+        stats.blocks += blocks;
+
+        guard.unlock();
+        Run(batch, blocks);
+        guard.lock();
+
+        completed += batch.size();
+        batch.clear();
+        finished.notify_all();
+    }
+}
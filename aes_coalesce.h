@@ -0,0 +1,108 @@
+/*
+ * Request coalescer for the AES Encryption project
+ *
+ * A small message keeps only a few lanes of an engine busy, and a caller
+ * with one message cannot fill the rest. A Coalescer collects CTR
+ * requests from any number of threads and hands their counter blocks to
+ * the engine COALESCE_BATCH at a time from its own thread. A batch goes
+ * out as soon as it is full or when its oldest request has waited for the
+ * latency bound, whichever comes first, and each request's callback runs
+ * once its output is written.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_COALESCE_H
+#define AES_COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aes_engine.h"
+
+/* Counter blocks per engine call; a multiple of the 8 AES-NI and 16 bitsliced lanes */
+#define COALESCE_BATCH 128
+
+/* Longest request that is coalesced; longer ones fill the lanes on their own */
+#define COALESCE_MAX_BYTES 256
+
+/* Called once a request's output is written */
+typedef void (*CoalesceDone)(void *arg);
+
+struct CoalesceStats {
+    size_t requests;
+    size_t batches;
+    size_t blocks;
+    /* Requests longer than COALESCE_MAX_BYTES, run by the submitting thread */
+    size_t direct;
+};
+
+class Coalescer {
+public:
+    /* Coalesce requests under ctx, which must outlive the coalescer; no request waits much longer than latencyMicros */
+    Coalescer(const AesContext *ctx, unsigned int latencyMicros);
+
+    /* Finish every queued request, then stop the thread */
+    ~Coalescer();
+
+    /*
+     * Queue a CTR request: len bytes of in, encrypted or decrypted with the
+     * keystream of counter blocks iv, iv + 1, ..., are written to out (which
+     * may be in), and then done(arg) runs on the coalescer's thread. iv is
+     * copied; in and out must stay valid until done is called. A request
+     * longer than COALESCE_MAX_BYTES runs at once on the calling thread,
+     * done included. done may submit further requests but must not call
+     * Flush() or destroy the coalescer.
+     */
+    void Submit(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, CoalesceDone done, void *arg);
+
+    /* Send every request submitted before the call without waiting out the latency bound, and return once they are done */
+    void Flush();
+
+    CoalesceStats Stats();
+
+private:
+    struct Request {
+        uint8_t iv[16];
+        const uint8_t *in;
+        uint8_t *out;
+        size_t len;
+        CoalesceDone done;
+        void *arg;
+    };
+
+    void Work();
+    void Run(const std::vector<Request> &batch, size_t blocks);
+
+    const AesContext *ctx;
+    std::chrono::microseconds latency;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::deque<Request> pending;
+    /* Counter blocks of the pending requests */
+    size_t pendingBlocks;
+    /* Arrival of the first request since the queue was last empty; no pending request is older */
+    std::chrono::steady_clock::time_point window;
+    /* Requests queued and completed so far, for Flush() */
+    uint64_t queued;
+    uint64_t completed;
+    unsigned int flushing;
+    bool stopping;
+    CoalesceStats stats;
+
+    /* Counter blocks of the current batch, encrypted in place; used only by the coalescer's thread */
+    alignas(16) uint8_t keystream[16 * COALESCE_BATCH];
+
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Step-by-step protocols for the AES Encryption project
+ *
+ * AES Encryption
+ * Mark Wesley Harris
+ * April 2019
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "aes_core.h"
+#include "aes_profile.h"
+#include "aes_trace.h"
+
+/* Print the calculated S-Box so it can be verified */
+void PrintSbox() {
+    printf("Calculated S-Box:\n-----------------------------------------------");
+
+    int i = 0;
+    for(; i < 256; i++) {
+        if(i % 16 == 0) {
+            printf("\n");
+        }
+        printf("%02X ", sbox[i] & 0xff);
+    }
+    printf("\n");
+}
+
+/* Key Expansion Protocol */
+template<int Nk>
+void ExpandKey(const uint8_t *key, unsigned int *w, bool trace) {
+    PROFILE_STAGE(PROFILE_EXPAND_KEY);
+    unsigned int tmp;
+    int i;
+    int counter = 1;
+
+    /* Manually set the first Nk words in the expanded key */
+    for(i = 0; i < Nk; i++) {
+        w[i] = ((unsigned int)key[4*i] << 24) | (key[4*i + 1] << 16) | (key[4*i + 2] << 8) | key[4*i + 3];
+    }
+
+    if(trace) {
+        printf("\nAuxiliary Function:\n--------------------------------\n");
+    }
+
+    /* Generate the rest of the expanded key */
+    for(i = Nk; i < KeySize<Nk>::Words; i++) {
+        tmp = w[i - 1];
+        if(i % Nk == 0) {
+            /* Substitute and rotate */
+            tmp = RotWord(tmp);
+            if(trace) {
+                printf("RotWord (w%d) = %02hhx %02hhx %02hhx %02hhx = x%d\n", i - 1, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+            }
+
+            tmp = SubWord(tmp);
+            if(trace) {
+                printf("SubWord (x%d) = %02hhx %02hhx %02hhx %02hhx = y%d\n", counter, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+            }
+
+            /* The three rightmost bytes are always 0 */
+            if(trace) {
+                printf("Rcon (%d) = %02hhx 00 00 00\n", i/Nk, RC[i/Nk - 1]);
+            }
+            tmp = tmp ^ (RC[i / Nk - 1] << 24);
+            if(trace) {
+                printf("y%d ^ Rcon (%d) = %02hhx %02hhx %02hhx %02hhx = z%d\n\n", counter, i/Nk, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF, counter);
+            }
+        }
+        else if(Nk > 6 && i % Nk == 4) {
+            /* AES-256 substitutes the middle word of each 8-word group as well */
+            tmp = SubWord(tmp);
+            if(trace) {
+                printf("SubWord (w%d) = %02hhx %02hhx %02hhx %02hhx\n\n", i - 1, (tmp >> 24) & 0xFF, (tmp >> 16) & 0xFF, (tmp >> 8) & 0xFF, tmp & 0xFF);
+            }
+        }
+
+        w[i] = w[i - Nk] ^ tmp;
+    }
+}
+
+template void ExpandKey<4>(const uint8_t *key, unsigned int *w, bool trace);
+template void ExpandKey<6>(const uint8_t *key, unsigned int *w, bool trace);
+template void ExpandKey<8>(const uint8_t *key, unsigned int *w, bool trace);
+
+/* Print the Expanded Key in a readable format */
+void PrintExpandedKey(const unsigned int *w, int words) {
+    printf("\nExpanded Key:\n-----------------\n");
+
+    int i;
+    for(i = 0; i < words; i++) {
+        printf("w%d = %02hhx %02hhx %02hhx %02hhx\n", i, (w[i] >> 24) & 0xFF, (w[i] >> 16) & 0xFF, (w[i] >> 8) & 0xFF, w[i] & 0xFF);
+        if((i + 1) % 4 == 0 && i > 0) {
+            printf("\n");
+        }
+    }
+}
+
+/* Print the State in a readable format */
+void PrintState(const unsigned int *state) {
+    int i;
+    for(i = 0; i < 4; i++) {
+        printf("%02x %02x %02x %02x\n", (state[0] >> (24 - 8*i)) & 0xFF, (state[1] >> (24 - 8*i)) & 0xFF, (state[2] >> (24 - 8*i)) & 0xFF, (state[3] >> (24 - 8*i)) & 0xFF);
+    }
+    printf("\n");
+}
+
+/* Print the Round Key in a readable format */
+void PrintRoundKey(const unsigned int *w, int count) {
+    printf("\n(%d) Round Key:\n--------------\n", count);
+
+    int i;
+    int offset = count * 4;
+    for(i = 0; i < 4; i++) {
+        printf("%02x %02x %02x %02x\n", (w[offset] >> (24 - 8*i)) & 0xFF, (w[offset + 1] >> (24 - 8*i)) & 0xFF, (w[offset + 2] >> (24 - 8*i)) & 0xFF, (w[offset + 3] >> (24 - 8*i)) & 0xFF);
+    }
+    printf("\n");
+}
+
+/* AddRoundKey protocol */
+void AddRoundKey(unsigned int *state, const unsigned int *w, int count) {
+    PROFILE_STAGE(PROFILE_ADD_ROUND_KEY);
+    /* XOR each byte of state[] with w[i,j] */
+    for(int i = 0; i < 4; i++) {
+        state[i] ^= w[i + count * 4];
+    }
+}
+
+/* SubstituteBytes Protocol */
+void SubstituteBytes(unsigned int *state) {
+    PROFILE_STAGE(PROFILE_SUB_BYTES);
+    int i;
+    for(i = 0; i < 4; i++) {
+        state[i] = SubWord(state[i]);
+    }
+}
+
+/* Shift Rows Protocol */
+void ShiftRows(unsigned int *state) {
+    PROFILE_STAGE(PROFILE_SHIFT_ROWS);
+    int i;
+    int j;
+    unsigned int row = 0;
+    unsigned int tmp = 0;
+    unsigned int out = 0;
+    int pos = 0;
+
+    /* Keep track of which row is being shifted by i */
+    for(i = 1; i < 4; i++) {
+        out = 0;
+
+        /* Find row, since it is the ith column of state matrix */
+        row = ((state[0] >> (24 - 8*i)) & 0xFF) << 24 | ((state[1] >> (24 - 8*i)) & 0xFF) << 16 | ((state[2] >> (24 - 8*i)) & 0xFF) << 8 | ((state[3] >> (24 - 8*i)) & 0xFF);
+
+        /* Shift each byte accordingly */
+        for(j = 0; j < 4; j++) {
+            /* Isolate byte */
+            tmp = (row >> (24 - 8 * j)) & 0xFF;
+
+            /* Shift byte */
+            pos = (3 - j + i) % 4;
+            tmp = tmp << 8 * pos;
+            out |= tmp;
+        }
+
+        /* Store as column i of state matrix */
+        unsigned int mask = 0;
+        if(i == 1) {
+            mask = 0xFF00FFFF;
+        }
+        else if(i == 2) {
+            mask = 0xFFFF00FF;
+        }
+        else {
+            mask = 0xFFFFFF00;
+        }
+        for(j = 0; j < 4; j++) {
+            state[j] = (state[j] & mask) | (((out >> (24 - 8*j)) & 0xFF) << (24 - 8*i));
+        }
+    }
+}
+
+/* Special Matrix Multiplication given a row and column, for any GF(2^8) coefficients */
+unsigned int MultiplyMatrix(unsigned int row, unsigned int col) {
+    int i;
+    unsigned int m = 0x1B;
+    unsigned int r = 0;
+    unsigned int c = 0;
+    unsigned int tmp = 0;
+    unsigned int sum = 0;
+
+    /* Iterate on each element of row and col */
+    for(i = 0; i < 4; i++) {
+        /* Isolate row and col bytes */
+        r = (row >> (24 - 8 * i)) & 0xFF;
+        c = (col >> (24 - 8 * i)) & 0xFF;
+        tmp = 0;
+
+        /* Store the multiplication c * r into sum, one bit of r at a time */
+        while(r) {
+            if(r & 1) {
+                tmp ^= c;
+            }
+            if(c & 0x80) {
+                c = ((c << 1) ^ m) & 0xFF;
+            }
+            else {
+                c = c << 1;
+            }
+            r >>= 1;
+        }
+        sum ^= tmp;
+    }
+
+    return sum & 0xFF;
+}
+
+/* Mix Columns Protocol */
+void MixColumns(unsigned int *state) {
+    PROFILE_STAGE(PROFILE_MIX_COLUMNS);
+    int i;
+    int j;
+    unsigned int tmp;
+    unsigned int calculated[4] = { 0, 0, 0, 0 };
+
+    /* Traverse each row of MCE */
+    for(i = 0; i < 4; i++) {
+        /* Traverse each column of state */
+        for(j = 0; j < 4; j++) {
+            /* Store isolated byte */
+            tmp = MultiplyMatrix(MCE[i], state[j]);
+
+            /* Move byte and store in new state */
+            calculated[j] |= tmp << (24 - 8 * i);
+        }
+    }
+
+    /* Copy calculated matrix to state */
+    memcpy(state, calculated, 16);
+}
+
+/* Inverse SubstituteBytes Protocol */
+void InvSubstituteBytes(unsigned int *state) {
+    int i;
+    int j;
+    for(i = 0; i < 4; i++) {
+        unsigned int out = 0;
+        for(j = 0; j < 4; j++) {
+            out |= (unsigned int)invsbox[(state[i] >> (24 - 8 * j)) & 0xFF] << (24 - 8 * j);
+        }
+        state[i] = out;
+    }
+}
+
+/* Inverse Shift Rows Protocol: row i moves i columns to the right */
+void InvShiftRows(unsigned int *state) {
+    int i;
+    int j;
+    unsigned int row = 0;
+    unsigned int tmp = 0;
+    unsigned int out = 0;
+    int pos = 0;
+
+    for(i = 1; i < 4; i++) {
+        out = 0;
+
+        /* Find row, since it is the ith column of state matrix */
+        row = ((state[0] >> (24 - 8*i)) & 0xFF) << 24 | ((state[1] >> (24 - 8*i)) & 0xFF) << 16 | ((state[2] >> (24 - 8*i)) & 0xFF) << 8 | ((state[3] >> (24 - 8*i)) & 0xFF);
+
+        /* Shift each byte accordingly */
+        for(j = 0; j < 4; j++) {
+            tmp = (row >> (24 - 8 * j)) & 0xFF;
+            pos = (7 - j - i) % 4;
+            out |= tmp << 8 * pos;
+        }
+
+        /* Store as column i of state matrix */
+        unsigned int mask = ~(0xFFu << (24 - 8*i));
+        for(j = 0; j < 4; j++) {
+            state[j] = (state[j] & mask) | (((out >> (24 - 8*j)) & 0xFF) << (24 - 8*i));
+        }
+    }
+}
+
+/* Inverse Mix Columns Protocol */
+void InvMixColumns(unsigned int *state) {
+    int i;
+    int j;
+    unsigned int calculated[4] = { 0, 0, 0, 0 };
+
+    for(i = 0; i < 4; i++) {
+        for(j = 0; j < 4; j++) {
+            calculated[j] |= MultiplyMatrix(MCD[i], state[j]) << (24 - 8 * i);
+        }
+    }
+
+    memcpy(state, calculated, 16);
+}
+
+/* Run the step-by-step protocols on state without printing anything */
+void EncryptState(unsigned int *state, const unsigned int *w, int rounds) {
+    NoTrace trace;
+
+    EncryptStateTraced(state, w, rounds, trace);
+}
+
+/* Run the inverse protocols on state, undoing EncryptState() */
+void DecryptState(unsigned int *state, const unsigned int *w, int rounds) {
+    int count = rounds;
+
+    AddRoundKey(state, w, count);
+    count--;
+
+    for(; count > 0; count--) {
+        InvShiftRows(state);
+        InvSubstituteBytes(state);
+        AddRoundKey(state, w, count);
+        InvMixColumns(state);
+    }
+
+    InvShiftRows(state);
+    InvSubstituteBytes(state);
+    AddRoundKey(state, w, count);
+}
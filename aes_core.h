@@ -0,0 +1,123 @@
+/*
+ * Step-by-step protocols for the AES Encryption project
+ *
+ * Every protocol works on the state and expanded key it is given, so any
+ * number of encryptions can run at once. aes.cpp and aes_multiple.cpp
+ * drive these to print and compare the intermediate rounds.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_CORE_H
+#define AES_CORE_H
+
+#include <stdint.h>
+
+#include "aes_tables.h"
+
+/* Reference to S-BOX table, generated at compile time */
+inline constexpr const uint8_t (&sbox)[256] = aesTables.sbox;
+/* Inverse S-BOX, generated alongside sbox */
+inline constexpr const uint8_t (&invsbox)[256] = aesTables.invsbox;
+
+/* Key of Nk words (4, 6 or 8): its round count and expanded key length */
+template<int Nk>
+struct KeySize {
+    static const int Rounds = Nk + 6;
+    static const int Words = 4 * (Nk + 7);
+};
+
+/* The largest schedule, for AES-256 */
+#define MAX_ROUNDS 14
+#define MAX_KEY_WORDS 60
+
+/* Given an input byte, return the corresponding output byte from the S-Box */
+inline unsigned int CalculateSboxValue(unsigned int input) {
+    int row = (input >> 4) & 0xF;
+    int col = input & 0xF;
+
+    return sbox[row * 16 + col];
+}
+
+/* Print the calculated S-Box so it can be verified */
+void PrintSbox();
+
+/* SubWord Protocol, inline with RotWord so the on-the-fly key schedule keeps its words in registers */
+inline unsigned int SubWord(unsigned int w) {
+    unsigned int out = 0;
+    int i;
+
+    /* Perform a byte substitution using the S-Box */
+    for(i = 0; i < 4; i++) {
+        /* Isolate the byte being used */
+        unsigned int tmp = (w >> (24 - i * 8)) & 0xFF;
+
+        /* Calculate the subsituted byte and store in out */
+        tmp = CalculateSboxValue(tmp);
+        out |= (tmp << (24 - i * 8));
+    }
+
+    return out;
+}
+
+/* RotWord Protocol */
+inline unsigned int RotWord(unsigned int w) {
+    /* Isolate B0 */
+    unsigned int tmp = (w >> 24) & 0xFF;
+
+    /* Shift w to B1 B2 B3 00 */
+    w = w << 8;
+
+    /* Complete rotation to B1 B2 B3 B0 */
+    return w | tmp;
+}
+
+/* Key Expansion Protocol: 4 * Nk key bytes into KeySize<Nk>::Words words, printing each step when trace is set */
+template<int Nk>
+void ExpandKey(const uint8_t *key, unsigned int *w, bool trace = false);
+
+/* Key Expansion Protocol for a 16-byte key: 44 words */
+inline void ExpandKey(const uint8_t *key, unsigned int *w, bool trace = false) {
+    ExpandKey<4>(key, w, trace);
+}
+
+/* Print the first words of the Expanded Key in a readable format */
+void PrintExpandedKey(const unsigned int *w, int words = 44);
+
+/* Print the State in a readable format */
+void PrintState(const unsigned int *state);
+
+/* Print the Round Key for round count in a readable format */
+void PrintRoundKey(const unsigned int *w, int count);
+
+/* AddRoundKey protocol, using the round key for round count */
+void AddRoundKey(unsigned int *state, const unsigned int *w, int count);
+
+/* SubstituteBytes Protocol */
+void SubstituteBytes(unsigned int *state);
+
+/* Shift Rows Protocol */
+void ShiftRows(unsigned int *state);
+
+/* Special Matrix Multiplication given a row and column, for any GF(2^8) coefficients */
+unsigned int MultiplyMatrix(unsigned int row, unsigned int col);
+
+/* Mix Columns Protocol */
+void MixColumns(unsigned int *state);
+
+/* Inverse SubstituteBytes Protocol */
+void InvSubstituteBytes(unsigned int *state);
+
+/* Inverse Shift Rows Protocol */
+void InvShiftRows(unsigned int *state);
+
+/* Inverse Mix Columns Protocol */
+void InvMixColumns(unsigned int *state);
+
+/* Run every protocol in order on state without printing anything, for 10, 12 or 14 rounds */
+void EncryptState(unsigned int *state, const unsigned int *w, int rounds = 10);
+
+/* Run the inverse protocols in reverse order on state */
+void DecryptState(unsigned int *state, const unsigned int *w, int rounds = 10);
+
+#endif
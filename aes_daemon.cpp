@@ -0,0 +1,663 @@
+/*
+ * Encryption daemon for the AES Encryption project
+ *
+ * Serves the protocol in aes_wire.h on a Unix domain socket. One thread
+ * runs an epoll loop over the listening socket and every connection. Each
+ * time round the loop it reads what the ready connections have sent,
+ * parses every complete request, reserves the replies in the connections'
+ * output buffers, and hands the requests of the whole round to the thread
+ * pool in tasks of about DAEMON_TASK_BYTES. Replies are sent once the
+ * round's tasks are done. Clients that pipeline their requests therefore
+ * get them processed many at a time, and the key schedules loaded into
+ * the table are expanded only once.
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "aes_engine.h"
+#include "aes_modes.h"
+#include "aes_pool.h"
+#include "aes_wire.h"
+
+/* Bytes read from a connection per turn of the loop */
+#define DAEMON_READ (64 * 1024)
+
+/* A connection is not read from while this much of its output is unsent */
+#define DAEMON_OUTPUT_LIMIT (4 * 1024 * 1024)
+
+/* Payload bytes handed to one pool task */
+#define DAEMON_TASK_BYTES (64 * 1024)
+
+/* Events taken per epoll_wait() */
+#define DAEMON_EVENTS 256
+
+/* Most pool threads -threads may ask for */
+#define DAEMON_MAX_THREADS 1024
+
+struct Connection {
+    int fd;
+    /* Received bytes; requests before inStart have been parsed */
+    std::vector<uint8_t> in;
+    size_t inStart;
+    /* Replies; those before outStart have been sent */
+    std::vector<uint8_t> out;
+    size_t outStart;
+    /* Events currently registered with epoll */
+    uint32_t events;
+    /* The peer has finished sending; close once the replies are out */
+    bool eof;
+    /* A read or write failed; close at the end of the round */
+    bool failed;
+    /* Already in this round's list */
+    bool active;
+};
+
+/* One request of a round */
+struct Job {
+    Connection *conn;
+    std::shared_ptr<const AesContext> ctx;
+    const uint8_t *in;
+    uint32_t length;
+    uint8_t mode;
+    uint8_t iv[16];
+    /* Offset of the reserved reply in conn->out, and the payload bytes of the reply once it is done */
+    size_t reply;
+    uint32_t replyLength;
+    uint32_t status;
+};
+
+/* Overwrite a buffer in a way the compiler may not drop as a dead store */
+static void SecureZero(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while(len--) {
+        *v++ = 0;
+    }
+}
+
+/* Deleter for loaded keys: wipe the round keys before the memory is reused */
+static void DestroyContext(const AesContext *ctx) {
+    SecureZero((void *)ctx, sizeof(AesContext));
+    delete ctx;
+}
+
+/* Reply payload bytes reserved for a request; CBC encryption adds up to a block of padding */
+static size_t ReplyBytes(const WireRequest *r) {
+    switch(r->mode) {
+    case WIRE_ECB_ENCRYPT:
+    case WIRE_ECB_DECRYPT:
+    case WIRE_CTR:
+    case WIRE_CBC_DECRYPT:
+        return r->length;
+    case WIRE_CBC_ENCRYPT:
+        return r->length / 16 * 16 + 16;
+    default:
+        return 0;
+    }
+}
+
+/* Run one request into its reserved reply */
+static void RunJob(Job *job) {
+    uint8_t *out = job->conn->out.data() + job->reply + sizeof(WireReply);
+    size_t plainLen;
+
+    switch(job->mode) {
+    case WIRE_ECB_ENCRYPT:
+        EncryptBlocks(job->ctx.get(), job->in, out, job->length / 16);
+        break;
+    case WIRE_ECB_DECRYPT:
+        DecryptBlocks(job->ctx.get(), job->in, out, job->length / 16);
+        break;
+    case WIRE_CTR:
+        CtrCrypt(job->ctx.get(), job->iv, 0, job->in, out, job->length);
+        break;
+    case WIRE_CBC_ENCRYPT:
+        job->replyLength = (uint32_t)CbcEncryptPadded(job->ctx.get(), job->iv, job->in, out, job->length);
+        break;
+    case WIRE_CBC_DECRYPT:
+        if(CbcDecryptPadded(job->ctx.get(), job->iv, job->in, out, job->length, &plainLen)) {
+            job->replyLength = (uint32_t)plainLen;
+        }
+        else {
+            job->replyLength = 0;
+            job->status = WIRE_BAD_PADDING;
+        }
+        break;
+    }
+}
+
+/* True when nothing accepts connections on the socket at address, so it may be removed */
+static bool StaleSocket(const sockaddr_un *address) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool stale;
+
+    if(fd < 0) {
+        return false;
+    }
+    stale = connect(fd, (const sockaddr *)address, sizeof(*address)) != 0 && errno == ECONNREFUSED;
+    close(fd);
+
+    return stale;
+}
+
+class Daemon {
+public:
+    Daemon(unsigned int threads, AesEngine engine) : requests(0), rounds(0), pool(threads), engine(engine), path(NULL), listener(-1), signals(-1), epoll(-1) {}
+    ~Daemon();
+
+    /* Bind path and set up the loop; SIGINT and SIGTERM must already be blocked */
+    bool Listen(const char *path);
+
+    /* Serve until SIGINT or SIGTERM */
+    void Run();
+
+    /* Requests served, and turns of the loop that had any */
+    uint64_t requests;
+    uint64_t rounds;
+
+private:
+    void Accept();
+    void Read(Connection *c);
+    void Parse(Connection *c);
+    void Write(Connection *c);
+    void Process();
+    void Finish(Connection *c);
+    void Watch(Connection *c);
+
+    ThreadPool pool;
+    AesEngine engine;
+    const char *path;
+    int listener;
+    int signals;
+    int epoll;
+
+    std::unordered_map<uint32_t, std::shared_ptr<const AesContext>> keys;
+    std::vector<Connection *> active;
+    std::vector<Job> jobs;
+};
+
+Daemon::~Daemon() {
+    if(listener >= 0) {
+        close(listener);
+    }
+    if(path != NULL) {
+        unlink(path);
+    }
+    if(signals >= 0) {
+        close(signals);
+    }
+    if(epoll >= 0) {
+        close(epoll);
+    }
+}
+
+bool Daemon::Listen(const char *socketPath) {
+    sockaddr_un address;
+    epoll_event event;
+    sigset_t mask;
+    struct stat st;
+
+    if(strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socketPath);
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    /* A socket left behind by an aesd that has exited is replaced; anything else at the path is left alone */
+    if(lstat(socketPath, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", socketPath);
+            return false;
+        }
+        if(!StaleSocket(&address)) {
+            fprintf(stderr, "%s is in use by another server\n", socketPath);
+            return false;
+        }
+        unlink(socketPath);
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0) {
+        perror(socketPath);
+        return false;
+    }
+
+    /* The path is ours to remove from here on */
+    path = socketPath;
+    if(listen(listener, SOMAXCONN) != 0) {
+        perror(socketPath);
+        return false;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(signals < 0 || epoll < 0) {
+        perror("aesd");
+        return false;
+    }
+
+    /* Connections carry their Connection; these two point at their own descriptors */
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &listener;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    event.data.ptr = &signals;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, signals, &event);
+
+    return true;
+}
+
+void Daemon::Accept() {
+    epoll_event event;
+    Connection *c;
+    int fd;
+
+    for(;;) {
+        fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            return;
+        }
+
+        c = new Connection();
+        c->fd = fd;
+        c->inStart = 0;
+        c->outStart = 0;
+        c->events = EPOLLIN;
+        c->eof = false;
+        c->failed = false;
+        c->active = false;
+
+        memset(&event, 0, sizeof(event));
+        event.events = c->events;
+        event.data.ptr = c;
+        if(epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            perror("epoll_ctl");
+            close(fd);
+            delete c;
+        }
+    }
+}
+
+void Daemon::Read(Connection *c) {
+    size_t size = c->in.size();
+    ssize_t n;
+
+    c->in.resize(size + DAEMON_READ);
+    n = recv(c->fd, c->in.data() + size, DAEMON_READ, 0);
+    if(n > 0) {
+        c->in.resize(size + n);
+        return;
+    }
+
+    c->in.resize(size);
+    if(n == 0) {
+        c->eof = true;
+    }
+    else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        c->failed = true;
+    }
+}
+
+/* Turn every complete request in c->in into a job with its reply reserved in c->out */
+void Daemon::Parse(Connection *c) {
+    WireRequest r;
+    WireReply *reply;
+    Job job;
+    size_t reserve;
+    uint8_t bad;
+
+    while(c->in.size() - c->inStart >= sizeof(WireRequest)) {
+        memcpy(&r, c->in.data() + c->inStart, sizeof(r));
+        if(r.length > WIRE_MAX_PAYLOAD) {
+            c->failed = true;
+            return;
+        }
+        if(c->in.size() - c->inStart - sizeof(WireRequest) < r.length) {
+            return;
+        }
+
+        job.conn = c;
+        job.ctx = NULL;
+        job.in = c->in.data() + c->inStart + sizeof(WireRequest);
+        job.length = r.length;
+        job.mode = r.mode;
+        memcpy(job.iv, r.iv, 16);
+        job.status = WIRE_OK;
+        c->inStart += sizeof(WireRequest) + r.length;
+
+        /* Lengths the mode cannot take */
+        bad = r.mode >= WIRE_MODES;
+        bad = bad || ((r.mode == WIRE_ECB_ENCRYPT || r.mode == WIRE_ECB_DECRYPT) && r.length % 16 != 0);
+        bad = bad || (r.mode == WIRE_CBC_DECRYPT && (r.length == 0 || r.length % 16 != 0));
+        bad = bad || (r.mode == WIRE_LOAD_KEY && r.length != 16 && r.length != 24 && r.length != 32);
+
+        if(bad) {
+            job.status = WIRE_BAD_REQUEST;
+        }
+        else if(r.mode == WIRE_LOAD_KEY) {
+            /* Requests parsed before this one keep the context they looked up */
+            AesContext *ctx = new AesContext;
+            InitializeContext(ctx, job.in, r.length, engine);
+            keys[r.keyId] = std::shared_ptr<const AesContext>(ctx, DestroyContext);
+        }
+        else if(r.mode == WIRE_DROP_KEY) {
+            keys.erase(r.keyId);
+        }
+        else {
+            auto found = keys.find(r.keyId);
+            if(found == keys.end()) {
+                job.status = WIRE_NO_KEY;
+            }
+            else {
+                job.ctx = found->second;
+            }
+        }
+
+        reserve = job.status == WIRE_OK ? ReplyBytes(&r) : 0;
+        job.reply = c->out.size();
+        job.replyLength = (uint32_t)reserve;
+        c->out.resize(c->out.size() + sizeof(WireReply) + reserve);
+        reply = (WireReply *)(c->out.data() + job.reply);
+        reply->tag = r.tag;
+
+        jobs.push_back(job);
+    }
+}
+
+void Daemon::Write(Connection *c) {
+    ssize_t n;
+
+    while(c->outStart < c->out.size()) {
+        n = send(c->fd, c->out.data() + c->outStart, c->out.size() - c->outStart, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                c->failed = true;
+            }
+            return;
+        }
+        c->outStart += n;
+    }
+
+    c->out.clear();
+    c->outStart = 0;
+}
+
+/* Run the round's jobs on the pool, then close up the replies that came out shorter than reserved */
+void Daemon::Process() {
+    std::vector<size_t> starts;
+    size_t bytes = 0;
+    size_t i;
+
+    for(i = 0; i < jobs.size(); i++) {
+        if(i == 0 || bytes >= DAEMON_TASK_BYTES) {
+            starts.push_back(i);
+            bytes = 0;
+        }
+        bytes += jobs[i].length + sizeof(WireRequest);
+    }
+    starts.push_back(jobs.size());
+
+    pool.ParallelFor(starts.size() - 1, [&](size_t task) {
+        size_t j;
+
+        for(j = starts[task]; j < starts[task + 1]; j++) {
+            if(jobs[j].ctx != NULL) {
+                RunJob(&jobs[j]);
+            }
+        }
+    });
+
+    /* A connection's replies are contiguous and in request order */
+    Connection *c = NULL;
+    size_t write = 0;
+    for(Job &job : jobs) {
+        if(job.conn != c) {
+            if(c != NULL) {
+                c->out.resize(write);
+            }
+            c = job.conn;
+            write = job.reply;
+        }
+
+        WireReply *reply = (WireReply *)(c->out.data() + job.reply);
+        reply->length = job.replyLength;
+        reply->status = job.status;
+        if(write != job.reply) {
+            memmove(c->out.data() + write, reply, sizeof(WireReply) + job.replyLength);
+        }
+        write += sizeof(WireReply) + job.replyLength;
+    }
+    if(c != NULL) {
+        c->out.resize(write);
+    }
+
+    requests += jobs.size();
+    jobs.clear();
+}
+
+/* Update what epoll reports for c to match its buffers */
+void Daemon::Watch(Connection *c) {
+    epoll_event event;
+    uint32_t events = 0;
+
+    if(!c->eof && c->out.size() - c->outStart < DAEMON_OUTPUT_LIMIT) {
+        events |= EPOLLIN;
+    }
+    if(c->outStart < c->out.size()) {
+        events |= EPOLLOUT;
+    }
+
+    if(events != c->events) {
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = c;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &event);
+        c->events = events;
+    }
+}
+
+/* End of a round for c: drop parsed input, send replies, and close it if it is done */
+void Daemon::Finish(Connection *c) {
+    c->active = false;
+
+    c->in.erase(c->in.begin(), c->in.begin() + c->inStart);
+    c->inStart = 0;
+
+    if(!c->failed) {
+        Write(c);
+    }
+
+    if(c->failed || (c->eof && c->out.empty())) {
+        close(c->fd);
+        delete c;
+        return;
+    }
+
+    Watch(c);
+}
+
+void Daemon::Run() {
+    epoll_event events[DAEMON_EVENTS];
+    signalfd_siginfo info;
+    Connection *c;
+    int n;
+    int i;
+
+    for(;;) {
+        n = epoll_wait(epoll, events, DAEMON_EVENTS, -1);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+
+        for(i = 0; i < n; i++) {
+            if(events[i].data.ptr == &signals) {
+                if(read(signals, &info, sizeof(info)) == sizeof(info)) {
+                    return;
+                }
+                continue;
+            }
+            if(events[i].data.ptr == &listener) {
+                Accept();
+                continue;
+            }
+
+            c = (Connection *)events[i].data.ptr;
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                Read(c);
+            }
+            if(!c->active) {
+                c->active = true;
+                active.push_back(c);
+            }
+        }
+
+        /* Replies are reserved before any job runs, so the output buffers do not move under the pool */
+        for(Connection *a : active) {
+            if(!a->failed) {
+                if(a->outStart > 0) {
+                    a->out.erase(a->out.begin(), a->out.begin() + a->outStart);
+                    a->outStart = 0;
+                }
+                Parse(a);
+            }
+        }
+
+        if(!jobs.empty()) {
+            Process();
+            rounds++;
+        }
+
+        for(Connection *a : active) {
+            Finish(a);
+        }
+        active.clear();
+    }
+}
+
+/* Parse a decimal number from min to max into *out; false for anything else, including a sign or trailing characters */
+static bool ParseCount(const char *s, unsigned long long min, unsigned long long max, unsigned long long *out) {
+    char *end;
+
+    if(!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+
+    errno = 0;
+    *out = strtoull(s, &end, 10);
+
+    return errno == 0 && *end == '\0' && *out >= min && *out <= max;
+}
+
+static void PrintUsage() {
+    printf("\nUsage: ./aesd -socket <path> [-threads <n>] [-engine auto|ttable|aesni|bitslice|vperm]\n");
+    printf("Serves the protocol in aes_wire.h until SIGINT or SIGTERM (default: one thread per hardware thread, at most %u).\n\n", DAEMON_MAX_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    unsigned int threads = std::min((unsigned int)DAEMON_MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+    unsigned long long value = 0;
+    AesEngine engine = ENGINE_AUTO;
+    sigset_t mask;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(i + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+
+        bool ok = true;
+        if(strcmp(argv[i], "-socket") == 0) {
+            path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-threads") == 0) {
+            ok = ParseCount(argv[++i], 1, DAEMON_MAX_THREADS, &value);
+            threads = value;
+        }
+        else if(strcmp(argv[i], "-engine") == 0) {
+            i++;
+            if(strcmp(argv[i], "ttable") == 0) {
+                engine = ENGINE_TTABLE;
+            }
+            else if(strcmp(argv[i], "aesni") == 0) {
+                engine = ENGINE_AESNI;
+            }
+            else if(strcmp(argv[i], "bitslice") == 0) {
+                engine = ENGINE_BITSLICE;
+            }
+            else if(strcmp(argv[i], "vperm") == 0) {
+                engine = ENGINE_VPERM;
+            }
+            else {
+                ok = strcmp(argv[i], "auto") == 0;
+            }
+        }
+        else {
+            ok = false;
+        }
+
+        if(!ok) {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if(path == NULL) {
+        PrintUsage();
+        return 1;
+    }
+
+    /* Blocked before the pool starts, so only the signalfd sees them */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    Daemon daemon(threads, engine);
+    if(!daemon.Listen(path)) {
+        return 1;
+    }
+
+    fprintf(stderr, "aesd: listening on %s with %u thread%s\n", path, threads, threads == 1 ? "" : "s");
+    daemon.Run();
+    fprintf(stderr, "aesd: served %llu requests in %llu rounds\n", (unsigned long long)daemon.requests, (unsigned long long)daemon.rounds);
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Engine selection for the AES Encryption project
+ *
+ * Builds cipher contexts from a key, converting the ExpandKey() output into
+ * the layouts the engines need, and picks the engine instance for the
+ * context's engine and key size.
+ *
+ * AES Encryption
+ */
+
+#include "aes_core.h"
+#include "aes_engine.h"
+
+/* Resolve a requested engine against what this CPU can run */
+static AesEngine ResolveEngine(AesEngine engine) {
+    if(engine == ENGINE_AUTO) {
+        return HasAesNi() ? ENGINE_AESNI : ENGINE_TTABLE;
+    }
+
+    /* Fall back to the portable engine when the instructions are missing */
+    if(engine == ENGINE_AESNI && !HasAesNi()) {
+        return ENGINE_TTABLE;
+    }
+    if(engine == ENGINE_VPERM && !HasSsse3()) {
+        return ENGINE_TTABLE;
+    }
+
+    return engine;
+}
+
+/* Entry points stored in the context: one per engine and round count, with no test of either inside */
+template<int Nr>
+static void EncryptTTable(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    EncryptBlocksTTable<Nr>(ctx->w, in, out, blocks);
+}
+
+template<int Nr>
+static void DecryptTTable(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    DecryptBlocksTTable<Nr>(ctx->dw, in, out, blocks);
+}
+
+template<int Nr>
+static void EncryptNi(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    EncryptBlocksNi<Nr>(ctx->rk, in, out, blocks);
+}
+
+template<int Nr>
+static void DecryptNi(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    DecryptBlocksNi<Nr>(ctx->drk, in, out, blocks);
+}
+
+template<int Nr>
+static void EncryptBitslice(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    EncryptBlocksBitslice<Nr>(ctx->sliced, in, out, blocks);
+}
+
+template<int Nr>
+static void DecryptBitslice(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    DecryptBlocksBitslice<Nr>(ctx->sliced, in, out, blocks);
+}
+
+template<int Nr>
+static void EncryptVperm(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    EncryptBlocksVperm<Nr>(ctx->rk, in, out, blocks);
+}
+
+template<int Nr>
+static void DecryptVperm(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    DecryptBlocksVperm<Nr>(ctx->drk, in, out, blocks);
+}
+
+/* Point ctx at the engine instances for its engine and round count */
+template<int Nr>
+static void SelectEngine(AesContext *ctx) {
+    ctx->rounds = Nr;
+
+    if(ctx->engine == ENGINE_AESNI) {
+        ctx->encrypt = EncryptNi<Nr>;
+        ctx->decrypt = DecryptNi<Nr>;
+        ctx->encryptKeys = EncryptMultiKeyNi<Nr>;
+    }
+    else if(ctx->engine == ENGINE_BITSLICE) {
+        ctx->encrypt = EncryptBitslice<Nr>;
+        ctx->decrypt = DecryptBitslice<Nr>;
+        ctx->encryptKeys = EncryptMultiKeyBitslice<Nr>;
+    }
+    else if(ctx->engine == ENGINE_VPERM) {
+        ctx->encrypt = EncryptVperm<Nr>;
+        ctx->decrypt = DecryptVperm<Nr>;
+        ctx->encryptKeys = EncryptMultiKeyVperm<Nr>;
+    }
+    else {
+        ctx->encrypt = EncryptTTable<Nr>;
+        ctx->decrypt = DecryptTTable<Nr>;
+        ctx->encryptKeys = EncryptMultiKeyTTable<Nr>;
+    }
+}
+
+/* Expand a key of Nk words and point ctx at the engine instances for its round count */
+template<int Nk>
+static void ExpandContext(AesContext *ctx, const uint8_t *key) {
+    const int Nr = KeySize<Nk>::Rounds;
+
+    ExpandKey<Nk>(key, ctx->w);
+    InvertKeySchedule(ctx->w, ctx->dw, Nr);
+    SelectEngine<Nr>(ctx);
+}
+
+bool InitializeContext(AesContext *ctx, const uint8_t *key, size_t keyBytes, AesEngine engine) {
+    int i;
+    int j;
+
+    ctx->engine = ResolveEngine(engine);
+
+    if(keyBytes == 16) {
+        ExpandContext<4>(ctx, key);
+    }
+    else if(keyBytes == 24) {
+        ExpandContext<6>(ctx, key);
+    }
+    else if(keyBytes == 32) {
+        ExpandContext<8>(ctx, key);
+    }
+    else {
+        return false;
+    }
+
+    /* Word i of the expanded key is column i % 4 of round key i / 4 */
+    for(i = 0; i < 4 * (ctx->rounds + 1); i++) {
+        for(j = 0; j < 4; j++) {
+            ctx->rk[i / 4][4 * (i % 4) + j] = (ctx->w[i] >> (24 - 8 * j)) & 0xFF;
+            ctx->drk[i / 4][4 * (i % 4) + j] = (ctx->dw[i] >> (24 - 8 * j)) & 0xFF;
+        }
+    }
+
+    if(ctx->engine == ENGINE_BITSLICE) {
+        SliceRoundKeys(ctx->rk, ctx->sliced, ctx->rounds);
+    }
+
+    return true;
+}
+
+/* Batched expansion of keys of Nk words; ExpandKeysNi() writes every schedule, the rest is per context */
+template<int Nk>
+static void ExpandContexts(AesContext *ctxs, const uint8_t *const *keys, size_t count, AesEngine engine) {
+    const int Nr = KeySize<Nk>::Rounds;
+    size_t n;
+
+    ExpandKeysNi<Nk>(ctxs, keys, count);
+
+    for(n = 0; n < count; n++) {
+        AesContext *ctx = &ctxs[n];
+
+        ctx->engine = engine;
+        SelectEngine<Nr>(ctx);
+
+        if(engine == ENGINE_BITSLICE) {
+            SliceRoundKeys(ctx->rk, ctx->sliced, Nr);
+        }
+    }
+}
+
+bool InitializeContexts(AesContext *ctxs, const uint8_t *const *keys, size_t keyBytes, size_t count, AesEngine engine) {
+    size_t n;
+
+    if(keyBytes != 16 && keyBytes != 24 && keyBytes != 32) {
+        return false;
+    }
+
+    /* Without AES-NI each key is expanded on its own */
+    if(!HasAesNi()) {
+        for(n = 0; n < count; n++) {
+            InitializeContext(&ctxs[n], keys[n], keyBytes, engine);
+        }
+        return true;
+    }
+
+    if(keyBytes == 16) {
+        ExpandContexts<4>(ctxs, keys, count, ResolveEngine(engine));
+    }
+    else if(keyBytes == 24) {
+        ExpandContexts<6>(ctxs, keys, count, ResolveEngine(engine));
+    }
+    else {
+        ExpandContexts<8>(ctxs, keys, count, ResolveEngine(engine));
+    }
+
+    return true;
+}
+
+void EncryptBlocksMultiKey(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    size_t n = 0;
+    size_t run;
+
+    /* A run of contexts sharing an engine instance goes to that instance in one call */
+    while(n < count) {
+        run = 1;
+        while(n + run < count && ctxs[n + run]->encryptKeys == ctxs[n]->encryptKeys) {
+            run++;
+        }
+
+        ctxs[n]->encryptKeys(ctxs + n, in + n, out + n, run);
+        n += run;
+    }
+}
+
+const char *EngineName(AesEngine engine) {
+    switch(engine) {
+        case ENGINE_TTABLE:
+            return "ttable";
+        case ENGINE_AESNI:
+            return "aesni";
+        case ENGINE_BITSLICE:
+            return "bitslice";
+        case ENGINE_VPERM:
+            return "vperm";
+        default:
+            return "auto";
+    }
+}
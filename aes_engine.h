@@ -0,0 +1,211 @@
+/*
+ * Round engines for the AES Encryption project
+ *
+ * The step-by-step protocols in aes.cpp show each transformation of the
+ * state on its own. The engines declared here compute the same cipher with
+ * the steps fused together, for use on bulk data.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_ENGINE_H
+#define AES_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_core.h"
+
+/* Available round engines */
+enum AesEngine {
+    ENGINE_AUTO,
+    ENGINE_TTABLE,
+    ENGINE_AESNI,
+    ENGINE_BITSLICE,
+    ENGINE_VPERM
+};
+
+/*
+ * Cipher context: the expanded key in the layouts each engine consumes and
+ * the engine that runs it. InitializeContext() is the only writer; after it
+ * returns the context is read-only, so any number of threads may encrypt
+ * with one context at the same time. Encryption keeps its state on the
+ * stack and writes only to the caller's output buffer.
+ *
+ * The schedules are sized for AES-256; a shorter key uses the first
+ * rounds + 1 round keys. The engines are compiled once per round count,
+ * and encrypt and decrypt point at the instance for this key, so the
+ * round loops never test the key length.
+ */
+struct alignas(64) AesContext {
+    /* Expanded key words from ExpandKey() */
+    unsigned int w[MAX_KEY_WORDS];
+    /* The same round keys in byte order, aligned for 128-bit loads */
+    alignas(16) uint8_t rk[MAX_ROUNDS + 1][16];
+    /* Equivalent inverse key schedule from InvertKeySchedule(), as words and bytes */
+    unsigned int dw[MAX_KEY_WORDS];
+    alignas(16) uint8_t drk[MAX_ROUNDS + 1][16];
+    /* Bit planes of each round key, filled only for the bitsliced engine */
+    alignas(16) uint8_t sliced[MAX_ROUNDS + 1][8][16];
+    /* Engine chosen by InitializeContext() */
+    AesEngine engine;
+    /* 10, 12 or 14 for a 16, 24 or 32-byte key */
+    int rounds;
+    /* The engine specialized for rounds */
+    void (*encrypt)(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks);
+    void (*decrypt)(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks);
+    /* Multi-key engine for this engine and round count; ctxs[0] is this context */
+    void (*encryptKeys)(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+};
+
+/* Expand a 16, 24 or 32-byte key into ctx and resolve the requested engine; false for any other key length */
+bool InitializeContext(AesContext *ctx, const uint8_t *key, size_t keyBytes, AesEngine engine);
+
+/*
+ * Build count contexts from count keys of keyBytes each, as count calls to
+ * InitializeContext() would. On a CPU with AES-NI the key schedules are
+ * expanded several keys at a time. False for an unsupported key length.
+ */
+bool InitializeContexts(AesContext *ctxs, const uint8_t *const *keys, size_t keyBytes, size_t count, AesEngine engine);
+
+/* Encrypt a run of 16-byte blocks with the engine selected in ctx; in and out may be the same buffer */
+inline void EncryptBlocks(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    ctx->encrypt(ctx, in, out, blocks);
+}
+
+/* Decrypt a run of 16-byte blocks with the engine selected in ctx; in and out may be the same buffer */
+inline void DecryptBlocks(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks) {
+    ctx->decrypt(ctx, in, out, blocks);
+}
+
+/*
+ * Encrypt one block per key: in[i] to out[i] under ctxs[i]. Consecutive
+ * contexts with the same engine and key size run in lockstep, 4 (T-tables),
+ * 8 (AES-NI) or 8/16 (bitsliced) lanes at a time, or one after another
+ * (vector permute), and any remainder is handled by the same call. in[i] and out[i] may be the same buffer.
+ */
+void EncryptBlocksMultiKey(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+/* Name of an engine for diagnostics */
+const char *EngineName(AesEngine engine);
+
+/* T-tables: Te0..Te3 fold SubBytes and MixColumns, Te4 is the final round S-Box */
+inline constexpr const unsigned int (&Te0)[256] = aesTables.te[0];
+inline constexpr const unsigned int (&Te1)[256] = aesTables.te[1];
+inline constexpr const unsigned int (&Te2)[256] = aesTables.te[2];
+inline constexpr const unsigned int (&Te3)[256] = aesTables.te[3];
+inline constexpr const unsigned int (&Te4)[256] = aesTables.te[4];
+
+/* Td0..Td3 fold the inverse S-Box and InvMixColumns, Td4 is the final round inverse S-Box */
+inline constexpr const unsigned int (&Td0)[256] = aesTables.td[0];
+inline constexpr const unsigned int (&Td1)[256] = aesTables.td[1];
+inline constexpr const unsigned int (&Td2)[256] = aesTables.td[2];
+inline constexpr const unsigned int (&Td3)[256] = aesTables.td[3];
+inline constexpr const unsigned int (&Td4)[256] = aesTables.td[4];
+
+/* Reverse the round keys and apply InvMixColumns to all but the first and last, for the equivalent inverse cipher */
+void InvertKeySchedule(const unsigned int *w, unsigned int *dw, int rounds = 10);
+
+/*
+ * The engines below are instantiated for Nr = 10, 12 and 14 rounds, the
+ * AES-128, AES-192 and AES-256 schedules.
+ */
+
+/* Encrypt one state (4 big-endian column words) in place using the T-tables */
+template<int Nr>
+void EncryptStateTTable(const unsigned int *w, unsigned int *s);
+
+/* Encrypt the state in into states[Nr], leaving the state after round r (0 being the initial Add Round Key) in states[r] */
+template<int Nr>
+void TraceStateTTable(const unsigned int *w, const unsigned int *in, unsigned int (*states)[4]);
+
+/* Encrypt a run of 16-byte blocks using the T-tables */
+template<int Nr>
+void EncryptBlocksTTable(const unsigned int *w, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Encrypt one block under each context's T-table schedule, four lanes in lockstep */
+template<int Nr>
+void EncryptMultiKeyTTable(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+/* Decrypt one state in place using the Td tables and an inverted key schedule */
+template<int Nr>
+void DecryptStateTTable(const unsigned int *dw, unsigned int *s);
+
+/* Decrypt a run of 16-byte blocks using the Td tables */
+template<int Nr>
+void DecryptBlocksTTable(const unsigned int *dw, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/*
+ * On-the-fly AES-128 with the T-tables: the 16-byte cipher key is the
+ * whole schedule, and each round key is derived from the previous one
+ * inside the round loop, so a table of many keys needs no AesContext and
+ * no key setup per key. Decryption runs the schedule backwards from round
+ * key 10, which a table kept for decryption stores instead of the key.
+ */
+
+/* Encrypt a run of 16-byte blocks under a 16-byte key; in and out may be the same buffer */
+void EncryptBlocksOnTheFly(const uint8_t *key, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Round key 10 of a 16-byte key, which DecryptBlocksOnTheFly() starts from */
+void LastRoundKey(const uint8_t *key, uint8_t *last);
+
+/* Decrypt a run of 16-byte blocks given round key 10 of the key; in and out may be the same buffer */
+void DecryptBlocksOnTheFly(const uint8_t *last, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* True when CPUID reports the AES-NI instructions */
+bool HasAesNi();
+
+/* Encrypt a run of 16-byte blocks with AESENC/AESENCLAST, 8 blocks in flight */
+template<int Nr>
+void EncryptBlocksNi(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Decrypt with AESDEC/AESDECLAST over the inverted key schedule drk, 8 blocks in flight */
+template<int Nr>
+void DecryptBlocksNi(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Encrypt one block under each context's round keys, 8 lanes in flight */
+template<int Nr>
+void EncryptMultiKeyNi(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+/* Fill w, rk, dw and drk of count contexts from keys of Nk words, 8 schedules at a time */
+template<int Nk>
+void ExpandKeysNi(AesContext *ctxs, const uint8_t *const *keys, size_t count);
+
+/* ExpandKey() for count keys of Nk words, 8 at a time; key n's words go to w + n * KeySize<Nk>::Words */
+template<int Nk>
+void ExpandKeyWordsNi(const uint8_t *const *keys, unsigned int *w, size_t count);
+
+/* True when the CPU and OS support AVX2 */
+bool HasAvx2();
+
+/* Spread each of the rounds + 1 round keys into 8 bit planes for the bitsliced engine */
+void SliceRoundKeys(const uint8_t (*rk)[16], uint8_t (*sliced)[8][16], int rounds = 10);
+
+/* Encrypt a run of 16-byte blocks in constant time, 16 (AVX2) or 8 (SSE2) at once */
+template<int Nr>
+void EncryptBlocksBitslice(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Encrypt one block under each context's round keys in constant time, 16 (AVX2) or 8 (SSE2) lanes at once */
+template<int Nr>
+void EncryptMultiKeyBitslice(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+/* Decrypt in constant time with the same sliced round keys, applied in reverse */
+template<int Nr>
+void DecryptBlocksBitslice(const uint8_t (*sliced)[8][16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* True when CPUID reports SSSE3, for PSHUFB */
+bool HasSsse3();
+
+/* Encrypt a run of 16-byte blocks one at a time in constant time, with the S-Box computed by PSHUFB lookups */
+template<int Nr>
+void EncryptBlocksVperm(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Decrypt one block at a time in constant time over the inverted key schedule drk */
+template<int Nr>
+void DecryptBlocksVperm(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* Encrypt one block under each context's round keys in constant time, one after another */
+template<int Nr>
+void EncryptMultiKeyVperm(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+#endif
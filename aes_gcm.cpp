@@ -0,0 +1,596 @@
+/*
+ * Galois/Counter Mode for the AES Encryption project
+ *
+ * GHASH multiplies in GF(2^128) with PCLMULQDQ when the CPU has it, and
+ * with 4-bit tables of H otherwise. The carry-less path multiplies eight
+ * blocks by H^8 down to H^1 and reduces the sum once, and with AES-NI the
+ * hashing of one batch runs between the AESENC rounds of the next batch's
+ * keystream so the two units work in parallel.
+ *
+ * AES Encryption
+ */
+
+#include <cpuid.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "aes_gcm.h"
+#include "aes_modes.h"
+
+/* True when CPUID reports PCLMULQDQ and the SSSE3 byte shuffle used around it */
+static bool ProbeClmul() {
+    unsigned int a;
+    unsigned int b;
+    unsigned int c;
+    unsigned int d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_PCLMUL) && (c & bit_SSSE3);
+}
+
+static bool HasClmul() {
+    static const bool has = ProbeClmul();
+
+    return has;
+}
+
+/* Load and store 64-bit big-endian integers */
+static inline uint64_t LoadBigEndian64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+}
+
+static inline void StoreBigEndian64(uint8_t *p, uint64_t v) {
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, 8);
+}
+
+/* Counter block: the first 12 bytes of j0 followed by a 32-bit big-endian counter */
+static inline void CounterBlock(const uint8_t *j0, uint32_t counter, uint8_t *block) {
+    memcpy(block, j0, 12);
+    counter = __builtin_bswap32(counter);
+    memcpy(block + 12, &counter, 4);
+}
+
+/* Reduction of the low nibble shifted out of the table product (Shoup's method) */
+static const uint64_t last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/* Build the 4-bit tables: hh/hl[i] is H times the nibble i, in GCM bit order */
+static void BuildTables(GcmKey *key, const uint8_t *h) {
+    uint64_t vh = LoadBigEndian64(h);
+    uint64_t vl = LoadBigEndian64(h + 8);
+    int i;
+    int j;
+
+    key->hh[0] = 0;
+    key->hl[0] = 0;
+    key->hh[8] = vh;
+    key->hl[8] = vl;
+
+    for(i = 4; i > 0; i >>= 1) {
+        uint64_t t = (vl & 1) * 0xe1000000ull;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ (t << 32);
+        key->hh[i] = vh;
+        key->hl[i] = vl;
+    }
+    for(i = 2; i <= 8; i *= 2) {
+        for(j = 1; j < i; j++) {
+            key->hh[i + j] = key->hh[i] ^ key->hh[j];
+            key->hl[i + j] = key->hl[i] ^ key->hl[j];
+        }
+    }
+}
+
+/* x = x * H with the 4-bit tables */
+static void MultiplyTable(const GcmKey *key, uint8_t *x) {
+    uint64_t zh;
+    uint64_t zl;
+    uint8_t rem;
+    uint8_t lo;
+    uint8_t hi;
+    int i;
+
+    lo = x[15] & 0xF;
+    zh = key->hh[lo];
+    zl = key->hl[lo];
+
+    for(i = 15; i >= 0; i--) {
+        lo = x[i] & 0xF;
+        hi = x[i] >> 4;
+
+        if(i != 15) {
+            rem = zl & 0xF;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= key->hh[lo];
+            zl ^= key->hl[lo];
+        }
+
+        rem = zl & 0xF;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (last4[rem] << 48);
+        zh ^= key->hh[hi];
+        zl ^= key->hl[hi];
+    }
+
+    StoreBigEndian64(x, zh);
+    StoreBigEndian64(x + 8, zl);
+}
+
+#pragma GCC push_options
+#pragma GCC target("aes,pclmul,ssse3,sse2")
+
+/* Reverse the bytes of a block, into and out of the bit order PCLMULQDQ multiplies in */
+static inline __m128i ByteSwap(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/* Accumulate the unreduced 256-bit product a * b into lo, mid and hi */
+#define CLMUL_ACCUMULATE(a, b) \
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00)); \
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11)); \
+    mid = _mm_xor_si128(mid, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x01), _mm_clmulepi64_si128(a, b, 0x10)));
+
+/* Fold a 256-bit product of byte-reversed operands back to 128 bits modulo x^128 + x^7 + x^2 + x + 1 */
+static inline __m128i Reduce(__m128i lo, __m128i mid, __m128i hi) {
+    __m128i a;
+    __m128i b;
+    __m128i c;
+
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    /* The operands are bit-reflected, so the product is one bit short: shift it left across both halves */
+    a = _mm_srli_epi32(lo, 31);
+    b = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    c = _mm_srli_si128(a, 12);
+    b = _mm_slli_si128(b, 4);
+    a = _mm_slli_si128(a, 4);
+    lo = _mm_or_si128(lo, a);
+    hi = _mm_or_si128(hi, b);
+    hi = _mm_or_si128(hi, c);
+
+    /* First phase of the reduction */
+    a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    b = _mm_srli_si128(a, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+
+    /* Second phase */
+    c = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    c = _mm_xor_si128(c, b);
+    lo = _mm_xor_si128(lo, c);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+static inline __m128i MultiplyClmul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    CLMUL_ACCUMULATE(a, b);
+
+    return Reduce(lo, mid, hi);
+}
+
+/* H^1 to H^GCM_LANES from H in GCM byte order */
+static void BuildPowers(GcmKey *key, const uint8_t *h) {
+    __m128i h1 = ByteSwap(_mm_loadu_si128((const __m128i *)h));
+    __m128i p = h1;
+    int i;
+
+    for(i = 0; i < GCM_LANES; i++) {
+        _mm_store_si128((__m128i *)key->hp[i], p);
+        p = MultiplyClmul(p, h1);
+    }
+}
+
+/* Hash whole blocks into x, eight per reduction */
+static void GhashClmul(const GcmKey *key, uint8_t *xp, const uint8_t *data, size_t blocks) {
+    __m128i x = ByteSwap(_mm_load_si128((const __m128i *)xp));
+    __m128i h[GCM_LANES];
+    size_t n = 0;
+    int i;
+
+    for(i = 0; i < GCM_LANES; i++) {
+        h[i] = _mm_load_si128((const __m128i *)key->hp[i]);
+    }
+
+    /* x' = (x + d0) H^8 + d1 H^7 + ... + d7 H */
+    for(; n + GCM_LANES <= blocks; n += GCM_LANES) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        for(i = 0; i < GCM_LANES; i++) {
+            __m128i d = ByteSwap(_mm_loadu_si128((const __m128i *)(data + 16 * i)));
+            if(i == 0) {
+                d = _mm_xor_si128(d, x);
+            }
+            CLMUL_ACCUMULATE(d, h[GCM_LANES - 1 - i]);
+        }
+        x = Reduce(lo, mid, hi);
+
+        data += 16 * GCM_LANES;
+    }
+
+    for(; n < blocks; n++) {
+        x = MultiplyClmul(_mm_xor_si128(x, ByteSwap(_mm_loadu_si128((const __m128i *)data))), h[0]);
+        data += 16;
+    }
+
+    _mm_store_si128((__m128i *)xp, ByteSwap(x));
+}
+
+/* One AES round on the eight keystream lanes */
+#define GCM_ROUND(k) \
+    b0 = _mm_aesenc_si128(b0, k); \
+    b1 = _mm_aesenc_si128(b1, k); \
+    b2 = _mm_aesenc_si128(b2, k); \
+    b3 = _mm_aesenc_si128(b3, k); \
+    b4 = _mm_aesenc_si128(b4, k); \
+    b5 = _mm_aesenc_si128(b5, k); \
+    b6 = _mm_aesenc_si128(b6, k); \
+    b7 = _mm_aesenc_si128(b7, k);
+
+/* Counter block i of the batch, whitened with the first round key */
+#define GCM_COUNTER(i) _mm_xor_si128(_mm_or_si128(prefix, _mm_set_epi32((int)__builtin_bswap32(counter + (i)), 0, 0, 0)), k[0])
+
+/* Finish lane b, apply it to input block i and store it */
+#define GCM_STORE(i, b) \
+    _mm_storeu_si128((__m128i *)(out + 16 * (i)), _mm_xor_si128(_mm_aesenclast_si128(b, k[Nr]), _mm_loadu_si128((const __m128i *)(in + 16 * (i)))));
+
+/*
+ * Counter-mode keystream and GHASH for whole blocks with AES-NI. The hash
+ * input of each batch is known before its keystream is: on decryption it
+ * is the batch's own ciphertext, on encryption the previous batch's. Its
+ * eight multiplies are issued between the AES rounds.
+ */
+template<int Nr>
+static void CryptFused(GcmState *g, const uint8_t *in, uint8_t *out, size_t blocks, bool decrypt) {
+    const GcmKey *key = g->key;
+    __m128i prefix = _mm_and_si128(_mm_load_si128((const __m128i *)g->j0), _mm_set_epi32(0, -1, -1, -1));
+    __m128i x = ByteSwap(_mm_load_si128((const __m128i *)g->x));
+    __m128i k[Nr + 1];
+    __m128i h[GCM_LANES];
+    __m128i d[GCM_LANES];
+    uint32_t counter = g->counter;
+    bool pending = false;
+    size_t n = 0;
+    int round;
+    int i;
+
+    for(round = 0; round <= Nr; round++) {
+        k[round] = _mm_load_si128((const __m128i *)key->aes->rk[round]);
+    }
+    for(i = 0; i < GCM_LANES; i++) {
+        h[i] = _mm_load_si128((const __m128i *)key->hp[i]);
+        d[i] = _mm_setzero_si128();
+    }
+
+    for(; n + GCM_LANES <= blocks; n += GCM_LANES) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        __m128i b0 = GCM_COUNTER(0);
+        __m128i b1 = GCM_COUNTER(1);
+        __m128i b2 = GCM_COUNTER(2);
+        __m128i b3 = GCM_COUNTER(3);
+        __m128i b4 = GCM_COUNTER(4);
+        __m128i b5 = GCM_COUNTER(5);
+        __m128i b6 = GCM_COUNTER(6);
+        __m128i b7 = GCM_COUNTER(7);
+        counter += GCM_LANES;
+
+        if(decrypt) {
+            for(i = 0; i < GCM_LANES; i++) {
+                d[i] = ByteSwap(_mm_loadu_si128((const __m128i *)(in + 16 * i)));
+            }
+            pending = true;
+        }
+        d[0] = _mm_xor_si128(d[0], x);
+
+        /* One multiply after each of the first eight rounds */
+#pragma GCC unroll 8
+        for(i = 0; i < GCM_LANES; i++) {
+            GCM_ROUND(k[i + 1]);
+            CLMUL_ACCUMULATE(d[i], h[GCM_LANES - 1 - i]);
+        }
+#pragma GCC unroll 6
+        for(round = GCM_LANES + 1; round < Nr; round++) {
+            GCM_ROUND(k[round]);
+        }
+        if(pending) {
+            x = Reduce(lo, mid, hi);
+        }
+
+        GCM_STORE(0, b0);
+        GCM_STORE(1, b1);
+        GCM_STORE(2, b2);
+        GCM_STORE(3, b3);
+        GCM_STORE(4, b4);
+        GCM_STORE(5, b5);
+        GCM_STORE(6, b6);
+        GCM_STORE(7, b7);
+
+        if(!decrypt) {
+            for(i = 0; i < GCM_LANES; i++) {
+                d[i] = ByteSwap(_mm_loadu_si128((const __m128i *)(out + 16 * i)));
+            }
+            pending = true;
+        }
+
+        in += 16 * GCM_LANES;
+        out += 16 * GCM_LANES;
+    }
+
+    /* The last encrypted batch has not been hashed yet */
+    if(!decrypt && pending) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        d[0] = _mm_xor_si128(d[0], x);
+        for(i = 0; i < GCM_LANES; i++) {
+            CLMUL_ACCUMULATE(d[i], h[GCM_LANES - 1 - i]);
+        }
+        x = Reduce(lo, mid, hi);
+    }
+
+    /* Remaining blocks one at a time */
+    for(; n < blocks; n++) {
+        __m128i s = _mm_xor_si128(_mm_or_si128(prefix, _mm_set_epi32((int)__builtin_bswap32(counter), 0, 0, 0)), k[0]);
+        __m128i c = _mm_loadu_si128((const __m128i *)in);
+        counter++;
+
+        for(round = 1; round < Nr; round++) {
+            s = _mm_aesenc_si128(s, k[round]);
+        }
+        s = _mm_xor_si128(_mm_aesenclast_si128(s, k[Nr]), c);
+        _mm_storeu_si128((__m128i *)out, s);
+
+        x = MultiplyClmul(_mm_xor_si128(x, ByteSwap(decrypt ? c : s)), h[0]);
+
+        in += 16;
+        out += 16;
+    }
+
+    _mm_store_si128((__m128i *)g->x, ByteSwap(x));
+    g->counter = counter;
+}
+
+#pragma GCC pop_options
+
+/* Hash whole blocks into x with whichever multiplier the key uses */
+static void Ghash(const GcmKey *key, uint8_t *x, const uint8_t *data, size_t blocks) {
+    size_t n;
+    int i;
+
+    if(key->clmul) {
+        GhashClmul(key, x, data, blocks);
+        return;
+    }
+
+    for(n = 0; n < blocks; n++) {
+        for(i = 0; i < 16; i++) {
+            x[i] ^= data[i];
+        }
+        MultiplyTable(key, x);
+        data += 16;
+    }
+}
+
+/* Keystream from the selected engine, then GHASH over the ciphertext */
+static void CryptGeneric(GcmState *g, const uint8_t *in, uint8_t *out, size_t blocks, bool decrypt) {
+    alignas(16) uint8_t keystream[16 * CTR_BATCH];
+    size_t batch;
+    size_t i;
+
+    while(blocks > 0) {
+        batch = blocks < CTR_BATCH ? blocks : CTR_BATCH;
+
+        for(i = 0; i < batch; i++) {
+            CounterBlock(g->j0, g->counter++, keystream + 16 * i);
+        }
+        EncryptBlocks(g->key->aes, keystream, keystream, batch);
+
+        if(decrypt) {
+            Ghash(g->key, g->x, in, batch);
+        }
+        for(i = 0; i < 16 * batch; i++) {
+            out[i] = in[i] ^ keystream[i];
+        }
+        if(!decrypt) {
+            Ghash(g->key, g->x, out, batch);
+        }
+
+        in += 16 * batch;
+        out += 16 * batch;
+        blocks -= batch;
+    }
+}
+
+static void CryptBlocks(GcmState *g, const uint8_t *in, uint8_t *out, size_t blocks, bool decrypt) {
+    if(!g->key->fused) {
+        CryptGeneric(g, in, out, blocks, decrypt);
+    }
+    else if(g->key->aes->rounds == 10) {
+        CryptFused<10>(g, in, out, blocks, decrypt);
+    }
+    else if(g->key->aes->rounds == 12) {
+        CryptFused<12>(g, in, out, blocks, decrypt);
+    }
+    else {
+        CryptFused<14>(g, in, out, blocks, decrypt);
+    }
+}
+
+void GcmInitialize(GcmKey *key, const AesContext *aes) {
+    alignas(16) uint8_t h[16];
+
+    memset(h, 0, 16);
+    EncryptBlocks(aes, h, h, 1);
+
+    key->aes = aes;
+    key->clmul = HasClmul();
+    key->fused = key->clmul && aes->engine == ENGINE_AESNI;
+
+    BuildTables(key, h);
+    if(key->clmul) {
+        BuildPowers(key, h);
+    }
+    else {
+        memset(key->hp, 0, sizeof(key->hp));
+    }
+}
+
+void GcmStart(GcmState *g, const GcmKey *key, const uint8_t *iv, size_t ivLen) {
+    uint8_t block[16];
+
+    memset(g, 0, sizeof(GcmState));
+    g->key = key;
+
+    if(ivLen == 12) {
+        memcpy(g->j0, iv, 12);
+        g->j0[15] = 1;
+    }
+    else {
+        /* J0 = GHASH(IV padded to a block || 64 zero bits || 64-bit IV length in bits) */
+        Ghash(key, g->j0, iv, ivLen / 16);
+        if(ivLen % 16) {
+            memset(block, 0, 16);
+            memcpy(block, iv + ivLen - ivLen % 16, ivLen % 16);
+            Ghash(key, g->j0, block, 1);
+        }
+        memset(block, 0, 8);
+        StoreBigEndian64(block + 8, (uint64_t)ivLen * 8);
+        Ghash(key, g->j0, block, 1);
+    }
+
+    /* Counter 1 of j0 encrypts the tag, the message starts at counter 2 */
+    g->counter = ((uint32_t)g->j0[12] << 24 | (uint32_t)g->j0[13] << 16 | (uint32_t)g->j0[14] << 8 | g->j0[15]) + 1;
+}
+
+void GcmAad(GcmState *g, const uint8_t *aad, size_t len) {
+    size_t take;
+
+    g->aadLen += len;
+
+    if(g->buffered) {
+        take = 16 - g->buffered < len ? 16 - g->buffered : len;
+        memcpy(g->buffer + g->buffered, aad, take);
+        g->buffered += take;
+        aad += take;
+        len -= take;
+        if(g->buffered < 16) {
+            return;
+        }
+        Ghash(g->key, g->x, g->buffer, 1);
+        g->buffered = 0;
+    }
+
+    Ghash(g->key, g->x, aad, len / 16);
+    memcpy(g->buffer, aad + len - len % 16, len % 16);
+    g->buffered = len % 16;
+}
+
+/* Pad and hash the last partial block of AAD or ciphertext */
+static void FlushBuffer(GcmState *g) {
+    if(g->buffered) {
+        memset(g->buffer + g->buffered, 0, 16 - g->buffered);
+        Ghash(g->key, g->x, g->buffer, 1);
+        g->buffered = 0;
+    }
+}
+
+static void Crypt(GcmState *g, const uint8_t *in, uint8_t *out, size_t len, bool decrypt) {
+    uint8_t c;
+    size_t blocks;
+    size_t i;
+
+    if(!g->text) {
+        FlushBuffer(g);
+        g->text = true;
+    }
+    g->textLen += len;
+
+    /* Use up the keystream of a block left partial by the previous call */
+    while(g->buffered && len > 0) {
+        c = *in ^ g->keystream[g->buffered];
+        g->buffer[g->buffered++] = decrypt ? *in : c;
+        *out++ = c;
+        in++;
+        len--;
+        if(g->buffered == 16) {
+            Ghash(g->key, g->x, g->buffer, 1);
+            g->buffered = 0;
+        }
+    }
+
+    blocks = len / 16;
+    if(blocks) {
+        CryptBlocks(g, in, out, blocks, decrypt);
+        in += 16 * blocks;
+        out += 16 * blocks;
+        len -= 16 * blocks;
+    }
+
+    if(len > 0) {
+        CounterBlock(g->j0, g->counter++, g->keystream);
+        EncryptBlocks(g->key->aes, g->keystream, g->keystream, 1);
+        for(i = 0; i < len; i++) {
+            c = in[i] ^ g->keystream[i];
+            g->buffer[i] = decrypt ? in[i] : c;
+            out[i] = c;
+        }
+        g->buffered = len;
+    }
+}
+
+void GcmEncrypt(GcmState *g, const uint8_t *in, uint8_t *out, size_t len) {
+    Crypt(g, in, out, len, false);
+}
+
+void GcmDecrypt(GcmState *g, const uint8_t *in, uint8_t *out, size_t len) {
+    Crypt(g, in, out, len, true);
+}
+
+void GcmFinish(GcmState *g, uint8_t *tag) {
+    uint8_t block[16];
+    int i;
+
+    FlushBuffer(g);
+
+    StoreBigEndian64(block, g->aadLen * 8);
+    StoreBigEndian64(block + 8, g->textLen * 8);
+    Ghash(g->key, g->x, block, 1);
+
+    EncryptBlocks(g->key->aes, g->j0, block, 1);
+    for(i = 0; i < 16; i++) {
+        tag[i] = g->x[i] ^ block[i];
+    }
+}
+
+bool GcmVerify(GcmState *g, const uint8_t *tag, size_t tagLen) {
+    uint8_t expected[16];
+    uint8_t diff = 0;
+    size_t i;
+
+    if(tagLen < 4 || tagLen > 16) {
+        return false;
+    }
+
+    GcmFinish(g, expected);
+    for(i = 0; i < tagLen; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+
+    return diff == 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Galois/Counter Mode for the AES Encryption project
+ *
+ * Authenticated encryption per NIST SP 800-38D. A GcmKey holds the hash key
+ * H and its powers for one AesContext and, like the context, is read-only
+ * once built. A GcmState carries one message through any number of
+ * GcmAad() calls followed by any number of GcmEncrypt() or GcmDecrypt()
+ * calls, and ends with GcmFinish() or GcmVerify().
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_GCM_H
+#define AES_GCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_engine.h"
+
+/* Blocks hashed per GHASH reduction, and the powers of H kept for it */
+#define GCM_LANES 8
+
+struct GcmKey {
+    const AesContext *aes;
+    /* H^1 to H^GCM_LANES in hp[0] to hp[GCM_LANES - 1], byte-reversed for PCLMULQDQ */
+    alignas(16) uint8_t hp[GCM_LANES][16];
+    /* 4-bit multiplication tables of H for the portable GHASH */
+    uint64_t hl[16];
+    uint64_t hh[16];
+    /* GHASH with PCLMULQDQ */
+    bool clmul;
+    /* Keystream and GHASH in one AES-NI/PCLMULQDQ loop */
+    bool fused;
+};
+
+struct GcmState {
+    const GcmKey *key;
+    /* Pre-counter block; message counters continue from it */
+    alignas(16) uint8_t j0[16];
+    /* Running GHASH value */
+    alignas(16) uint8_t x[16];
+    /* Partial AAD or ciphertext block not yet hashed, and the keystream for the partial ciphertext block */
+    uint8_t buffer[16];
+    uint8_t keystream[16];
+    size_t buffered;
+    /* Next 32-bit block counter */
+    uint32_t counter;
+    uint64_t aadLen;
+    uint64_t textLen;
+    /* Set once the first GcmEncrypt() or GcmDecrypt() call closes the AAD */
+    bool text;
+};
+
+/* Derive H from an expanded key; aes must outlive key */
+void GcmInitialize(GcmKey *key, const AesContext *aes);
+
+/* Begin a message; a 12-byte IV is used directly, any other length is hashed */
+void GcmStart(GcmState *g, const GcmKey *key, const uint8_t *iv, size_t ivLen);
+
+/* Authenticate additional data; only before the first GcmEncrypt() or GcmDecrypt() */
+void GcmAad(GcmState *g, const uint8_t *aad, size_t len);
+
+/* Encrypt or decrypt the next len bytes of the message; in and out may be the same buffer */
+void GcmEncrypt(GcmState *g, const uint8_t *in, uint8_t *out, size_t len);
+void GcmDecrypt(GcmState *g, const uint8_t *in, uint8_t *out, size_t len);
+
+/* Write the 16-byte tag of the message */
+void GcmFinish(GcmState *g, uint8_t *tag);
+
+/*
+ * Compare the message's tag with the first tagLen (4 to 16) bytes of tag in
+ * constant time. Plaintext from GcmDecrypt() must be discarded if this
+ * returns false.
+ */
+bool GcmVerify(GcmState *g, const uint8_t *tag, size_t tagLen);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * Hex encoding for the AES Encryption project
+ *
+ * The vector decoder maps each digit to its nibble with two unsigned range
+ * checks, one for '0'-'9' and one for 'a'-'f' after folding case, so a
+ * single movemask validates 16 or 32 digits at once. PMADDUBSW then joins
+ * each pair of nibbles into a byte. The encoder splits bytes into nibbles
+ * and looks the digits up with PSHUFB.
+ *
+ * AES Encryption
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+#include "aes_hex.h"
+
+static const char digits[] = "0123456789abcdef";
+
+/* Value of one hex digit, or -1 */
+static inline int HexValue(unsigned char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+bool DecodeHexScalar(const char *in, uint8_t *out, size_t bytes) {
+    size_t i;
+    int hi;
+    int lo;
+
+    for(i = 0; i < bytes; i++) {
+        hi = HexValue(in[2 * i]);
+        lo = HexValue(in[2 * i + 1]);
+        if((hi | lo) < 0) {
+            return false;
+        }
+        out[i] = (hi << 4) | lo;
+    }
+
+    return true;
+}
+
+void EncodeHexScalar(const uint8_t *in, char *out, size_t bytes) {
+    size_t i;
+
+    for(i = 0; i < bytes; i++) {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 0x0f];
+    }
+}
+
+#pragma GCC push_options
+#pragma GCC target("ssse3")
+
+/* Nibble values of 16 digits; false if any is not a hex digit */
+static inline bool Nibbles128(__m128i c, __m128i *v) {
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+    *v = _mm_or_si128(_mm_and_si128(isDigit, d), _mm_and_si128(isLetter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    return _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) == 0xffff;
+}
+
+/* 16 bytes from 32 digits per step */
+static bool DecodeHexSsse3(const char *in, uint8_t *out, size_t bytes) {
+    const __m128i pairs = _mm_set1_epi16(0x0110);
+    __m128i a;
+    __m128i b;
+    size_t i;
+
+    for(i = 0; i + 16 <= bytes; i += 16) {
+        if(!Nibbles128(_mm_loadu_si128((const __m128i *)(in + 2 * i)), &a) || !Nibbles128(_mm_loadu_si128((const __m128i *)(in + 2 * i + 16)), &b)) {
+            return false;
+        }
+        a = _mm_maddubs_epi16(a, pairs);
+        b = _mm_maddubs_epi16(b, pairs);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+    }
+
+    return DecodeHexScalar(in + 2 * i, out + i, bytes - i);
+}
+
+/* 32 digits from 16 bytes per step */
+static void EncodeHexSsse3(const uint8_t *in, char *out, size_t bytes) {
+    const __m128i lut = _mm_loadu_si128((const __m128i *)digits);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i x;
+    __m128i hi;
+    __m128i lo;
+    size_t i;
+
+    for(i = 0; i + 16 <= bytes; i += 16) {
+        x = _mm_loadu_si128((const __m128i *)(in + i));
+        hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), low));
+        lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, low));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    EncodeHexScalar(in + i, out + 2 * i, bytes - i);
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+static inline bool Nibbles256(__m256i c, __m256i *v) {
+    __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+    *v = _mm256_or_si256(_mm256_and_si256(isDigit, d), _mm256_and_si256(isLetter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+    return _mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter)) == -1;
+}
+
+/* 32 bytes from 64 digits per step; PACKUSWB works per lane, so the quadwords come out as 0, 2, 1, 3 */
+static bool DecodeHexAvx2(const char *in, uint8_t *out, size_t bytes) {
+    const __m256i pairs = _mm256_set1_epi16(0x0110);
+    __m256i a;
+    __m256i b;
+    size_t i;
+
+    for(i = 0; i + 32 <= bytes; i += 32) {
+        if(!Nibbles256(_mm256_loadu_si256((const __m256i *)(in + 2 * i)), &a) || !Nibbles256(_mm256_loadu_si256((const __m256i *)(in + 2 * i + 32)), &b)) {
+            return false;
+        }
+        a = _mm256_maddubs_epi16(a, pairs);
+        b = _mm256_maddubs_epi16(b, pairs);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+    }
+
+    return DecodeHexSsse3(in + 2 * i, out + i, bytes - i);
+}
+
+/* 64 digits from 32 bytes per step; the unpacks work per lane, so the halves are regrouped */
+static void EncodeHexAvx2(const uint8_t *in, char *out, size_t bytes) {
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)digits));
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i x;
+    __m256i hi;
+    __m256i lo;
+    __m256i first;
+    __m256i second;
+    size_t i;
+
+    for(i = 0; i + 32 <= bytes; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *)(in + i));
+        hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low));
+        lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low));
+        first = _mm256_unpacklo_epi8(hi, lo);
+        second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+
+    EncodeHexSsse3(in + i, out + 2 * i, bytes - i);
+}
+
+#pragma GCC pop_options
+
+bool DecodeHex(const char *in, uint8_t *out, size_t bytes) {
+    if(HasAvx2()) {
+        return DecodeHexAvx2(in, out, bytes);
+    }
+    if(HasSsse3()) {
+        return DecodeHexSsse3(in, out, bytes);
+    }
+
+    return DecodeHexScalar(in, out, bytes);
+}
+
+bool DecodeHexString(const char *s, uint8_t *out, size_t bytes) {
+    return strlen(s) == 2 * bytes && DecodeHex(s, out, bytes);
+}
+
+void EncodeHex(const uint8_t *in, char *out, size_t bytes) {
+    if(HasAvx2()) {
+        EncodeHexAvx2(in, out, bytes);
+    }
+    else if(HasSsse3()) {
+        EncodeHexSsse3(in, out, bytes);
+    }
+    else {
+        EncodeHexScalar(in, out, bytes);
+    }
+}
+
+void EncodeHexSpaced(const uint8_t *in, char *out, size_t bytes) {
+    size_t i;
+
+    for(i = 0; i < bytes; i++) {
+        out[3 * i] = digits[in[i] >> 4];
+        out[3 * i + 1] = digits[in[i] & 0x0f];
+        out[3 * i + 2] = ' ';
+    }
+    out[3 * bytes] = '\0';
+}
+
+/* Write all of buf; returns 0 or -1 */
+static int WriteFully(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Encrypt a batch of decoded lines in place and write them as hex */
+static int FlushLines(const AesContext *ctx, uint8_t *blocks, char *text, size_t lines, bool decrypt, int fd) {
+    size_t i;
+
+    if(decrypt) {
+        DecryptBlocks(ctx, blocks, blocks, lines);
+    }
+    else {
+        EncryptBlocks(ctx, blocks, blocks, lines);
+    }
+
+    for(i = 0; i < lines; i++) {
+        EncodeHex(blocks + 16 * i, text + 33 * i, 16);
+        text[33 * i + 32] = '\n';
+    }
+
+    return WriteFully(fd, text, 33 * lines);
+}
+
+int EncryptHexLines(const AesContext *ctx, const char *in, const char *out, bool decrypt) {
+    /* A partial line carried between reads is at most 33 characters, or it is already too long */
+    char *buffer = (char *)malloc(HEX_LINE_BUFFER + 64);
+    char *text = (char *)malloc(33 * HEX_LINE_BATCH);
+    uint8_t *blocks = (uint8_t *)malloc(16 * HEX_LINE_BATCH);
+    const char *p;
+    const char *nl;
+    size_t have = 0;
+    size_t pos = 0;
+    size_t rest;
+    size_t len;
+    size_t next;
+    size_t line = 0;
+    size_t batch = 0;
+    bool eof = false;
+    int status = 0;
+    ssize_t n;
+    int inFd;
+    int outFd;
+
+    if(buffer == NULL || text == NULL || blocks == NULL) {
+        fprintf(stderr, "Out of memory for hex buffers\n");
+        free(buffer);
+        free(text);
+        free(blocks);
+        return -1;
+    }
+
+    inFd = strcmp(in, "-") == 0 ? STDIN_FILENO : open(in, O_RDONLY);
+    if(inFd < 0) {
+        perror(in);
+        free(buffer);
+        free(text);
+        free(blocks);
+        return -1;
+    }
+
+    outFd = strcmp(out, "-") == 0 ? STDOUT_FILENO : open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outFd < 0) {
+        perror(out);
+        if(inFd != STDIN_FILENO) {
+            close(inFd);
+        }
+        free(buffer);
+        free(text);
+        free(blocks);
+        return -1;
+    }
+
+    while(status == 0 && !eof) {
+        /* Keep the partial line and read behind it */
+        memmove(buffer, buffer + pos, have - pos);
+        have -= pos;
+        pos = 0;
+        do {
+            n = read(inFd, buffer + have, HEX_LINE_BUFFER);
+        } while(n < 0 && errno == EINTR);
+        if(n < 0) {
+            perror(in);
+            status = -1;
+            break;
+        }
+        eof = n == 0;
+        have += n;
+
+        while(status == 0 && pos < have) {
+            p = buffer + pos;
+            rest = have - pos;
+
+            /* Common case: 32 digits and a newline */
+            if(rest >= 33 && p[32] == '\n') {
+                len = 32;
+                next = 33;
+            }
+            else {
+                nl = (const char *)memchr(p, '\n', rest);
+                if(nl == NULL && !eof && rest <= 33) {
+                    break;
+                }
+                len = nl ? nl - p : rest;
+                next = nl ? len + 1 : rest;
+                if(len > 0 && p[len - 1] == '\r') {
+                    len--;
+                }
+            }
+
+            line++;
+            if(len != 32 || !DecodeHex(p, blocks + 16 * batch, 16)) {
+                fprintf(stderr, "Line %zu is not 32 hex digits.\n", line);
+                status = -1;
+                break;
+            }
+            pos += next;
+
+            if(++batch == HEX_LINE_BATCH) {
+                if(FlushLines(ctx, blocks, text, batch, decrypt, outFd) < 0) {
+                    perror(out);
+                    status = -1;
+                }
+                batch = 0;
+            }
+        }
+    }
+
+    /* Lines before a bad one are still written */
+    if(batch > 0 && FlushLines(ctx, blocks, text, batch, decrypt, outFd) < 0) {
+        perror(out);
+        status = -1;
+    }
+
+    if(inFd != STDIN_FILENO) {
+        close(inFd);
+    }
+    if(outFd != STDOUT_FILENO && close(outFd) < 0) {
+        perror(out);
+        status = -1;
+    }
+    free(buffer);
+    free(text);
+    free(blocks);
+
+    return status;
+}
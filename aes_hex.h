@@ -0,0 +1,48 @@
+/*
+ * Hex encoding for the AES Encryption project
+ *
+ * A validating hex codec with SSSE3 and AVX2 paths, and a bulk mode that
+ * encrypts files of one 32-digit block per line.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_HEX_H
+#define AES_HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_engine.h"
+
+/* Lines decoded, encrypted and encoded together in the hex-line mode */
+#define HEX_LINE_BATCH 4096
+
+/* Bytes read from the input per call in the hex-line mode */
+#define HEX_LINE_BUFFER (1 << 20)
+
+/* Decode 2 * bytes hex digits of either case into bytes; false if any is not a hex digit */
+bool DecodeHex(const char *in, uint8_t *out, size_t bytes);
+
+/* Decode a string of exactly 2 * bytes hex digits */
+bool DecodeHexString(const char *s, uint8_t *out, size_t bytes);
+
+/* Write 2 * bytes lowercase hex digits, without a terminator */
+void EncodeHex(const uint8_t *in, char *out, size_t bytes);
+
+/* Write "xx " for each byte and a terminator; out holds 3 * bytes + 1 characters */
+void EncodeHexSpaced(const uint8_t *in, char *out, size_t bytes);
+
+/* The portable codec, used for the tails and by the verification */
+bool DecodeHexScalar(const char *in, uint8_t *out, size_t bytes);
+void EncodeHexScalar(const uint8_t *in, char *out, size_t bytes);
+
+/*
+ * Encrypt (or decrypt) every line of in, each exactly 32 hex digits with an
+ * optional trailing carriage return, into one line of lowercase hex in out.
+ * Paths may be "-" for standard input and output. Returns 0, or -1 after
+ * printing the first bad line number.
+ */
+int EncryptHexLines(const AesContext *ctx, const char *in, const char *out, bool decrypt);
+
+#endif
@@ -0,0 +1,425 @@
+/*
+ * Load generator for the AES Encryption project
+ *
+ * Drives aesd over its Unix domain socket. Each connection runs on its own
+ * thread, loads a key of its own, and then keeps sending windows of depth
+ * pipelined requests, reading all of a window's replies before sending
+ * the next. Reports requests per second, payload throughput, and the
+ * median and 99th percentile time from sending a window to its last reply.
+ * With -verify every reply is checked against the same mode run locally.
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "aes_engine.h"
+#include "aes_modes.h"
+#include "aes_wire.h"
+
+/* Most connections, each with a thread of its own */
+#define LOAD_MAX_CONNECTIONS 1024
+
+/* Most requests in flight on one connection */
+#define LOAD_MAX_DEPTH 4096
+
+struct LoadOptions {
+    const char *path;
+    unsigned int connections;
+    unsigned int depth;
+    size_t size;
+    uint8_t mode;
+    double seconds;
+    bool verify;
+};
+
+/* What one connection did */
+struct LoadResult {
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t mismatches;
+    /* Nanoseconds from sending each window to its last reply */
+    std::vector<double> windows;
+    bool ok;
+};
+
+static bool SendAll(int fd, const uint8_t *p, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool ReceiveAll(int fd, uint8_t *p, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = recv(fd, p, len, 0);
+        if(n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/*
+ * Send a window and read its count replies at the same time: aesd stops
+ * reading a connection whose unsent replies pass its output limit, so a
+ * window sent whole before any reply is read could leave both sides
+ * waiting. Each complete reply goes to check(header, payload) in order;
+ * false when the connection fails or a reply is longer than maxPayload.
+ */
+template<typename Check>
+static bool Exchange(int fd, const std::vector<uint8_t> &window, unsigned int count, size_t maxPayload, std::vector<uint8_t> &buffer, Check check) {
+    WireReply header;
+    pollfd p;
+    size_t sent = 0;
+    size_t filled = 0;
+    size_t parsed;
+    unsigned int done = 0;
+    ssize_t n;
+
+    p.fd = fd;
+    while(done < count) {
+        p.events = POLLIN | (sent < window.size() ? POLLOUT : 0);
+        if(poll(&p, 1, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if(p.revents & (POLLERR | POLLNVAL)) {
+            return false;
+        }
+
+        if(p.revents & POLLOUT) {
+            n = send(fd, window.data() + sent, window.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            sent += n > 0 ? n : 0;
+        }
+
+        if(p.revents & (POLLIN | POLLHUP)) {
+            if(buffer.size() - filled < 64 * 1024) {
+                buffer.resize(filled + 64 * 1024);
+            }
+            n = recv(fd, buffer.data() + filled, buffer.size() - filled, MSG_DONTWAIT);
+            if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                return false;
+            }
+            filled += n > 0 ? n : 0;
+
+            /* Hand over every complete reply, then keep the partial one at the front */
+            parsed = 0;
+            while(done < count && filled - parsed >= sizeof(header)) {
+                memcpy(&header, buffer.data() + parsed, sizeof(header));
+                if(header.length > maxPayload) {
+                    return false;
+                }
+                if(filled - parsed < sizeof(header) + header.length) {
+                    break;
+                }
+                check(header, buffer.data() + parsed + sizeof(header));
+                parsed += sizeof(header) + header.length;
+                done++;
+            }
+            memmove(buffer.data(), buffer.data() + parsed, filled - parsed);
+            filled -= parsed;
+        }
+    }
+
+    return true;
+}
+
+/* Append one request frame to a window */
+static void AddRequest(std::vector<uint8_t> &window, uint8_t mode, uint32_t keyId, uint64_t tag, const uint8_t *iv, const uint8_t *payload, uint32_t length) {
+    WireRequest r;
+    size_t at = window.size();
+
+    memset(&r, 0, sizeof(r));
+    r.length = length;
+    r.keyId = keyId;
+    r.tag = tag;
+    r.mode = mode;
+    if(iv != NULL) {
+        memcpy(r.iv, iv, 16);
+    }
+
+    window.resize(at + sizeof(r) + length);
+    memcpy(window.data() + at, &r, sizeof(r));
+    memcpy(window.data() + at + sizeof(r), payload, length);
+}
+
+/* The reply payload aesd should send for a payload under ctx */
+static size_t Expected(const AesContext *ctx, uint8_t mode, const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len) {
+    uint8_t chain[16];
+
+    memcpy(chain, iv, 16);
+    switch(mode) {
+    case WIRE_ECB_ENCRYPT:
+        EncryptBlocks(ctx, in, out, len / 16);
+        return len;
+    case WIRE_CTR:
+        CtrCrypt(ctx, iv, 0, in, out, len);
+        return len;
+    case WIRE_CBC_ENCRYPT:
+        return CbcEncryptPadded(ctx, chain, in, out, len);
+    }
+
+    return 0;
+}
+
+static void RunConnection(const LoadOptions *options, unsigned int id, std::atomic<bool> *stop, LoadResult *result) {
+    const size_t replyBytes = options->size / 16 * 16 + 16;
+    std::vector<uint8_t> window;
+    std::vector<uint8_t> payload(options->size);
+    std::vector<uint8_t> received;
+    std::vector<uint8_t> expected(replyBytes);
+    sockaddr_un address;
+    WireReply header;
+    AesContext ctx;
+    uint8_t key[16];
+    uint8_t iv[16];
+    unsigned int seed = id + 1;
+    uint64_t tag = 0;
+    unsigned int i;
+    size_t j;
+    int fd;
+
+    result->requests = 0;
+    result->bytes = 0;
+    result->mismatches = 0;
+    result->ok = false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, options->path, sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+        perror(options->path);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    for(j = 0; j < 16; j++) {
+        key[j] = rand_r(&seed) & 0xFF;
+        iv[j] = rand_r(&seed) & 0xFF;
+    }
+    for(j = 0; j < options->size; j++) {
+        payload[j] = rand_r(&seed) & 0xFF;
+    }
+    InitializeContext(&ctx, key, 16, ENGINE_AUTO);
+    Expected(&ctx, options->mode, iv, payload.data(), expected.data(), options->size);
+
+    /* Each connection has a key of its own under its id */
+    AddRequest(window, WIRE_LOAD_KEY, id, 0, NULL, key, 16);
+    if(!SendAll(fd, window.data(), window.size()) || !ReceiveAll(fd, (uint8_t *)&header, sizeof(header)) || header.status != WIRE_OK) {
+        fprintf(stderr, "Connection %u could not load its key\n", id);
+        close(fd);
+        return;
+    }
+
+    /* Every window is the same requests with fresh tags */
+    window.clear();
+    for(i = 0; i < options->depth; i++) {
+        AddRequest(window, options->mode, id, 0, iv, payload.data(), (uint32_t)options->size);
+    }
+
+    while(!stop->load(std::memory_order_relaxed)) {
+        for(i = 0; i < options->depth; i++) {
+            ((WireRequest *)(window.data() + i * (sizeof(WireRequest) + options->size)))->tag = tag + i;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        i = 0;
+        bool ok = Exchange(fd, window, options->depth, replyBytes, received, [&](const WireReply &reply, const uint8_t *payload) {
+            if(reply.status != WIRE_OK || reply.tag != tag + i) {
+                result->mismatches++;
+            }
+            else if(options->verify && memcmp(payload, expected.data(), reply.length) != 0) {
+                result->mismatches++;
+            }
+            i++;
+        });
+        if(!ok) {
+            fprintf(stderr, "Connection %u lost the daemon\n", id);
+            close(fd);
+            return;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        result->windows.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        result->requests += options->depth;
+        result->bytes += options->depth * options->size;
+        tag += options->depth;
+    }
+
+    close(fd);
+    result->ok = true;
+}
+
+/* Parse a decimal number from min to max into *out; false for anything else, including a sign or trailing characters */
+static bool ParseCount(const char *s, unsigned long long min, unsigned long long max, unsigned long long *out) {
+    char *end;
+
+    if(!isdigit((unsigned char)s[0])) {
+        return false;
+    }
+
+    errno = 0;
+    *out = strtoull(s, &end, 10);
+
+    return errno == 0 && *end == '\0' && *out >= min && *out <= max;
+}
+
+static void PrintUsage() {
+    printf("\nUsage: ./loadgen -socket <path> [-connections <n>] [-depth <n>] [-size <bytes>] [-mode ctr|ecb|cbc] [-seconds <s>] [-verify]\n");
+    printf("Defaults: 4 connections, 64 requests in flight on each, 64-byte CTR payloads, 5 seconds.\n");
+    printf("At most %u connections, %u in flight on each, and %u-byte payloads.\n\n", LOAD_MAX_CONNECTIONS, LOAD_MAX_DEPTH, WIRE_MAX_PAYLOAD);
+}
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    std::vector<std::thread> threads;
+    std::vector<LoadResult> results;
+    std::vector<double> windows;
+    std::atomic<bool> stop(false);
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t mismatches = 0;
+    unsigned long long value = 0;
+    unsigned int i;
+
+    options.path = NULL;
+    options.connections = 4;
+    options.depth = 64;
+    options.size = 64;
+    options.mode = WIRE_CTR;
+    options.seconds = 5;
+    options.verify = false;
+
+    for(i = 1; i < (unsigned int)argc; i++) {
+        if(strcmp(argv[i], "-verify") == 0) {
+            options.verify = true;
+            continue;
+        }
+
+        if(i + 1 >= (unsigned int)argc) {
+            PrintUsage();
+            return 1;
+        }
+
+        bool ok = true;
+        if(strcmp(argv[i], "-socket") == 0) {
+            options.path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-connections") == 0) {
+            ok = ParseCount(argv[++i], 1, LOAD_MAX_CONNECTIONS, &value);
+            options.connections = value;
+        }
+        else if(strcmp(argv[i], "-depth") == 0) {
+            ok = ParseCount(argv[++i], 1, LOAD_MAX_DEPTH, &value);
+            options.depth = value;
+        }
+        else if(strcmp(argv[i], "-size") == 0) {
+            ok = ParseCount(argv[++i], 0, WIRE_MAX_PAYLOAD, &value);
+            options.size = value;
+        }
+        else if(strcmp(argv[i], "-mode") == 0) {
+            i++;
+            if(strcmp(argv[i], "ctr") == 0) {
+                options.mode = WIRE_CTR;
+            }
+            else if(strcmp(argv[i], "ecb") == 0) {
+                options.mode = WIRE_ECB_ENCRYPT;
+            }
+            else if(strcmp(argv[i], "cbc") == 0) {
+                options.mode = WIRE_CBC_ENCRYPT;
+            }
+            else {
+                ok = false;
+            }
+        }
+        else if(strcmp(argv[i], "-seconds") == 0) {
+            options.seconds = atof(argv[++i]);
+            ok = options.seconds > 0;
+        }
+        else {
+            ok = false;
+        }
+
+        if(!ok) {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if(options.path == NULL || (options.mode == WIRE_ECB_ENCRYPT && options.size % 16 != 0)) {
+        PrintUsage();
+        return 1;
+    }
+
+    results.resize(options.connections);
+    auto start = std::chrono::steady_clock::now();
+    for(i = 0; i < options.connections; i++) {
+        threads.emplace_back(RunConnection, &options, i, &stop, &results[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop.store(true);
+    for(std::thread &t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for(const LoadResult &r : results) {
+        if(!r.ok) {
+            return 1;
+        }
+        requests += r.requests;
+        bytes += r.bytes;
+        mismatches += r.mismatches;
+        windows.insert(windows.end(), r.windows.begin(), r.windows.end());
+    }
+    std::sort(windows.begin(), windows.end());
+
+    printf("%u connections, %u in flight each, %zu-byte payloads\n", options.connections, options.depth, options.size);
+    printf("%.0f requests/s, %.1f MB/s\n", requests / elapsed, bytes / elapsed / 1e6);
+    if(!windows.empty()) {
+        printf("Window round trip: %.1f us median, %.1f us p99\n", windows[windows.size() / 2] / 1000, windows[(size_t)(0.99 * (windows.size() - 1))] / 1000);
+    }
+    if(mismatches > 0) {
+        printf("%llu replies were wrong\n", (unsigned long long)mismatches);
+        return 1;
+    }
+
+    return 0;
+}
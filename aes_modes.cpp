@@ -0,0 +1,325 @@
+/*
+ * Block cipher modes for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "aes_modes.h"
+
+/* Load and store 64-bit big-endian integers */
+static inline uint64_t LoadBigEndian64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+}
+
+static inline void StoreBigEndian64(uint8_t *p, uint64_t v) {
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, 8);
+}
+
+/* 128-bit big-endian counter block held as two native halves */
+struct Counter {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/* Counter for iv + blocks */
+static inline Counter SeekCounter(const uint8_t *iv, uint64_t blocks) {
+    Counter c;
+
+    c.hi = LoadBigEndian64(iv);
+    c.lo = LoadBigEndian64(iv + 8) + blocks;
+    if(c.lo < blocks) {
+        c.hi++;
+    }
+
+    return c;
+}
+
+/* Write the next n counter blocks to out and advance c past them */
+static inline void FillCounters(Counter &c, uint8_t *out, size_t n) {
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        StoreBigEndian64(out + 16 * i, c.hi);
+        StoreBigEndian64(out + 16 * i + 8, c.lo);
+        if(++c.lo == 0) {
+            c.hi++;
+        }
+    }
+}
+
+/* out = a ^ b for one block, in one 16-byte store so the engine's 16-byte load of it is forwarded */
+static inline void XorBlock(uint8_t *out, const uint8_t *a, const uint8_t *b) {
+    _mm_storeu_si128((__m128i *)out, _mm_xor_si128(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b)));
+}
+
+/* out = in ^ keystream for len bytes, a word at a time */
+static inline void XorBytes(uint8_t *out, const uint8_t *in, const uint8_t *keystream, size_t len) {
+    uint64_t a;
+    uint64_t b;
+    size_t i = 0;
+
+    for(; i + 8 <= len; i += 8) {
+        memcpy(&a, in + i, 8);
+        memcpy(&b, keystream + i, 8);
+        a ^= b;
+        memcpy(out + i, &a, 8);
+    }
+    for(; i < len; i++) {
+        out[i] = in[i] ^ keystream[i];
+    }
+}
+
+void EcbEncryptParallel(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks, ThreadPool &pool) {
+    size_t perChunk = CHUNK_SIZE / 16;
+    size_t chunks = (blocks + perChunk - 1) / perChunk;
+
+    pool.ParallelFor(chunks, [&](size_t chunk) {
+        size_t start = chunk * perChunk;
+        size_t n = blocks - start < perChunk ? blocks - start : perChunk;
+        EncryptBlocks(ctx, in + 16 * start, out + 16 * start, n);
+    });
+}
+
+void EcbDecryptParallel(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks, ThreadPool &pool) {
+    size_t perChunk = CHUNK_SIZE / 16;
+    size_t chunks = (blocks + perChunk - 1) / perChunk;
+
+    pool.ParallelFor(chunks, [&](size_t chunk) {
+        size_t start = chunk * perChunk;
+        size_t n = blocks - start < perChunk ? blocks - start : perChunk;
+        DecryptBlocks(ctx, in + 16 * start, out + 16 * start, n);
+    });
+}
+
+void CbcEncrypt(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks) {
+    alignas(16) uint8_t block[16];
+    size_t n;
+
+    /* Each block depends on the previous ciphertext, so this runs one block at a time */
+    for(n = 0; n < blocks; n++) {
+        XorBytes(block, in, iv, 16);
+        EncryptBlocks(ctx, block, out, 1);
+        memcpy(iv, out, 16);
+
+        in += 16;
+        out += 16;
+    }
+}
+
+void CbcDecrypt(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks) {
+    alignas(16) uint8_t plain[16 * CTR_BATCH];
+    alignas(16) uint8_t chain[16];
+    size_t batch;
+    size_t i;
+
+    /* Decryption only needs ciphertext that is already known, so whole batches go to the engine at once */
+    while(blocks > 0) {
+        batch = blocks < CTR_BATCH ? blocks : CTR_BATCH;
+
+        DecryptBlocks(ctx, in, plain, batch);
+        memcpy(chain, in + 16 * (batch - 1), 16);
+
+        /*
+         * Block i is chained to ciphertext i - 1. Going backwards, writing
+         * out block i only overwrites ciphertext that has been used, so
+         * out may alias in.
+         */
+        for(i = batch - 1; i > 0; i--) {
+            XorBytes(out + 16 * i, plain + 16 * i, in + 16 * (i - 1), 16);
+        }
+        XorBytes(out, plain, iv, 16);
+        memcpy(iv, chain, 16);
+
+        in += 16 * batch;
+        out += 16 * batch;
+        blocks -= batch;
+    }
+}
+
+size_t CbcEncryptPadded(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len) {
+    alignas(16) uint8_t block[16];
+    size_t whole = len / 16;
+
+    /* Only the tail is copied, into the padding block */
+    CbcEncrypt(ctx, iv, in, out, whole);
+    Pkcs7PadBlock(in + 16 * whole, len % 16, block);
+    CbcEncrypt(ctx, iv, block, out + 16 * whole, 1);
+
+    return 16 * whole + 16;
+}
+
+bool CbcDecryptPadded(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, size_t *plainLen) {
+    int pad;
+
+    if(len == 0 || len % 16 != 0) {
+        return false;
+    }
+
+    CbcDecrypt(ctx, iv, in, out, len / 16);
+    pad = Pkcs7PadLength(out + len - 16);
+    if(pad < 0) {
+        return false;
+    }
+
+    *plainLen = len - pad;
+    return true;
+}
+
+/* A stream being encrypted by CbcEncryptStreams(); its chaining value lives in the gather buffer */
+struct CbcSlot {
+    CbcStream *stream;
+    const uint8_t *in;
+    uint8_t *out;
+    /* Blocks still to encrypt, counting the padding block */
+    size_t left;
+};
+
+/* The next plaintext block of a slot; the padding block is built in padded */
+static inline const uint8_t *SlotInput(const CbcSlot &t, bool pad, uint8_t *padded) {
+    if(pad && t.left == 1) {
+        Pkcs7PadBlock(t.in, t.stream->len % 16, padded);
+        return padded;
+    }
+
+    return t.in;
+}
+
+void CbcEncryptStreams(const AesContext *ctx, CbcStream *streams, size_t count, bool pad) {
+    alignas(16) uint8_t blocks[16 * CTR_BATCH];
+    alignas(16) uint8_t padded[16];
+    CbcSlot slot[CTR_BATCH];
+    size_t slots = 0;
+    size_t next = 0;
+    size_t done = 0;
+    size_t i;
+    size_t j;
+
+    while(true) {
+        /* Finished streams get their last ciphertext block as the IV and leave; the rest keep their order */
+        if(done > 0) {
+            for(i = 0, j = 0; i < slots; i++) {
+                if(slot[i].left == 0) {
+                    memcpy(slot[i].stream->iv, blocks + 16 * i, 16);
+                    continue;
+                }
+                if(i != j) {
+                    slot[j] = slot[i];
+                    memcpy(blocks + 16 * j, blocks + 16 * i, 16);
+                }
+                j++;
+            }
+            slots = j;
+            done = 0;
+        }
+
+        /* Free slots go to the next streams that have any blocks, chaining the first block to the IV */
+        while(slots < CTR_BATCH && next < count) {
+            CbcSlot &t = slot[slots];
+
+            t.stream = &streams[next++];
+            t.in = t.stream->in;
+            t.out = t.stream->out;
+            t.left = t.stream->len / 16 + (pad ? 1 : 0);
+            if(t.left > 0) {
+                XorBlock(blocks + 16 * slots, t.stream->iv, SlotInput(t, pad, padded));
+                slots++;
+            }
+        }
+        if(slots == 0) {
+            break;
+        }
+
+        EncryptBlocks(ctx, blocks, blocks, slots);
+
+        /* Write each ciphertext block and chain it to the stream's next plaintext block where it stays */
+        for(i = 0; i < slots; i++) {
+            CbcSlot &t = slot[i];
+
+            memcpy(t.out, blocks + 16 * i, 16);
+            t.in += 16;
+            t.out += 16;
+            if(--t.left == 0) {
+                done++;
+            }
+            else {
+                XorBlock(blocks + 16 * i, blocks + 16 * i, SlotInput(t, pad, padded));
+            }
+        }
+    }
+}
+
+void Pkcs7PadBlock(const uint8_t *tail, size_t len, uint8_t *block) {
+    memcpy(block, tail, len);
+    memset(block + len, (int)(16 - len), 16 - len);
+}
+
+int Pkcs7PadLength(const uint8_t *block) {
+    uint8_t pad = block[15];
+    uint8_t bad = 0;
+    int i;
+
+    if(pad == 0 || pad > 16) {
+        return -1;
+    }
+
+    /* Check every byte of the block so the time does not depend on where a mismatch is */
+    for(i = 0; i < 16; i++) {
+        bad |= (i >= 16 - pad) ? block[i] ^ pad : 0;
+    }
+
+    return bad ? -1 : pad;
+}
+
+void CtrCounters(const uint8_t *iv, uint8_t *out, size_t n) {
+    Counter counter = SeekCounter(iv, 0);
+
+    FillCounters(counter, out, n);
+}
+
+void CtrCrypt(const AesContext *ctx, const uint8_t *iv, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len) {
+    alignas(16) uint8_t counters[16 * CTR_BATCH];
+    alignas(16) uint8_t keystream[16 * CTR_BATCH];
+    Counter counter = SeekCounter(iv, offset / 16);
+    size_t skip = offset % 16;
+    size_t blocks;
+    size_t bytes;
+
+    while(len > 0) {
+        /* Enough blocks to cover the skipped prefix and the rest of the input */
+        blocks = (skip + len + 15) / 16;
+        if(blocks > CTR_BATCH) {
+            blocks = CTR_BATCH;
+        }
+
+        FillCounters(counter, counters, blocks);
+        EncryptBlocks(ctx, counters, keystream, blocks);
+
+        bytes = 16 * blocks - skip;
+        if(bytes > len) {
+            bytes = len;
+        }
+        XorBytes(out, in, keystream + skip, bytes);
+
+        in += bytes;
+        out += bytes;
+        len -= bytes;
+        skip = 0;
+    }
+}
+
+void CtrCryptParallel(const AesContext *ctx, const uint8_t *iv, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len, ThreadPool &pool) {
+    size_t chunks = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    /* Each chunk seeks straight to its own counter range */
+    pool.ParallelFor(chunks, [&](size_t chunk) {
+        size_t start = chunk * CHUNK_SIZE;
+        size_t bytes = len - start < CHUNK_SIZE ? len - start : CHUNK_SIZE;
+        CtrCrypt(ctx, iv, offset + start, in + start, out + start, bytes);
+    });
+}
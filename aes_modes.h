@@ -0,0 +1,82 @@
+/*
+ * Block cipher modes for the AES Encryption project
+ *
+ * The modes take an AesContext from InitializeContext() and work on
+ * caller-provided buffers of any length.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_MODES_H
+#define AES_MODES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_engine.h"
+#include "aes_pool.h"
+
+/* Blocks of keystream generated per engine call */
+#define CTR_BATCH 64
+
+/* Bytes of input handed to one worker at a time by the parallel modes */
+#define CHUNK_SIZE (64 * 1024)
+
+/* ECB mode split into CHUNK_SIZE pieces across the threads of pool */
+void EcbEncryptParallel(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks, ThreadPool &pool);
+
+/* ECB mode decryption, split like EcbEncryptParallel() */
+void EcbDecryptParallel(const AesContext *ctx, const uint8_t *in, uint8_t *out, size_t blocks, ThreadPool &pool);
+
+/* CBC mode encryption of whole blocks; iv is replaced by the last ciphertext block so a stream can continue */
+void CbcEncrypt(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* CBC mode decryption of whole blocks; iv is replaced by the last ciphertext block, as in CbcEncrypt() */
+void CbcDecrypt(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* CBC mode encryption of len bytes with PKCS#7 padding; out holds len / 16 * 16 + 16 bytes and may be in. Returns the ciphertext length */
+size_t CbcEncryptPadded(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+
+/* CBC mode decryption of len bytes, a nonzero multiple of 16, then removal of the padding; false if the padding is invalid */
+bool CbcDecryptPadded(const AesContext *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, size_t *plainLen);
+
+/* One message of a CbcEncryptStreams() call */
+struct CbcStream {
+    const uint8_t *in;
+    /* len / 16 blocks, plus the padding block when padding; may be in */
+    uint8_t *out;
+    size_t len;
+    /* Replaced by the last ciphertext block, as in CbcEncrypt() */
+    uint8_t iv[16];
+};
+
+/*
+ * CBC mode encryption of count independent messages under one key. The
+ * next block of up to CTR_BATCH messages goes to the engine in a single
+ * call, so the serial chain of each message no longer leaves the engine's
+ * lanes idle; a message that ends hands its slot to the next one. With pad
+ * set every message gets PKCS#7 padding, built in the gather buffer
+ * without copying the message; otherwise only whole blocks are encrypted.
+ */
+void CbcEncryptStreams(const AesContext *ctx, CbcStream *streams, size_t count, bool pad);
+
+/* Build the final PKCS#7 block from the last len (0 to 15) bytes of a message */
+void Pkcs7PadBlock(const uint8_t *tail, size_t len, uint8_t *block);
+
+/* Number of padding bytes (1 to 16) at the end of a decrypted final block, or -1 if the padding is invalid */
+int Pkcs7PadLength(const uint8_t *block);
+
+/*
+ * CTR mode: encrypt or decrypt len bytes. The keystream for byte offset
+ * starts at counter block iv + offset / 16 (a 128-bit big-endian add), so
+ * any range of a stream can be processed on its own.
+ */
+void CtrCrypt(const AesContext *ctx, const uint8_t *iv, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len);
+
+/* Write the n counter blocks iv, iv + 1, ... to out, for callers that gather keystream blocks themselves */
+void CtrCounters(const uint8_t *iv, uint8_t *out, size_t n);
+
+/* CTR mode split into CHUNK_SIZE counter ranges across the threads of pool */
+void CtrCryptParallel(const AesContext *ctx, const uint8_t *iv, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len, ThreadPool &pool);
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ * AES-NI round engine for the AES Encryption project
+ *
+ * AESENC performs SubBytes, ShiftRows, MixColumns and AddRoundKey in one
+ * instruction. Its latency is several cycles but a new one can start every
+ * cycle, so eight independent blocks are kept in flight at once. AESDEC
+ * is the matching equivalent inverse round and runs over the inverted key
+ * schedule from InvertKeySchedule().
+ *
+ * AES Encryption
+ */
+
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#include "aes_engine.h"
+
+/* Number of blocks encrypted together to hide AESENC latency */
+#define NI_LANES 8
+
+static bool ProbeAesNi() {
+    unsigned int a;
+    unsigned int b;
+    unsigned int c;
+    unsigned int d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES);
+}
+
+/* The probe runs once, on first use; the static's initialization is thread-safe, so pool workers may call this at any time */
+bool HasAesNi() {
+    static const bool has = ProbeAesNi();
+
+    return has;
+}
+
+/* Every CPU with AES-NI also has SSSE3, which the batched key expansion uses for PSHUFB */
+#pragma GCC push_options
+#pragma GCC target("aes,ssse3")
+
+/* Apply one middle round (_mm_aesenc_si128 or _mm_aesdec_si128) to all eight lanes */
+#define NI_ROUND(op, k) \
+    b0 = op(b0, k); \
+    b1 = op(b1, k); \
+    b2 = op(b2, k); \
+    b3 = op(b3, k); \
+    b4 = op(b4, k); \
+    b5 = op(b5, k); \
+    b6 = op(b6, k); \
+    b7 = op(b7, k);
+
+/* Load one block of in and apply the initial Add Round Key */
+#define NI_LOAD(i) _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * (i))), k[0])
+
+/* Apply the final round to one lane and store it */
+#define NI_STORE(op, i, b) _mm_storeu_si128((__m128i *)(out + 16 * (i)), op(b, k[Nr]))
+
+template<int Nr>
+void EncryptBlocksNi(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    __m128i k[Nr + 1];
+    size_t n = 0;
+    int round;
+
+    for(round = 0; round <= Nr; round++) {
+        k[round] = _mm_load_si128((const __m128i *)rk[round]);
+    }
+
+    /* The lanes are separate variables so they stay in registers */
+    for(; n + NI_LANES <= blocks; n += NI_LANES) {
+        __m128i b0 = NI_LOAD(0);
+        __m128i b1 = NI_LOAD(1);
+        __m128i b2 = NI_LOAD(2);
+        __m128i b3 = NI_LOAD(3);
+        __m128i b4 = NI_LOAD(4);
+        __m128i b5 = NI_LOAD(5);
+        __m128i b6 = NI_LOAD(6);
+        __m128i b7 = NI_LOAD(7);
+
+#pragma GCC unroll 14
+        for(round = 1; round < Nr; round++) {
+            NI_ROUND(_mm_aesenc_si128, k[round]);
+        }
+
+        NI_STORE(_mm_aesenclast_si128, 0, b0);
+        NI_STORE(_mm_aesenclast_si128, 1, b1);
+        NI_STORE(_mm_aesenclast_si128, 2, b2);
+        NI_STORE(_mm_aesenclast_si128, 3, b3);
+        NI_STORE(_mm_aesenclast_si128, 4, b4);
+        NI_STORE(_mm_aesenclast_si128, 5, b5);
+        NI_STORE(_mm_aesenclast_si128, 6, b6);
+        NI_STORE(_mm_aesenclast_si128, 7, b7);
+
+        in += 16 * NI_LANES;
+        out += 16 * NI_LANES;
+    }
+
+    /* Remaining blocks one at a time */
+    for(; n < blocks; n++) {
+        __m128i s = NI_LOAD(0);
+        for(round = 1; round < Nr; round++) {
+            s = _mm_aesenc_si128(s, k[round]);
+        }
+        NI_STORE(_mm_aesenclast_si128, 0, s);
+
+        in += 16;
+        out += 16;
+    }
+}
+
+template<int Nr>
+void DecryptBlocksNi(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    __m128i k[Nr + 1];
+    size_t n = 0;
+    int round;
+
+    for(round = 0; round <= Nr; round++) {
+        k[round] = _mm_load_si128((const __m128i *)drk[round]);
+    }
+
+    /* The lanes are separate variables so they stay in registers */
+    for(; n + NI_LANES <= blocks; n += NI_LANES) {
+        __m128i b0 = NI_LOAD(0);
+        __m128i b1 = NI_LOAD(1);
+        __m128i b2 = NI_LOAD(2);
+        __m128i b3 = NI_LOAD(3);
+        __m128i b4 = NI_LOAD(4);
+        __m128i b5 = NI_LOAD(5);
+        __m128i b6 = NI_LOAD(6);
+        __m128i b7 = NI_LOAD(7);
+
+#pragma GCC unroll 14
+        for(round = 1; round < Nr; round++) {
+            NI_ROUND(_mm_aesdec_si128, k[round]);
+        }
+
+        NI_STORE(_mm_aesdeclast_si128, 0, b0);
+        NI_STORE(_mm_aesdeclast_si128, 1, b1);
+        NI_STORE(_mm_aesdeclast_si128, 2, b2);
+        NI_STORE(_mm_aesdeclast_si128, 3, b3);
+        NI_STORE(_mm_aesdeclast_si128, 4, b4);
+        NI_STORE(_mm_aesdeclast_si128, 5, b5);
+        NI_STORE(_mm_aesdeclast_si128, 6, b6);
+        NI_STORE(_mm_aesdeclast_si128, 7, b7);
+
+        in += 16 * NI_LANES;
+        out += 16 * NI_LANES;
+    }
+
+    /* Remaining blocks one at a time */
+    for(; n < blocks; n++) {
+        __m128i s = NI_LOAD(0);
+        for(round = 1; round < Nr; round++) {
+            s = _mm_aesdec_si128(s, k[round]);
+        }
+        NI_STORE(_mm_aesdeclast_si128, 0, s);
+
+        in += 16;
+        out += 16;
+    }
+}
+
+template void EncryptBlocksNi<10>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksNi<12>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksNi<14>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksNi<10>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksNi<12>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksNi<14>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+
+/* One lane of the multi-key loop: this lane's round key, so the lanes share no register */
+#define NI_KEY_ROUND(op, i, b, round) b = op(b, _mm_load_si128((const __m128i *)ctxs[i]->rk[round]))
+
+/* Apply one round to all eight lanes, each under its own key */
+#define NI_KEY_ROUNDS(op, round) \
+    NI_KEY_ROUND(op, 0, b0, round); \
+    NI_KEY_ROUND(op, 1, b1, round); \
+    NI_KEY_ROUND(op, 2, b2, round); \
+    NI_KEY_ROUND(op, 3, b3, round); \
+    NI_KEY_ROUND(op, 4, b4, round); \
+    NI_KEY_ROUND(op, 5, b5, round); \
+    NI_KEY_ROUND(op, 6, b6, round); \
+    NI_KEY_ROUND(op, 7, b7, round);
+
+template<int Nr>
+void EncryptMultiKeyNi(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    size_t n = 0;
+    int round;
+
+    for(; n + NI_LANES <= count; n += NI_LANES) {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)in[0]);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)in[1]);
+        __m128i b2 = _mm_loadu_si128((const __m128i *)in[2]);
+        __m128i b3 = _mm_loadu_si128((const __m128i *)in[3]);
+        __m128i b4 = _mm_loadu_si128((const __m128i *)in[4]);
+        __m128i b5 = _mm_loadu_si128((const __m128i *)in[5]);
+        __m128i b6 = _mm_loadu_si128((const __m128i *)in[6]);
+        __m128i b7 = _mm_loadu_si128((const __m128i *)in[7]);
+
+        NI_KEY_ROUNDS(_mm_xor_si128, 0);
+#pragma GCC unroll 14
+        for(round = 1; round < Nr; round++) {
+            NI_KEY_ROUNDS(_mm_aesenc_si128, round);
+        }
+        NI_KEY_ROUNDS(_mm_aesenclast_si128, Nr);
+
+        _mm_storeu_si128((__m128i *)out[0], b0);
+        _mm_storeu_si128((__m128i *)out[1], b1);
+        _mm_storeu_si128((__m128i *)out[2], b2);
+        _mm_storeu_si128((__m128i *)out[3], b3);
+        _mm_storeu_si128((__m128i *)out[4], b4);
+        _mm_storeu_si128((__m128i *)out[5], b5);
+        _mm_storeu_si128((__m128i *)out[6], b6);
+        _mm_storeu_si128((__m128i *)out[7], b7);
+
+        ctxs += NI_LANES;
+        in += NI_LANES;
+        out += NI_LANES;
+    }
+
+    /* Ragged tail: the remaining lanes one at a time */
+    for(; n < count; n++) {
+        __m128i s = _mm_loadu_si128((const __m128i *)in[0]);
+        NI_KEY_ROUND(_mm_xor_si128, 0, s, 0);
+        for(round = 1; round < Nr; round++) {
+            NI_KEY_ROUND(_mm_aesenc_si128, 0, s, round);
+        }
+        NI_KEY_ROUND(_mm_aesenclast_si128, 0, s, Nr);
+        _mm_storeu_si128((__m128i *)out[0], s);
+
+        ctxs++;
+        in++;
+        out++;
+    }
+}
+
+/* Exchange the 32-bit words of four vectors as a 4x4 matrix */
+static inline void TransposeWords(__m128i *v) {
+    __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+    __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+    __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+    __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+
+    v[0] = _mm_unpacklo_epi64(t0, t1);
+    v[1] = _mm_unpackhi_epi64(t0, t1);
+    v[2] = _mm_unpacklo_epi64(t2, t3);
+    v[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+/* Key schedule vectors for one pass: group g holds lanes 4g to 4g + 3, rounded up to whole vectors for AES-192 */
+template<int Nk>
+using LaneWords = __m128i[NI_LANES / 4][KeySize<Nk>::Words + 4];
+
+/*
+ * Key schedules are expanded word by word with one key in each 32-bit lane
+ * of a vector, so ExpandKey()'s recurrence runs for 4 keys per vector and
+ * NI_LANES keys per pass. AESENCLAST with a zero round key is Shift Rows
+ * then Substitute Bytes; PSHUFB first applies RotWord where needed and
+ * undoes the Shift Rows, leaving SubWord in every lane. On return lane l's
+ * round key r is w[l / 4][4r + l % 4], in byte order.
+ */
+template<int Nk>
+static inline void ExpandLanes(const uint8_t *const *key, LaneWords<Nk> &w) {
+    const int words = KeySize<Nk>::Words;
+    const int groups = NI_LANES / 4;
+    const __m128i rotSub = _mm_setr_epi8(1, 14, 11, 4, 5, 2, 15, 8, 9, 6, 3, 12, 13, 10, 7, 0);
+    const __m128i sub = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+    const __m128i zero = _mm_setzero_si128();
+    int g;
+    int l;
+    int i;
+    int j;
+
+    /* The last load of an AES-192 key fills two words the recurrence then overwrites */
+    for(g = 0; g < groups; g++) {
+        for(j = 0; j < Nk; j += 4) {
+            for(l = 0; l < 4; l++) {
+                const uint8_t *p = key[4 * g + l] + 4 * j;
+                w[g][j + l] = Nk - j >= 4 ? _mm_loadu_si128((const __m128i *)p) : _mm_loadl_epi64((const __m128i *)p);
+            }
+            TransposeWords(&w[g][j]);
+        }
+    }
+
+    /* The groups are independent, so their AESENCLAST latencies overlap */
+    for(i = Nk; i < words; i++) {
+        for(g = 0; g < groups; g++) {
+            __m128i t = w[g][i - 1];
+
+            if(i % Nk == 0) {
+                t = _mm_aesenclast_si128(_mm_shuffle_epi8(t, rotSub), _mm_set1_epi32(RC[i / Nk - 1]));
+            }
+            else if(Nk > 6 && i % Nk == 4) {
+                t = _mm_aesenclast_si128(_mm_shuffle_epi8(t, sub), zero);
+            }
+            w[g][i] = _mm_xor_si128(w[g][i - Nk], t);
+        }
+    }
+
+    for(g = 0; g < groups; g++) {
+        for(i = 0; i < words; i += 4) {
+            TransposeWords(&w[g][i]);
+        }
+    }
+}
+
+/* Key pointers for the pass starting at key n; a ragged final pass expands a zero key in the unused lanes and discards it */
+static inline int PassKeys(const uint8_t *const *keys, size_t n, size_t count, const uint8_t *unused, const uint8_t **key) {
+    int lanes = count - n < NI_LANES ? count - n : NI_LANES;
+    int l;
+
+    for(l = 0; l < NI_LANES; l++) {
+        key[l] = l < lanes ? keys[n + l] : unused;
+    }
+
+    return lanes;
+}
+
+template<int Nk>
+void ExpandKeysNi(AesContext *ctxs, const uint8_t *const *keys, size_t count) {
+    const int Nr = KeySize<Nk>::Rounds;
+    /* Byte order of each 32-bit word reversed, for the big-endian schedule words */
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const uint8_t unused[4 * Nk] = {};
+    const uint8_t *key[NI_LANES];
+    LaneWords<Nk> w;
+    size_t n;
+    int lanes;
+    int l;
+    int i;
+
+    for(n = 0; n < count; n += lanes) {
+        lanes = PassKeys(keys, n, count, unused, key);
+        ExpandLanes<Nk>(key, w);
+
+        for(l = 0; l < lanes; l++) {
+            AesContext *ctx = &ctxs[n + l];
+
+            for(i = 0; i <= Nr; i++) {
+                __m128i k = w[l / 4][4 * i + l % 4];
+                __m128i d = i > 0 && i < Nr ? _mm_aesimc_si128(k) : k;
+
+                _mm_store_si128((__m128i *)ctx->rk[i], k);
+                _mm_store_si128((__m128i *)ctx->drk[Nr - i], d);
+                _mm_storeu_si128((__m128i *)&ctx->w[4 * i], _mm_shuffle_epi8(k, swap));
+                _mm_storeu_si128((__m128i *)&ctx->dw[4 * (Nr - i)], _mm_shuffle_epi8(d, swap));
+            }
+        }
+    }
+}
+
+template<int Nk>
+void ExpandKeyWordsNi(const uint8_t *const *keys, unsigned int *w, size_t count) {
+    const int Nr = KeySize<Nk>::Rounds;
+    const int words = KeySize<Nk>::Words;
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const uint8_t unused[4 * Nk] = {};
+    const uint8_t *key[NI_LANES];
+    LaneWords<Nk> lanesW;
+    size_t n;
+    int lanes;
+    int l;
+    int i;
+
+    for(n = 0; n < count; n += lanes) {
+        lanes = PassKeys(keys, n, count, unused, key);
+        ExpandLanes<Nk>(key, lanesW);
+
+        for(l = 0; l < lanes; l++) {
+            for(i = 0; i <= Nr; i++) {
+                _mm_storeu_si128((__m128i *)&w[words * (n + l) + 4 * i], _mm_shuffle_epi8(lanesW[l / 4][4 * i + l % 4], swap));
+            }
+        }
+    }
+}
+
+template void EncryptMultiKeyNi<10>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyNi<12>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyNi<14>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void ExpandKeysNi<4>(AesContext *ctxs, const uint8_t *const *keys, size_t count);
+template void ExpandKeysNi<6>(AesContext *ctxs, const uint8_t *const *keys, size_t count);
+template void ExpandKeysNi<8>(AesContext *ctxs, const uint8_t *const *keys, size_t count);
+template void ExpandKeyWordsNi<4>(const uint8_t *const *keys, unsigned int *w, size_t count);
+template void ExpandKeyWordsNi<6>(const uint8_t *const *keys, unsigned int *w, size_t count);
+template void ExpandKeyWordsNi<8>(const uint8_t *const *keys, unsigned int *w, size_t count);
+
+#pragma GCC pop_options
@@ -0,0 +1,114 @@
+/*
+ * Worker thread pool for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#include "aes_pool.h"
+
+ThreadPool::ThreadPool(unsigned int threads) : job(NULL), jobTasks(0), generation(0), busy(0), stopping(false), next(0) {
+    unsigned int i;
+
+    for(i = 1; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::Work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for(std::thread &t : workers) {
+        t.join();
+    }
+}
+
+/* Claim and run tasks of the current job until none are left */
+void ThreadPool::RunTasks() {
+    const std::function<void(size_t)> *task;
+    size_t tasks;
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        task = job;
+        tasks = jobTasks;
+    }
+
+    for(;;) {
+        i = next.fetch_add(1, std::memory_order_relaxed);
+        if(i >= tasks) {
+            break;
+        }
+        (*task)(i);
+    }
+}
+
+void ThreadPool::Work() {
+    unsigned long seen = 0;
+
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if(stopping) {
+                return;
+            }
+            seen = generation;
+            busy++;
+        }
+
+        RunTasks();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy--;
+            if(busy == 0) {
+                done.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(size_t tasks, const std::function<void(size_t)> &task) {
+    size_t i;
+
+    /* Nothing to share out */
+    if(workers.empty() || tasks <= 1) {
+        for(i = 0; i < tasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> serial(callers);
+
+    {
+        /* A worker that woke late for the previous job may still be draining it */
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+
+        job = &task;
+        jobTasks = tasks;
+        next.store(0, std::memory_order_relaxed);
+        generation++;
+    }
+    wake.notify_all();
+
+    RunTasks();
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0 && next.load(std::memory_order_relaxed) >= jobTasks; });
+        job = NULL;
+        jobTasks = 0;
+    }
+}
+
+ThreadPool &DefaultPool() {
+    static ThreadPool pool(std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1);
+    return pool;
+}
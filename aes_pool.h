@@ -0,0 +1,62 @@
+/*
+ * Worker thread pool for the AES Encryption project
+ *
+ * The bulk modes split their input into independent chunks and hand them
+ * to a fixed set of threads that live for the whole process.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_POOL_H
+#define AES_POOL_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    /* Start threads - 1 workers; the thread calling ParallelFor() is the last one */
+    explicit ThreadPool(unsigned int threads);
+    ~ThreadPool();
+
+    /* Number of threads that run tasks, including the caller */
+    unsigned int Size() const { return (unsigned int)workers.size() + 1; }
+
+    /*
+     * Run task(i) for every i in [0, tasks) and return when all are done.
+     * Tasks are claimed in order from a shared counter. Calls from several
+     * threads are serialized; a task must not call ParallelFor() itself.
+     */
+    void ParallelFor(size_t tasks, const std::function<void(size_t)> &task);
+
+private:
+    void Work();
+    void RunTasks();
+
+    std::vector<std::thread> workers;
+    std::mutex callers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    /* Current job, published under lock */
+    const std::function<void(size_t)> *job;
+    size_t jobTasks;
+    unsigned long generation;
+    unsigned int busy;
+    bool stopping;
+
+    /* Next task index of the current job */
+    std::atomic<size_t> next;
+};
+
+/* Process-wide pool with one thread per hardware thread */
+ThreadPool &DefaultPool();
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Per-stage cycle counters for the AES Encryption project
+ *
+ * The instruction counter is a per-thread perf event whose mmap page
+ * allows RDPMC, so reading it costs no system call. Kernels or machines
+ * that refuse the event, or do not grant RDPMC, get cycle counts only.
+ *
+ * AES Encryption
+ */
+
+#ifdef AES_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+
+#include <mutex>
+
+#include "aes_profile.h"
+
+/* Written only by its thread; aligned so no two threads share a line */
+struct alignas(64) ProfileThread {
+    uint64_t calls[PROFILE_STAGES];
+    uint64_t cycles[PROFILE_STAGES];
+    uint64_t instructions[PROFILE_STAGES];
+    /* Instruction counter page, or NULL */
+    perf_event_mmap_page *page;
+    int id;
+    ProfileThread *next;
+};
+
+static const char *const stageNames[PROFILE_STAGES] = { "SubstituteBytes", "ShiftRows", "MixColumns", "AddRoundKey", "ExpandKey" };
+
+static std::mutex registryLock;
+static ProfileThread *threads = NULL;
+static int threadCount = 0;
+
+static thread_local ProfileThread *current = NULL;
+
+/* Open the calling thread's instruction counter and map its page; NULL unless RDPMC is allowed */
+static perf_event_mmap_page *OpenInstructionCounter() {
+    perf_event_attr attr;
+    perf_event_mmap_page *page;
+    void *m;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if(fd < 0) {
+        return NULL;
+    }
+
+    m = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(m == MAP_FAILED) {
+        return NULL;
+    }
+
+    page = (perf_event_mmap_page *)m;
+    if(!page->cap_user_rdpmc || page->index == 0) {
+        munmap(m, sysconf(_SC_PAGESIZE));
+        return NULL;
+    }
+
+    return page;
+}
+
+static void PrintProfile() {
+    uint64_t calls[PROFILE_STAGES] = { 0 };
+    uint64_t cycles[PROFILE_STAGES] = { 0 };
+    uint64_t instructions[PROFILE_STAGES] = { 0 };
+    bool counted = false;
+    ProfileThread *t;
+    int s;
+
+    std::lock_guard<std::mutex> lock(registryLock);
+
+    fprintf(stderr, "\nStage profile (%d thread%s):\n", threadCount, threadCount == 1 ? "" : "s");
+    fprintf(stderr, "%-8s %-16s %14s %14s %14s %16s\n", "thread", "stage", "calls", "cycles/call", "instr/call", "total cycles");
+    for(t = threads; t != NULL; t = t->next) {
+        counted = counted || t->page != NULL;
+        for(s = 0; s < PROFILE_STAGES; s++) {
+            calls[s] += t->calls[s];
+            cycles[s] += t->cycles[s];
+            instructions[s] += t->instructions[s];
+            if(threadCount > 1 && t->calls[s] > 0) {
+                fprintf(stderr, "%-8d %-16s %14llu %14.1f %14.1f %16llu\n", t->id, stageNames[s], (unsigned long long)t->calls[s], (double)t->cycles[s] / t->calls[s], (double)t->instructions[s] / t->calls[s], (unsigned long long)t->cycles[s]);
+            }
+        }
+    }
+
+    for(s = 0; s < PROFILE_STAGES; s++) {
+        if(calls[s] == 0) {
+            continue;
+        }
+        fprintf(stderr, "%-8s %-16s %14llu %14.1f ", "all", stageNames[s], (unsigned long long)calls[s], (double)cycles[s] / calls[s]);
+        if(counted) {
+            fprintf(stderr, "%14.1f ", (double)instructions[s] / calls[s]);
+        }
+        else {
+            fprintf(stderr, "%14s ", "n/a");
+        }
+        fprintf(stderr, "%16llu\n", (unsigned long long)cycles[s]);
+    }
+    if(!counted) {
+        fprintf(stderr, "Instruction counts need perf_event_open and RDPMC (see perf_event_paranoid).\n");
+    }
+}
+
+ProfileThread *CurrentProfileThread() {
+    ProfileThread *t = current;
+
+    if(t != NULL) {
+        return t;
+    }
+
+    /* Never freed, so the table can include threads that have exited */
+    t = new ProfileThread();
+    t->page = OpenInstructionCounter();
+
+    std::lock_guard<std::mutex> lock(registryLock);
+    if(threads == NULL) {
+        atexit(PrintProfile);
+    }
+    t->id = threadCount++;
+    t->next = threads;
+    threads = t;
+    current = t;
+
+    return t;
+}
+
+void ProfileSample(ProfileThread *t, uint64_t *cycles, uint64_t *instructions) {
+    perf_event_mmap_page *page = t->page;
+    uint64_t count = 0;
+    uint32_t seq;
+    int64_t pmc;
+
+    /* The kernel bumps lock around updates to the page; retry if it moved */
+    if(page != NULL) {
+        do {
+            seq = page->lock;
+            __asm__ __volatile__("" ::: "memory");
+            count = page->offset;
+            if(page->index != 0) {
+                pmc = __rdpmc(page->index - 1);
+                pmc = (int64_t)((uint64_t)pmc << (64 - page->pmc_width)) >> (64 - page->pmc_width);
+                count += pmc;
+            }
+            __asm__ __volatile__("" ::: "memory");
+        } while(page->lock != seq);
+    }
+
+    *instructions = count;
+    *cycles = __rdtsc();
+}
+
+void ProfileAdd(ProfileThread *t, ProfileStage stage, uint64_t cycles, uint64_t instructions) {
+    uint64_t now;
+    uint64_t count;
+
+    ProfileSample(t, &now, &count);
+    t->calls[stage]++;
+    t->cycles[stage] += now - cycles;
+    t->instructions[stage] += count - instructions;
+}
+
+#endif
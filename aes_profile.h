@@ -0,0 +1,68 @@
+/*
+ * Per-stage cycle counters for the AES Encryption project
+ *
+ * Built only with -DAES_PROFILE (make profile). Each instrumented protocol
+ * opens a ProfileScope, which adds the calls, TSC cycles and, where the
+ * kernel lets user space read the instruction counter with RDPMC, retired
+ * instructions to counters owned by the calling thread. Every thread's
+ * counters sit on their own cache lines and are only written by that
+ * thread; the table is printed to standard error at exit. Without
+ * AES_PROFILE, PROFILE_STAGE() expands to nothing.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_PROFILE_H
+#define AES_PROFILE_H
+
+#include <stdint.h>
+
+enum ProfileStage {
+    PROFILE_SUB_BYTES,
+    PROFILE_SHIFT_ROWS,
+    PROFILE_MIX_COLUMNS,
+    PROFILE_ADD_ROUND_KEY,
+    PROFILE_EXPAND_KEY,
+    PROFILE_STAGES
+};
+
+#ifdef AES_PROFILE
+
+struct ProfileThread;
+
+/* Counters of the calling thread, created and registered on first use */
+ProfileThread *CurrentProfileThread();
+
+/* Read the TSC and the instruction counter (0 when unavailable) */
+void ProfileSample(ProfileThread *t, uint64_t *cycles, uint64_t *instructions);
+
+/* Add one call of stage that started at the given sample */
+void ProfileAdd(ProfileThread *t, ProfileStage stage, uint64_t cycles, uint64_t instructions);
+
+/* Counts the enclosing block as one call of a stage; nested scopes are counted in both */
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) : stage(stage), thread(CurrentProfileThread()) {
+        ProfileSample(thread, &cycles, &instructions);
+    }
+
+    ~ProfileScope() {
+        ProfileAdd(thread, stage, cycles, instructions);
+    }
+
+private:
+    ProfileStage stage;
+    ProfileThread *thread;
+    uint64_t cycles;
+    uint64_t instructions;
+};
+
+#define PROFILE_STAGE(stage) ProfileScope profileScope(stage)
+
+#else
+
+#define PROFILE_STAGE(stage)
+
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Single-producer/single-consumer ring for the AES Encryption project
+ *
+ * Connects two pipeline stages without locks: only the producer writes
+ * tail and only the consumer writes head, each on its own cache line.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_RING_H
+#define AES_RING_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>
+
+template<typename T, size_t N>
+class SpscRing {
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    /* Producer side; false when the ring is full */
+    bool Push(const T &value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots[t % N] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer side; false when the ring is empty */
+    bool Pop(T &value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = slots[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Blocking forms that yield the core while waiting */
+    void PushWait(const T &value) {
+        while(!Push(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void PopWait(T &value) {
+        while(!Pop(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) T slots[N];
+};
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * File and stream encryption for the AES Encryption project
+ *
+ * Three stages share a fixed set of page-aligned buffers. The reader fills
+ * a buffer (or, for a memory-mapped file, points into the mapping), the
+ * encryptor runs the mode over it with the worker pool, and the writer
+ * hands it to the kernel in one large write. Buffer indices travel between
+ * the stages through lock-free rings, so reading, encrypting and writing
+ * overlap and nothing is allocated per block. Decryption runs through the
+ * same stages; the reader looks one buffer ahead so the final chunk, which
+ * holds the padding to strip, is never empty.
+ *
+ * AES Encryption
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "aes_modes.h"
+#include "aes_ring.h"
+#include "aes_stream.h"
+
+/* One buffer's worth of work moving down the pipeline */
+struct Chunk {
+    /* Index of the buffer that receives (or already holds) the output */
+    int buffer;
+    /* Input bytes: the buffer itself, or a slice of the input mapping */
+    const uint8_t *data;
+    size_t len;
+    /* Set on the final chunk, which is empty only when the whole input is */
+    bool last;
+};
+
+struct Pipeline {
+    uint8_t *buffers[STREAM_BUFFERS];
+    /* Writer to reader: buffers that may be refilled */
+    SpscRing<int, STREAM_BUFFERS> free;
+    /* Reader to encryptor */
+    SpscRing<Chunk, STREAM_BUFFERS> filled;
+    /* Encryptor to writer */
+    SpscRing<Chunk, STREAM_BUFFERS> encrypted;
+    /* Set by any stage that hit an I/O error */
+    std::atomic<bool> failed;
+};
+
+/* Read until buf is full or the input ends; returns bytes read or -1 */
+static ssize_t ReadFully(int fd, uint8_t *buf, size_t len) {
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len) {
+        n = read(fd, buf + done, len - done);
+        if(n == 0) {
+            break;
+        }
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+/* Write all of buf; returns 0 or -1 */
+static int WriteFully(int fd, const uint8_t *buf, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Reader stage for pipes and other unmappable input */
+static void ReadStage(Pipeline *p, int fd) {
+    Chunk c;
+    int next = -1;
+    ssize_t n;
+    ssize_t ahead = 0;
+
+    p->free.PopWait(c.buffer);
+    n = ReadFully(fd, p->buffers[c.buffer], STREAM_BUFFER);
+
+    do {
+        if(n < 0) {
+            perror("read");
+            p->failed = true;
+            n = 0;
+        }
+
+        /* A full buffer is only known to be the last once the next read comes back empty */
+        c.last = true;
+        if(n == STREAM_BUFFER && !p->failed) {
+            p->free.PopWait(next);
+            ahead = ReadFully(fd, p->buffers[next], STREAM_BUFFER);
+            c.last = ahead == 0;
+        }
+
+        c.data = p->buffers[c.buffer];
+        c.len = n;
+        p->filled.PushWait(c);
+
+        c.buffer = next;
+        n = ahead;
+    } while(!c.last);
+}
+
+/* Reader stage for a memory-mapped file: no copies, just slices of the mapping */
+static void MapStage(Pipeline *p, const uint8_t *map, size_t size) {
+    size_t pos = 0;
+    Chunk c;
+
+    do {
+        p->free.PopWait(c.buffer);
+
+        c.data = map + pos;
+        c.len = size - pos < STREAM_BUFFER ? size - pos : STREAM_BUFFER;
+        pos += c.len;
+        c.last = pos == size;
+        p->filled.PushWait(c);
+    } while(!c.last);
+}
+
+/* Writer stage */
+static void WriteStage(Pipeline *p, int fd) {
+    Chunk c;
+
+    do {
+        p->encrypted.PopWait(c);
+
+        if(!p->failed && WriteFully(fd, c.data, c.len) < 0) {
+            perror("write");
+            p->failed = true;
+        }
+
+        p->free.PushWait(c.buffer);
+    } while(!c.last);
+}
+
+/* Decrypt one chunk of ECB or CBC ciphertext into out; returns the plaintext length */
+static size_t DecryptChunk(Pipeline *p, const AesContext *ctx, const StreamOptions *options, uint8_t *chain, const Chunk &c, uint8_t *out) {
+    ThreadPool &pool = DefaultPool();
+    size_t whole = c.len / 16;
+    int pad;
+
+    if(c.len % 16 != 0 || (c.last && c.len == 0)) {
+        fprintf(stderr, "Ciphertext is not a whole number of blocks\n");
+        p->failed = true;
+        return 0;
+    }
+
+    if(options->mode == STREAM_ECB) {
+        EcbDecryptParallel(ctx, c.data, out, whole, pool);
+    }
+    else {
+        CbcDecrypt(ctx, chain, c.data, out, whole);
+    }
+
+    /* Only the last chunk carries the padding block */
+    if(!c.last) {
+        return c.len;
+    }
+    pad = Pkcs7PadLength(out + c.len - 16);
+    if(pad < 0) {
+        fprintf(stderr, "Bad PKCS#7 padding, wrong key or corrupt input\n");
+        p->failed = true;
+        return 0;
+    }
+
+    return c.len - pad;
+}
+
+/* Encryptor stage, run on the calling thread */
+static void EncryptStage(Pipeline *p, const AesContext *ctx, const StreamOptions *options) {
+    ThreadPool &pool = DefaultPool();
+    uint8_t chain[16];
+    uint8_t block[16];
+    uint64_t offset = 0;
+    size_t whole;
+    Chunk c;
+
+    memcpy(chain, options->iv, 16);
+
+    do {
+        p->filled.PopWait(c);
+
+        uint8_t *out = p->buffers[c.buffer];
+        whole = c.len / 16;
+
+        if(options->mode == STREAM_CTR) {
+            CtrCryptParallel(ctx, options->iv, offset, c.data, out, c.len, pool);
+            offset += c.len;
+        }
+        else if(options->decrypt) {
+            c.len = p->failed ? 0 : DecryptChunk(p, ctx, options, chain, c, out);
+        }
+        else {
+            if(options->mode == STREAM_ECB) {
+                EcbEncryptParallel(ctx, c.data, out, whole, pool);
+            }
+            else {
+                CbcEncrypt(ctx, chain, c.data, out, whole);
+            }
+
+            /* Only the last chunk can end mid-block; it always gains a padding block */
+            if(c.last) {
+                Pkcs7PadBlock(c.data + 16 * whole, c.len % 16, block);
+                if(options->mode == STREAM_ECB) {
+                    EncryptBlocks(ctx, block, out + 16 * whole, 1);
+                }
+                else {
+                    CbcEncrypt(ctx, chain, block, out + 16 * whole, 1);
+                }
+                whole++;
+            }
+            c.len = 16 * whole;
+        }
+
+        c.data = out;
+        p->encrypted.PushWait(c);
+    } while(!c.last);
+}
+
+int EncryptStream(const AesContext *ctx, const StreamOptions *options) {
+    Pipeline p;
+    const uint8_t *map = NULL;
+    struct stat st;
+    size_t size = 0;
+    int in;
+    int out;
+    int i;
+
+    in = strcmp(options->in, "-") == 0 ? STDIN_FILENO : open(options->in, O_RDONLY);
+    if(in < 0) {
+        perror(options->in);
+        return -1;
+    }
+
+    out = strcmp(options->out, "-") == 0 ? STDOUT_FILENO : open(options->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        perror(options->out);
+        close(in);
+        return -1;
+    }
+
+    /* The extra page holds the padding block of the final chunk */
+    p.failed = false;
+    for(i = 0; i < STREAM_BUFFERS; i++) {
+        p.buffers[i] = (uint8_t *)aligned_alloc(4096, STREAM_BUFFER + 4096);
+        if(p.buffers[i] == NULL) {
+            fprintf(stderr, "Out of memory for stream buffers\n");
+            p.failed = true;
+            break;
+        }
+        p.free.PushWait(i);
+    }
+
+    /* Map regular files; anything else is read through the buffers */
+    if(fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+        if(m != MAP_FAILED) {
+            map = (const uint8_t *)m;
+            size = st.st_size;
+            madvise(m, size, MADV_SEQUENTIAL);
+        }
+    }
+
+    if(!p.failed) {
+        std::thread reader = map ? std::thread(MapStage, &p, map, size) : std::thread(ReadStage, &p, in);
+        std::thread writer(WriteStage, &p, out);
+
+        EncryptStage(&p, ctx, options);
+
+        reader.join();
+        writer.join();
+    }
+
+    while(i-- > 0) {
+        free(p.buffers[i]);
+    }
+    if(map) {
+        munmap((void *)map, size);
+    }
+    if(in != STDIN_FILENO) {
+        close(in);
+    }
+    if(out != STDOUT_FILENO && close(out) < 0) {
+        perror(options->out);
+        return -1;
+    }
+
+    return p.failed ? -1 : 0;
+}
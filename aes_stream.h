@@ -0,0 +1,45 @@
+/*
+ * File and stream encryption for the AES Encryption project
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_STREAM_H
+#define AES_STREAM_H
+
+#include <stdint.h>
+
+#include "aes_engine.h"
+
+/* Bytes moved through the pipeline per buffer; a multiple of the page size */
+#define STREAM_BUFFER (4 * 1024 * 1024)
+
+/* Buffers in flight between the reader, the encryptor and the writer */
+#define STREAM_BUFFERS 4
+
+enum StreamMode {
+    STREAM_ECB,
+    STREAM_CBC,
+    STREAM_CTR
+};
+
+struct StreamOptions {
+    /* Paths, or "-" for standard input and output */
+    const char *in;
+    const char *out;
+    StreamMode mode;
+    /* Decrypt instead of encrypt; ECB and CBC input must end in valid PKCS#7 padding */
+    bool decrypt;
+    /* Initialization vector for CBC, initial counter block for CTR */
+    uint8_t iv[16];
+};
+
+/*
+ * Encrypt (or decrypt) options->in into options->out. ECB and CBC output is
+ * padded with PKCS#7, and the padding is checked and stripped on decryption.
+ * Regular input files are memory-mapped; pipes go through a
+ * reader/encryptor/writer pipeline. Returns 0, or -1 after printing why.
+ */
+int EncryptStream(const AesContext *ctx, const StreamOptions *options);
+
+#endif
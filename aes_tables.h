@@ -0,0 +1,130 @@
+/*
+ * Compile-time lookup tables for the AES Encryption project
+ *
+ * The S-Box walk and the T-table construction are constexpr, so every
+ * table is finished by the compiler and emitted as aligned read-only data. Nothing has to run before the first encryption, and processes
+ * running the same binary share the pages.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_TABLES_H
+#define AES_TABLES_H
+
+#include <stdint.h>
+
+#define ROTL8(x,shift) ((uint8_t) ((x) << (shift)) | ((x) >> (8 - (shift))))
+
+/* Mix Columns encryption matrix */
+inline constexpr unsigned int MCE[4] = { 0x02030101, 0x01020301, 0x01010203, 0x03010102 };
+/* Mix Columns decryption matrix, the inverse of MCE */
+inline constexpr unsigned int MCD[4] = { 0x0e0b0d09, 0x090e0b0d, 0x0d090e0b, 0x0b0d090e };
+
+struct AesTables {
+    /* Round constants: successive powers of x in GF(2^8) */
+    uint8_t rc[10];
+    alignas(64) uint8_t sbox[256];
+    alignas(64) uint8_t invsbox[256];
+    /* Te0..Te3 fold SubBytes and MixColumns, Te4 is the final round S-Box */
+    alignas(64) unsigned int te[5][256];
+    /* Td0..Td3 fold the inverse S-Box and InvMixColumns, Td4 is the final round inverse S-Box */
+    alignas(64) unsigned int td[5][256];
+};
+
+/* Multiply two elements of GF(2^8) modulo the AES polynomial */
+constexpr uint8_t GfMultiply(uint8_t a, uint8_t b) {
+    uint8_t out = 0;
+
+    while(b) {
+        if(b & 1) {
+            out ^= a;
+        }
+        a = (a << 1) ^ (a & 0x80 ? 0x1B : 0);
+        b >>= 1;
+    }
+
+    return out;
+}
+
+/* Generate S-Box (taken from https://en.wikipedia.org/wiki/Rijndael_S-box) */
+constexpr void BuildSbox(AesTables &t) {
+    uint8_t p = 1, q = 1;
+
+    /* Loop invariant: p * q == 1 in the Galois field */
+    do {
+        /* Multiply p by 3 */
+        p = p ^ (p << 1) ^ (p & 0x80 ? 0x1B : 0);
+
+        /* Divide q by 3 (equals multiplication by 0xf6) */
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        q ^= q & 0x80 ? 0x09 : 0;
+
+        /* Compute the affine transformation */
+        uint8_t xformed = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4);
+
+        t.sbox[p] = xformed ^ 0x63;
+        t.invsbox[t.sbox[p]] = p;
+    } while (p != 1);
+
+    /* 0 is a special case since it has no inverse */
+    t.sbox[0] = 0x63;
+    t.invsbox[0x63] = 0;
+}
+
+/* Fold box and a Mix Columns matrix into four round tables and a final round table */
+constexpr void BuildRoundTables(unsigned int (*tables)[256], const uint8_t *box, const unsigned int *matrix) {
+    for(int x = 0; x < 256; x++) {
+        uint8_t s = box[x];
+
+        /* Column j of the matrix multiplies the byte that lands in row j of a state column */
+        for(int j = 0; j < 4; j++) {
+            unsigned int v = 0;
+            for(int i = 0; i < 4; i++) {
+                uint8_t coefficient = (matrix[i] >> (24 - 8 * j)) & 0xFF;
+                v |= (unsigned int)GfMultiply(coefficient, s) << (24 - 8 * i);
+            }
+            tables[j][x] = v;
+        }
+
+        /* Last round has no Mix Columns, so the S-Box value is replicated and masked */
+        tables[4][x] = s * 0x01010101u;
+    }
+}
+
+/* Round constant i is x^i, each one xtime of the last */
+constexpr void BuildRoundConstants(AesTables &t) {
+    uint8_t x = 1;
+
+    for(int i = 0; i < 10; i++) {
+        t.rc[i] = x;
+        x = GfMultiply(x, 0x02);
+    }
+}
+
+constexpr AesTables BuildTables() {
+    AesTables t = {};
+
+    BuildRoundConstants(t);
+    BuildSbox(t);
+    BuildRoundTables(t.te, t.sbox, MCE);
+    BuildRoundTables(t.td, t.invsbox, MCD);
+
+    return t;
+}
+
+inline constexpr AesTables aesTables = BuildTables();
+
+/* Round Constant definition, generated at compile time */
+inline constexpr const unsigned char (&RC)[10] = aesTables.rc;
+
+/* FIPS-197 Figure 7 and Figure 14 entries, and the first entries of the folded tables */
+static_assert(aesTables.sbox[0x00] == 0x63 && aesTables.sbox[0x53] == 0xED && aesTables.sbox[0xFF] == 0x16, "S-Box does not match FIPS-197");
+static_assert(aesTables.invsbox[0x00] == 0x52 && aesTables.invsbox[0xED] == 0x53 && aesTables.invsbox[0xFF] == 0x7D, "Inverse S-Box does not match FIPS-197");
+static_assert(aesTables.te[0][0x00] == 0xC66363A5 && aesTables.te[3][0x00] == 0x6363A5C6, "Te tables do not fold the S-Box into MCE");
+static_assert(aesTables.td[0][0x00] == 0x51F4A750 && aesTables.td[4][0x00] == 0x52525252, "Td tables do not fold the inverse S-Box into MCD");
+static_assert(RC[0] == 0x01 && RC[7] == 0x80 && RC[8] == 0x1B && RC[9] == 0x36, "Round constants do not match FIPS-197 Section 5.2");
+static_assert(GfMultiply(0x57, 0x13) == 0xFE, "GF(2^8) multiplication does not match FIPS-197 Section 4.2");
+
+#endif
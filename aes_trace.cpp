@@ -0,0 +1,148 @@
+/*
+ * Round tracing for the AES Encryption project
+ *
+ * Trace files start with a TraceHeader followed by the records, oldest
+ * first, in native byte order.
+ *
+ * AES Encryption
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes_trace.h"
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t records;
+};
+
+static const char traceMagic[8] = { 'A', 'E', 'S', 'T', 'R', 'A', 'C', 'E' };
+
+void TextTrace::Record(int round, TraceStep step, const unsigned int *words) {
+    switch(step) {
+    case TRACE_INPUT:
+        break;
+    case TRACE_SUB_BYTES:
+        printf("\n(%d) Substitute Bytes:\n---------------------\n", round);
+        break;
+    case TRACE_SHIFT_ROWS:
+        printf("\n(%d) Shift Rows:\n---------------\n", round);
+        break;
+    case TRACE_MIX_COLUMNS:
+        printf("\n(%d) Mix Columns:\n----------------\n", round);
+        break;
+    case TRACE_ROUND_KEY:
+        printf("\n(%d) Round Key:\n--------------\n", round);
+        break;
+    case TRACE_ADD_ROUND_KEY:
+        if(round == rounds) {
+            printf("\n(%d) Final Output:\n------------------\n", round + 1);
+        }
+        else {
+            printf("\n(%d) Start of Round:\n-------------------\n", round + 1);
+        }
+        break;
+    }
+
+    PrintState(words);
+}
+
+bool CreateTraceRing(TraceRing *ring, size_t records, int rounds) {
+    size_t capacity = 1;
+
+    /* Bounded before rounding up, so neither the doubling nor the byte count can wrap */
+    if(records > TRACE_MAX_RECORDS) {
+        ring->records = NULL;
+        return false;
+    }
+    while(capacity < records) {
+        capacity <<= 1;
+    }
+
+    ring->records = (TraceRecord *)malloc(capacity * sizeof(TraceRecord));
+    ring->capacity = capacity;
+    ring->written = 0;
+    ring->block = 0;
+    ring->rounds = rounds;
+
+    return ring->records != NULL;
+}
+
+void DestroyTraceRing(TraceRing *ring) {
+    free(ring->records);
+    ring->records = NULL;
+}
+
+bool WriteTrace(const TraceRing *ring, const char *path) {
+    TraceHeader header;
+    uint64_t kept = ring->written < ring->capacity ? ring->written : ring->capacity;
+    size_t first = (ring->written - kept) & (ring->capacity - 1);
+    size_t tail = ring->capacity - first < kept ? ring->capacity - first : kept;
+    FILE *f = fopen(path, "wb");
+    bool ok;
+
+    if(f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, traceMagic, sizeof(traceMagic));
+    header.recordSize = sizeof(TraceRecord);
+    header.records = kept;
+
+    /* The kept records wrap around the end of the ring at most once */
+    ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(ring->records + first, sizeof(TraceRecord), tail, f) == tail;
+    ok = ok && fwrite(ring->records, sizeof(TraceRecord), kept - tail, f) == kept - tail;
+    if(fclose(f) != 0 || !ok) {
+        perror(path);
+        return false;
+    }
+
+    return true;
+}
+
+bool PrintTrace(const char *path) {
+    TraceHeader header;
+    TraceRecord r;
+    TextTrace text;
+    uint64_t i;
+    bool first = true;
+    uint32_t block = 0;
+    FILE *f = fopen(path, "rb");
+
+    if(f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, traceMagic, sizeof(traceMagic)) != 0 || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(f);
+        return false;
+    }
+
+    for(i = 0; i < header.records; i++) {
+        if(fread(&r, sizeof(r), 1, f) != 1) {
+            fprintf(stderr, "%s ends after %llu of %llu records\n", path, (unsigned long long)i, (unsigned long long)header.records);
+            fclose(f);
+            return false;
+        }
+
+        if(first || r.block != block) {
+            printf("\n======== Block %u ========\n", r.block);
+            first = false;
+            block = r.block;
+        }
+        text.rounds = r.rounds;
+        text.Record(r.round, (TraceStep)r.step, r.words);
+    }
+
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,131 @@
+/*
+ * Round tracing for the AES Encryption project
+ *
+ * EncryptStateTraced() runs the step-by-step protocols and hands the state
+ * after every step to a tracing policy. The policy is a template parameter,
+ * so NoTrace compiles away entirely, TextTrace prints the walkthrough that
+ * aes.cpp shows, and TraceRing appends fixed-size records to a preallocated
+ * ring that can be written to a file and printed later.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_TRACE_H
+#define AES_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_core.h"
+
+enum TraceStep {
+    /* The plaintext, before round 0 */
+    TRACE_INPUT,
+    TRACE_SUB_BYTES,
+    TRACE_SHIFT_ROWS,
+    TRACE_MIX_COLUMNS,
+    /* The round key about to be added */
+    TRACE_ROUND_KEY,
+    /* The state after the round key was added, which ends the round */
+    TRACE_ADD_ROUND_KEY
+};
+
+/* Tracing policy that records nothing */
+struct NoTrace {
+    inline void Record(int, TraceStep, const unsigned int *) {}
+};
+
+/* Tracing policy that prints each step as aes.cpp always has */
+struct TextTrace {
+    /* Rounds of the cipher, to label the last AddRoundKey as the output */
+    int rounds;
+
+    void Record(int round, TraceStep step, const unsigned int *words);
+};
+
+/* One step of one block, as stored in a TraceRing and in trace files */
+struct TraceRecord {
+    uint32_t block;
+    uint8_t round;
+    uint8_t step;
+    uint16_t rounds;
+    uint32_t words[4];
+};
+
+/*
+ * Tracing policy that copies each step into a ring of records allocated
+ * up front; once full, the oldest records are overwritten. Set block before
+ * each encryption to tell the blocks apart.
+ */
+struct TraceRing {
+    TraceRecord *records;
+    /* A power of two */
+    size_t capacity;
+    /* Records written so far, including overwritten ones */
+    uint64_t written;
+    uint32_t block;
+    uint16_t rounds;
+
+    inline void Record(int round, TraceStep step, const unsigned int *words) {
+        TraceRecord *r = &records[written++ & (capacity - 1)];
+
+        r->block = block;
+        r->round = round;
+        r->step = step;
+        r->rounds = rounds;
+        r->words[0] = words[0];
+        r->words[1] = words[1];
+        r->words[2] = words[2];
+        r->words[3] = words[3];
+    }
+};
+
+/* Most records a TraceRing may be asked for */
+#define TRACE_MAX_RECORDS ((size_t)1 << 28)
+
+/* Allocate a ring of at least records records; false when out of memory or records is past TRACE_MAX_RECORDS */
+bool CreateTraceRing(TraceRing *ring, size_t records, int rounds = 10);
+
+void DestroyTraceRing(TraceRing *ring);
+
+/* Write the records still in the ring, oldest first, to path */
+bool WriteTrace(const TraceRing *ring, const char *path);
+
+/* Read a file from WriteTrace() and print every block through TextTrace */
+bool PrintTrace(const char *path);
+
+/* Run every protocol in order on state, for 10, 12 or 14 rounds, reporting each step to trace */
+template<typename Trace>
+inline void EncryptStateTraced(unsigned int *state, const unsigned int *w, int rounds, Trace &trace) {
+    int count = 0;
+    int i;
+
+    trace.Record(count, TRACE_INPUT, state);
+    trace.Record(count, TRACE_ROUND_KEY, w);
+    AddRoundKey(state, w, count);
+    trace.Record(count, TRACE_ADD_ROUND_KEY, state);
+    count++;
+
+    for(i = 0; i < rounds - 1; i++) {
+        SubstituteBytes(state);
+        trace.Record(count, TRACE_SUB_BYTES, state);
+        ShiftRows(state);
+        trace.Record(count, TRACE_SHIFT_ROWS, state);
+        MixColumns(state);
+        trace.Record(count, TRACE_MIX_COLUMNS, state);
+        trace.Record(count, TRACE_ROUND_KEY, w + 4 * count);
+        AddRoundKey(state, w, count);
+        trace.Record(count, TRACE_ADD_ROUND_KEY, state);
+        count++;
+    }
+
+    SubstituteBytes(state);
+    trace.Record(count, TRACE_SUB_BYTES, state);
+    ShiftRows(state);
+    trace.Record(count, TRACE_SHIFT_ROWS, state);
+    trace.Record(count, TRACE_ROUND_KEY, w + 4 * count);
+    AddRoundKey(state, w, count);
+    trace.Record(count, TRACE_ADD_ROUND_KEY, state);
+}
+
+#endif
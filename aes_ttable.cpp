@@ -0,0 +1,399 @@
+/*
+ * T-table round engine for the AES Encryption project
+ *
+ * Each full round is 16 table lookups and XORs against the expanded key,
+ * instead of the separate SubstituteBytes, ShiftRows and MixColumns steps.
+ * Decryption uses the equivalent inverse cipher: the Td tables fold the
+ * inverse S-Box into InvMixColumns and the decryption round keys are
+ * pre-transformed once, so a decrypt round costs the same as an encrypt round.
+ *
+ * AES Encryption
+ */
+
+#include "aes_engine.h"
+
+/* InvMixColumns of one column word: Td_j[Te4[b]] is InvMixColumns of byte b in row j, since the inverse S-Box undoes the S-Box inside Td_j */
+static inline unsigned int InvMixColumn(unsigned int k) {
+    return Td0[Te4[k >> 24] & 0xFF] ^ Td1[Te4[(k >> 16) & 0xFF] & 0xFF] ^ Td2[Te4[(k >> 8) & 0xFF] & 0xFF] ^ Td3[Te4[k & 0xFF] & 0xFF];
+}
+
+/* Equivalent inverse key schedule: the round keys in reverse order, with InvMixColumns applied to all but the first and last */
+void InvertKeySchedule(const unsigned int *w, unsigned int *dw, int rounds) {
+    int round;
+    int c;
+
+    for(round = 0; round <= rounds; round++) {
+        for(c = 0; c < 4; c++) {
+            unsigned int k = w[4 * (rounds - round) + c];
+
+            if(round > 0 && round < rounds) {
+                k = InvMixColumn(k);
+            }
+            dw[4 * round + c] = k;
+        }
+    }
+}
+
+/* Load a big-endian word from a byte stream */
+static inline unsigned int LoadWord(const uint8_t *p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+/* Store a big-endian word to a byte stream */
+static inline void StoreWord(uint8_t *p, unsigned int v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* One full round: row r of the output column c comes from column c + r */
+#define TTABLE_ROUND(d, s, k) \
+    d[0] = Te0[s[0] >> 24] ^ Te1[(s[1] >> 16) & 0xFF] ^ Te2[(s[2] >> 8) & 0xFF] ^ Te3[s[3] & 0xFF] ^ (k)[0]; \
+    d[1] = Te0[s[1] >> 24] ^ Te1[(s[2] >> 16) & 0xFF] ^ Te2[(s[3] >> 8) & 0xFF] ^ Te3[s[0] & 0xFF] ^ (k)[1]; \
+    d[2] = Te0[s[2] >> 24] ^ Te1[(s[3] >> 16) & 0xFF] ^ Te2[(s[0] >> 8) & 0xFF] ^ Te3[s[1] & 0xFF] ^ (k)[2]; \
+    d[3] = Te0[s[3] >> 24] ^ Te1[(s[0] >> 16) & 0xFF] ^ Te2[(s[1] >> 8) & 0xFF] ^ Te3[s[2] & 0xFF] ^ (k)[3];
+
+/* Final round: Substitute Bytes and Shift Rows only */
+#define TTABLE_FINAL_ROUND(d, s, k) \
+    d[0] = ((Te4[s[0] >> 24] & 0xFF000000) ^ (Te4[(s[1] >> 16) & 0xFF] & 0x00FF0000) ^ (Te4[(s[2] >> 8) & 0xFF] & 0x0000FF00) ^ (Te4[s[3] & 0xFF] & 0x000000FF)) ^ (k)[0]; \
+    d[1] = ((Te4[s[1] >> 24] & 0xFF000000) ^ (Te4[(s[2] >> 16) & 0xFF] & 0x00FF0000) ^ (Te4[(s[3] >> 8) & 0xFF] & 0x0000FF00) ^ (Te4[s[0] & 0xFF] & 0x000000FF)) ^ (k)[1]; \
+    d[2] = ((Te4[s[2] >> 24] & 0xFF000000) ^ (Te4[(s[3] >> 16) & 0xFF] & 0x00FF0000) ^ (Te4[(s[0] >> 8) & 0xFF] & 0x0000FF00) ^ (Te4[s[1] & 0xFF] & 0x000000FF)) ^ (k)[2]; \
+    d[3] = ((Te4[s[3] >> 24] & 0xFF000000) ^ (Te4[(s[0] >> 16) & 0xFF] & 0x00FF0000) ^ (Te4[(s[1] >> 8) & 0xFF] & 0x0000FF00) ^ (Te4[s[2] & 0xFF] & 0x000000FF)) ^ (k)[3];
+
+/* One inverse round: row r of the output column c comes from column c - r */
+#define TTABLE_INV_ROUND(d, s, k) \
+    d[0] = Td0[s[0] >> 24] ^ Td1[(s[3] >> 16) & 0xFF] ^ Td2[(s[2] >> 8) & 0xFF] ^ Td3[s[1] & 0xFF] ^ (k)[0]; \
+    d[1] = Td0[s[1] >> 24] ^ Td1[(s[0] >> 16) & 0xFF] ^ Td2[(s[3] >> 8) & 0xFF] ^ Td3[s[2] & 0xFF] ^ (k)[1]; \
+    d[2] = Td0[s[2] >> 24] ^ Td1[(s[1] >> 16) & 0xFF] ^ Td2[(s[0] >> 8) & 0xFF] ^ Td3[s[3] & 0xFF] ^ (k)[2]; \
+    d[3] = Td0[s[3] >> 24] ^ Td1[(s[2] >> 16) & 0xFF] ^ Td2[(s[1] >> 8) & 0xFF] ^ Td3[s[0] & 0xFF] ^ (k)[3];
+
+/* Final inverse round: Inverse Shift Rows and Inverse Substitute Bytes only */
+#define TTABLE_INV_FINAL_ROUND(d, s, k) \
+    d[0] = ((Td4[s[0] >> 24] & 0xFF000000) ^ (Td4[(s[3] >> 16) & 0xFF] & 0x00FF0000) ^ (Td4[(s[2] >> 8) & 0xFF] & 0x0000FF00) ^ (Td4[s[1] & 0xFF] & 0x000000FF)) ^ (k)[0]; \
+    d[1] = ((Td4[s[1] >> 24] & 0xFF000000) ^ (Td4[(s[0] >> 16) & 0xFF] & 0x00FF0000) ^ (Td4[(s[3] >> 8) & 0xFF] & 0x0000FF00) ^ (Td4[s[2] & 0xFF] & 0x000000FF)) ^ (k)[1]; \
+    d[2] = ((Td4[s[2] >> 24] & 0xFF000000) ^ (Td4[(s[1] >> 16) & 0xFF] & 0x00FF0000) ^ (Td4[(s[0] >> 8) & 0xFF] & 0x0000FF00) ^ (Td4[s[3] & 0xFF] & 0x000000FF)) ^ (k)[2]; \
+    d[3] = ((Td4[s[3] >> 24] & 0xFF000000) ^ (Td4[(s[2] >> 16) & 0xFF] & 0x00FF0000) ^ (Td4[(s[1] >> 8) & 0xFF] & 0x0000FF00) ^ (Td4[s[0] & 0xFF] & 0x000000FF)) ^ (k)[3];
+
+/* Encrypt a state of 4 column words in place */
+template<int Nr>
+void EncryptStateTTable(const unsigned int *w, unsigned int *s) {
+    unsigned int a[4];
+    unsigned int b[4];
+    int round;
+
+    /* Initial Add Round Key */
+    a[0] = s[0] ^ w[0];
+    a[1] = s[1] ^ w[1];
+    a[2] = s[2] ^ w[2];
+    a[3] = s[3] ^ w[3];
+
+    /* Rounds 1 to Nr - 2, two at a time so the state ping-pongs between a and b */
+#pragma GCC unroll 8
+    for(round = 1; round < Nr - 1; round += 2) {
+        TTABLE_ROUND(b, a, w + 4 * round);
+        TTABLE_ROUND(a, b, w + 4 * (round + 1));
+    }
+    TTABLE_ROUND(b, a, w + 4 * (Nr - 1));
+
+    TTABLE_FINAL_ROUND(s, b, w + 4 * Nr);
+}
+
+/* Encrypt a state like EncryptStateTTable(), keeping the state after every round */
+template<int Nr>
+void TraceStateTTable(const unsigned int *w, const unsigned int *in, unsigned int (*states)[4]) {
+    int round;
+
+    states[0][0] = in[0] ^ w[0];
+    states[0][1] = in[1] ^ w[1];
+    states[0][2] = in[2] ^ w[2];
+    states[0][3] = in[3] ^ w[3];
+
+#pragma GCC unroll 14
+    for(round = 1; round < Nr; round++) {
+        TTABLE_ROUND(states[round], states[round - 1], w + 4 * round);
+    }
+
+    TTABLE_FINAL_ROUND(states[Nr], states[Nr - 1], w + 4 * Nr);
+}
+
+/* Encrypt consecutive blocks, loading each as big-endian column words */
+template<int Nr>
+void EncryptBlocksTTable(const unsigned int *w, const uint8_t *in, uint8_t *out, size_t blocks) {
+    unsigned int s[4];
+    size_t n;
+
+    for(n = 0; n < blocks; n++) {
+        s[0] = LoadWord(in);
+        s[1] = LoadWord(in + 4);
+        s[2] = LoadWord(in + 8);
+        s[3] = LoadWord(in + 12);
+
+        EncryptStateTTable<Nr>(w, s);
+
+        StoreWord(out, s[0]);
+        StoreWord(out + 4, s[1]);
+        StoreWord(out + 8, s[2]);
+        StoreWord(out + 12, s[3]);
+
+        in += 16;
+        out += 16;
+    }
+}
+
+/* Decrypt a state of 4 column words in place with the equivalent inverse key schedule dw */
+template<int Nr>
+void DecryptStateTTable(const unsigned int *dw, unsigned int *s) {
+    unsigned int a[4];
+    unsigned int b[4];
+    int round;
+
+    a[0] = s[0] ^ dw[0];
+    a[1] = s[1] ^ dw[1];
+    a[2] = s[2] ^ dw[2];
+    a[3] = s[3] ^ dw[3];
+
+#pragma GCC unroll 8
+    for(round = 1; round < Nr - 1; round += 2) {
+        TTABLE_INV_ROUND(b, a, dw + 4 * round);
+        TTABLE_INV_ROUND(a, b, dw + 4 * (round + 1));
+    }
+    TTABLE_INV_ROUND(b, a, dw + 4 * (Nr - 1));
+
+    TTABLE_INV_FINAL_ROUND(s, b, dw + 4 * Nr);
+}
+
+/* Decrypt consecutive blocks, loading each as big-endian column words */
+template<int Nr>
+void DecryptBlocksTTable(const unsigned int *dw, const uint8_t *in, uint8_t *out, size_t blocks) {
+    unsigned int s[4];
+    size_t n;
+
+    for(n = 0; n < blocks; n++) {
+        s[0] = LoadWord(in);
+        s[1] = LoadWord(in + 4);
+        s[2] = LoadWord(in + 8);
+        s[3] = LoadWord(in + 12);
+
+        DecryptStateTTable<Nr>(dw, s);
+
+        StoreWord(out, s[0]);
+        StoreWord(out + 4, s[1]);
+        StoreWord(out + 8, s[2]);
+        StoreWord(out + 12, s[3]);
+
+        in += 16;
+        out += 16;
+    }
+}
+
+/* Blocks encrypted together under separate keys, so one block's table loads overlap the others' */
+#define TTABLE_LANES 4
+
+template<int Nr>
+void EncryptMultiKeyTTable(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    unsigned int a[TTABLE_LANES][4];
+    unsigned int b[TTABLE_LANES][4];
+    const unsigned int *w[TTABLE_LANES];
+    unsigned int s[4];
+    size_t n = 0;
+    int round;
+    int l;
+    int c;
+
+    for(; n + TTABLE_LANES <= count; n += TTABLE_LANES) {
+#pragma GCC unroll 4
+        for(l = 0; l < TTABLE_LANES; l++) {
+            w[l] = ctxs[n + l]->w;
+            for(c = 0; c < 4; c++) {
+                a[l][c] = LoadWord(in[n + l] + 4 * c) ^ w[l][c];
+            }
+        }
+
+        /* The lanes step through each round together, as in EncryptStateTTable() */
+#pragma GCC unroll 8
+        for(round = 1; round < Nr - 1; round += 2) {
+#pragma GCC unroll 4
+            for(l = 0; l < TTABLE_LANES; l++) {
+                TTABLE_ROUND(b[l], a[l], w[l] + 4 * round);
+            }
+#pragma GCC unroll 4
+            for(l = 0; l < TTABLE_LANES; l++) {
+                TTABLE_ROUND(a[l], b[l], w[l] + 4 * (round + 1));
+            }
+        }
+
+#pragma GCC unroll 4
+        for(l = 0; l < TTABLE_LANES; l++) {
+            TTABLE_ROUND(b[l], a[l], w[l] + 4 * (Nr - 1));
+            TTABLE_FINAL_ROUND(a[l], b[l], w[l] + 4 * Nr);
+            for(c = 0; c < 4; c++) {
+                StoreWord(out[n + l] + 4 * c, a[l][c]);
+            }
+        }
+    }
+
+    /* Ragged tail: the remaining lanes one at a time */
+    for(; n < count; n++) {
+        for(c = 0; c < 4; c++) {
+            s[c] = LoadWord(in[n] + 4 * c);
+        }
+        EncryptStateTTable<Nr>(ctxs[n]->w, s);
+        for(c = 0; c < 4; c++) {
+            StoreWord(out[n] + 4 * c, s[c]);
+        }
+    }
+}
+
+/* Round key r + 1 of a 16-byte key from round key r, as ExpandKey<4>() computes words 4r + 4 to 4r + 7 */
+static inline void NextRoundKey(unsigned int *k, int r) {
+    k[0] ^= SubWord(RotWord(k[3])) ^ ((unsigned int)RC[r] << 24);
+    k[1] ^= k[0];
+    k[2] ^= k[1];
+    k[3] ^= k[2];
+}
+
+/* Round key r from round key r + 1: the same step run backwards */
+static inline void PreviousRoundKey(unsigned int *k, int r) {
+    k[3] ^= k[2];
+    k[2] ^= k[1];
+    k[1] ^= k[0];
+    k[0] ^= SubWord(RotWord(k[3])) ^ ((unsigned int)RC[r] << 24);
+}
+
+void LastRoundKey(const uint8_t *key, uint8_t *last) {
+    unsigned int k[4];
+    int round;
+    int c;
+
+    for(c = 0; c < 4; c++) {
+        k[c] = LoadWord(key + 4 * c);
+    }
+    for(round = 0; round < 10; round++) {
+        NextRoundKey(k, round);
+    }
+    for(c = 0; c < 4; c++) {
+        StoreWord(last + 4 * c, k[c]);
+    }
+}
+
+void EncryptBlocksOnTheFly(const uint8_t *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+    unsigned int a[TTABLE_LANES][4];
+    unsigned int b[TTABLE_LANES][4];
+    unsigned int k[4];
+    size_t lanes;
+    size_t l;
+    int round;
+    int c;
+
+    /* Up to TTABLE_LANES blocks go through the rounds together and share each derived round key */
+    for(; blocks > 0; blocks -= lanes) {
+        lanes = blocks < TTABLE_LANES ? blocks : TTABLE_LANES;
+
+        for(c = 0; c < 4; c++) {
+            k[c] = LoadWord(key + 4 * c);
+        }
+        for(l = 0; l < lanes; l++) {
+            for(c = 0; c < 4; c++) {
+                a[l][c] = LoadWord(in + 16 * l + 4 * c) ^ k[c];
+            }
+        }
+
+        for(round = 1; round < 9; round += 2) {
+            NextRoundKey(k, round - 1);
+            for(l = 0; l < lanes; l++) {
+                TTABLE_ROUND(b[l], a[l], k);
+            }
+            NextRoundKey(k, round);
+            for(l = 0; l < lanes; l++) {
+                TTABLE_ROUND(a[l], b[l], k);
+            }
+        }
+        NextRoundKey(k, 8);
+        for(l = 0; l < lanes; l++) {
+            TTABLE_ROUND(b[l], a[l], k);
+        }
+        NextRoundKey(k, 9);
+        for(l = 0; l < lanes; l++) {
+            TTABLE_FINAL_ROUND(a[l], b[l], k);
+            for(c = 0; c < 4; c++) {
+                StoreWord(out + 16 * l + 4 * c, a[l][c]);
+            }
+        }
+
+        in += 16 * lanes;
+        out += 16 * lanes;
+    }
+}
+
+void DecryptBlocksOnTheFly(const uint8_t *last, const uint8_t *in, uint8_t *out, size_t blocks) {
+    unsigned int a[TTABLE_LANES][4];
+    unsigned int b[TTABLE_LANES][4];
+    unsigned int k[4];
+    unsigned int d[4];
+    size_t lanes;
+    size_t l;
+    int round;
+    int c;
+
+    /* The equivalent inverse cipher, taking InvMixColumns of each round key as the schedule steps back to it */
+    for(; blocks > 0; blocks -= lanes) {
+        lanes = blocks < TTABLE_LANES ? blocks : TTABLE_LANES;
+
+        for(c = 0; c < 4; c++) {
+            k[c] = LoadWord(last + 4 * c);
+        }
+        for(l = 0; l < lanes; l++) {
+            for(c = 0; c < 4; c++) {
+                a[l][c] = LoadWord(in + 16 * l + 4 * c) ^ k[c];
+            }
+        }
+
+        for(round = 1; round < 9; round += 2) {
+            PreviousRoundKey(k, 10 - round);
+            for(c = 0; c < 4; c++) {
+                d[c] = InvMixColumn(k[c]);
+            }
+            for(l = 0; l < lanes; l++) {
+                TTABLE_INV_ROUND(b[l], a[l], d);
+            }
+            PreviousRoundKey(k, 9 - round);
+            for(c = 0; c < 4; c++) {
+                d[c] = InvMixColumn(k[c]);
+            }
+            for(l = 0; l < lanes; l++) {
+                TTABLE_INV_ROUND(a[l], b[l], d);
+            }
+        }
+        PreviousRoundKey(k, 1);
+        for(c = 0; c < 4; c++) {
+            d[c] = InvMixColumn(k[c]);
+        }
+        for(l = 0; l < lanes; l++) {
+            TTABLE_INV_ROUND(b[l], a[l], d);
+        }
+        PreviousRoundKey(k, 0);
+        for(l = 0; l < lanes; l++) {
+            TTABLE_INV_FINAL_ROUND(a[l], b[l], k);
+            for(c = 0; c < 4; c++) {
+                StoreWord(out + 16 * l + 4 * c, a[l][c]);
+            }
+        }
+
+        in += 16 * lanes;
+        out += 16 * lanes;
+    }
+}
+
+/* AES-128, AES-192 and AES-256 */
+#define TTABLE_INSTANTIATE(Nr) \
+    template void EncryptStateTTable<Nr>(const unsigned int *w, unsigned int *s); \
+    template void TraceStateTTable<Nr>(const unsigned int *w, const unsigned int *in, unsigned int (*states)[4]); \
+    template void EncryptBlocksTTable<Nr>(const unsigned int *w, const uint8_t *in, uint8_t *out, size_t blocks); \
+    template void DecryptStateTTable<Nr>(const unsigned int *dw, unsigned int *s); \
+    template void DecryptBlocksTTable<Nr>(const unsigned int *dw, const uint8_t *in, uint8_t *out, size_t blocks); \
+    template void EncryptMultiKeyTTable<Nr>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+TTABLE_INSTANTIATE(10)
+TTABLE_INSTANTIATE(12)
+TTABLE_INSTANTIATE(14)
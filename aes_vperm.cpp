@@ -0,0 +1,301 @@
+/*
+ * Vector-permute round engine for the AES Encryption project
+ *
+ * Runs one block at a time in an SSE register, for CPUs (or virtual
+ * machines) without AES-NI, and reads no memory at an address that
+ * depends on the key or the data. Substitute Bytes moves each byte into
+ * GF(2^8) built as a quadratic extension of GF(2^4), where the inverse
+ * needs only inverses of 4-bit elements; every table has 16 entries and
+ * is applied to all 16 bytes at once with PSHUFB. Shift Rows is one more
+ * PSHUFB, and Mix Columns is rotations within the columns plus xtime.
+ *
+ * AES Encryption
+ */
+
+#include <cpuid.h>
+#include <tmmintrin.h>
+
+#include "aes_engine.h"
+
+static bool ProbeSsse3() {
+    unsigned int a;
+    unsigned int b;
+    unsigned int c;
+    unsigned int d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+
+bool HasSsse3() {
+    static const bool has = ProbeSsse3();
+
+    return has;
+}
+
+/* PSHUFB writes 0 for an index with the top bit set; the tables use it for 1/0 */
+#define VPERM_INFINITY 0x80
+
+struct VpermTables {
+    /* A byte into the tower field, by its low and high nibble; the decryption pair undoes the affine step first */
+    alignas(16) uint8_t encLo[16];
+    alignas(16) uint8_t encHi[16];
+    alignas(16) uint8_t decLo[16];
+    alignas(16) uint8_t decHi[16];
+    /* 1/x and a/x in GF(2^4) */
+    alignas(16) uint8_t inv[16];
+    alignas(16) uint8_t ak[16];
+    /* The inverse in the tower field back to a byte, as one table of io and one of jo; encryption adds the affine step but 0x63 */
+    alignas(16) uint8_t encIo[16];
+    alignas(16) uint8_t encJo[16];
+    alignas(16) uint8_t decIo[16];
+    alignas(16) uint8_t decJo[16];
+};
+
+/* Multiply in GF(2^4) modulo y^4 + y + 1 */
+constexpr uint8_t NibbleMultiply(uint8_t a, uint8_t b) {
+    uint8_t out = 0;
+
+    while(b) {
+        if(b & 1) {
+            out ^= a;
+        }
+        a = (a << 1) ^ (a & 0x08 ? 0x13 : 0);
+        b >>= 1;
+    }
+
+    return out;
+}
+
+constexpr uint8_t NibbleInverse(uint8_t a) {
+    uint8_t b = 1;
+
+    while(NibbleMultiply(a, b) != 1) {
+        b++;
+    }
+
+    return b;
+}
+
+/* Multiply i z + k (high nibble i, low nibble k) in the tower, where z^2 = a z + a */
+constexpr uint8_t TowerMultiply(uint8_t x, uint8_t y, uint8_t a) {
+    uint8_t ii = NibbleMultiply(x >> 4, y >> 4);
+    uint8_t hi = NibbleMultiply(a, ii) ^ NibbleMultiply(x >> 4, y & 15) ^ NibbleMultiply(x & 15, y >> 4);
+    uint8_t lo = NibbleMultiply(a, ii) ^ NibbleMultiply(x & 15, y & 15);
+
+    return (hi << 4) | lo;
+}
+
+/* The linear part of the S-Box affine step and its inverse */
+constexpr uint8_t AffineLinear(uint8_t q) {
+    return q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4);
+}
+
+constexpr uint8_t InverseAffineLinear(uint8_t q) {
+    return ROTL8(q, 1) ^ ROTL8(q, 3) ^ ROTL8(q, 6);
+}
+
+/*
+ * For x = i z + k, with j = i ^ k, the norm D = a i^2 + a i k + k^2 is in
+ * GF(2^4) and 1/x = (i z + a i + k) / D. The round computes
+ *
+ *     io = j ^ 1/(1/i ^ a/k) = D / (k + a i)
+ *     jo = i ^ 1/(1/j ^ a/k) = D / (k + a j)
+ *
+ * from which 1/x = (1/a + 1/a^2)/io z + 1/io + (1/a^2)/jo z, one table of
+ * io and one of jo. Zero inputs follow through with 1/0 as the infinity
+ * marker, whose lookup gives 0.
+ */
+constexpr VpermTables BuildVpermTables() {
+    VpermTables t = {};
+    uint8_t toTower[256] = {};
+    uint8_t fromTower[256] = {};
+    uint8_t a = 2;
+    uint8_t beta = 2;
+    int x = 0;
+    int m = 0;
+
+    /* The first a for which z^2 + a z + a has no root in GF(2^4) */
+    for(;; a++) {
+        bool root = false;
+        for(x = 0; x < 16; x++) {
+            root = root || (NibbleMultiply(x, x) ^ NibbleMultiply(a, x) ^ a) == 0;
+        }
+        if(!root) {
+            break;
+        }
+    }
+
+    /* A root of the AES polynomial x^8 + x^4 + x^3 + x + 1 in the tower; x -> beta is an isomorphism */
+    for(;; beta++) {
+        uint8_t p[9] = { 1 };
+        for(m = 1; m < 9; m++) {
+            p[m] = TowerMultiply(p[m - 1], beta, a);
+        }
+        if((p[8] ^ p[4] ^ p[3] ^ p[1] ^ p[0]) == 0) {
+            break;
+        }
+    }
+
+    for(x = 0; x < 256; x++) {
+        uint8_t power = 1;
+        uint8_t y = 0;
+        for(m = 0; m < 8; m++) {
+            if(x & (1 << m)) {
+                y ^= power;
+            }
+            power = TowerMultiply(power, beta, a);
+        }
+        toTower[x] = y;
+        fromTower[y] = x;
+    }
+
+    uint8_t inverseA = NibbleInverse(a);
+    uint8_t inverseA2 = NibbleMultiply(inverseA, inverseA);
+
+    for(x = 0; x < 16; x++) {
+        t.encLo[x] = toTower[x];
+        t.encHi[x] = toTower[x << 4];
+        /* The inverse S-Box takes y to 1/(L^-1(y) ^ 0x05); the constant rides on the low nibble */
+        t.decLo[x] = toTower[InverseAffineLinear(x) ^ 0x05];
+        t.decHi[x] = toTower[InverseAffineLinear(x << 4)];
+
+        t.inv[x] = x ? NibbleInverse(x) : VPERM_INFINITY;
+        t.ak[x] = x ? NibbleMultiply(a, NibbleInverse(x)) : VPERM_INFINITY;
+
+        /* io and jo are never 0 for a nonzero byte, and infinite ones read as 0 */
+        if(x) {
+            uint8_t r = NibbleInverse(x);
+            uint8_t io = (NibbleMultiply(inverseA ^ inverseA2, r) << 4) | r;
+            uint8_t jo = NibbleMultiply(inverseA2, r) << 4;
+
+            t.encIo[x] = AffineLinear(fromTower[io]);
+            t.encJo[x] = AffineLinear(fromTower[jo]);
+            t.decIo[x] = fromTower[io];
+            t.decJo[x] = fromTower[jo];
+        }
+    }
+
+    return t;
+}
+
+static constexpr VpermTables vperm = BuildVpermTables();
+
+/* Shift Rows and its inverse on a column-major state */
+alignas(16) static constexpr uint8_t shiftRows[16] = { 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11 };
+alignas(16) static constexpr uint8_t invShiftRows[16] = { 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3 };
+
+/* Row r of each column from row r + 1 and r + 2 */
+alignas(16) static constexpr uint8_t rotate1[16] = { 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12 };
+alignas(16) static constexpr uint8_t rotate2[16] = { 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 };
+
+#pragma GCC push_options
+#pragma GCC target("ssse3")
+
+static inline __m128i Load(const uint8_t *p) {
+    return _mm_load_si128((const __m128i *)p);
+}
+
+/* Look up every byte of index in a 16-entry table */
+static inline __m128i Lookup(const uint8_t *table, __m128i index) {
+    return _mm_shuffle_epi8(Load(table), index);
+}
+
+/* Multiply every byte by x modulo the AES polynomial */
+static inline __m128i Xtime(__m128i v) {
+    return _mm_add_epi8(v, v) ^ (_mm_cmplt_epi8(v, _mm_setzero_si128()) & _mm_set1_epi8(0x1B));
+}
+
+/* Invert every byte in the tower field between the input and output basis changes */
+static inline __m128i Substitute(__m128i s, const uint8_t *lo, const uint8_t *hi, const uint8_t *outIo, const uint8_t *outJo) {
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i x = Lookup(lo, s & mask) ^ Lookup(hi, _mm_srli_epi32(s, 4) & mask);
+    __m128i k = x & mask;
+    __m128i i = _mm_srli_epi32(x, 4) & mask;
+    __m128i j = i ^ k;
+    __m128i ak = Lookup(vperm.ak, k);
+    __m128i io = Lookup(vperm.inv, Lookup(vperm.inv, i) ^ ak) ^ j;
+    __m128i jo = Lookup(vperm.inv, Lookup(vperm.inv, j) ^ ak) ^ i;
+
+    return Lookup(outIo, io) ^ Lookup(outJo, jo);
+}
+
+static inline __m128i MixColumns(__m128i s) {
+    __m128i r = _mm_shuffle_epi8(s, Load(rotate1));
+    __m128i b = s ^ r;
+
+    /* 2 (s_r + s_r+1) + s_r+1 + s_r+2 + s_r+3, the MCE row */
+    return Xtime(b) ^ r ^ _mm_shuffle_epi8(b, Load(rotate2));
+}
+
+/* MCD is MCE times the circulant (5, 0, 4, 0) */
+static inline __m128i InvMixColumns(__m128i s) {
+    return MixColumns(s ^ Xtime(Xtime(s ^ _mm_shuffle_epi8(s, Load(rotate2)))));
+}
+
+template<int Nr>
+static inline __m128i EncryptBlock(const uint8_t (*rk)[16], __m128i s) {
+    const __m128i c = _mm_set1_epi8(0x63);
+    int r;
+
+    s ^= Load(rk[0]);
+    for(r = 1; r < Nr; r++) {
+        s = Substitute(s, vperm.encLo, vperm.encHi, vperm.encIo, vperm.encJo) ^ c;
+        s = MixColumns(_mm_shuffle_epi8(s, Load(shiftRows))) ^ Load(rk[r]);
+    }
+    s = Substitute(s, vperm.encLo, vperm.encHi, vperm.encIo, vperm.encJo) ^ c;
+
+    return _mm_shuffle_epi8(s, Load(shiftRows)) ^ Load(rk[Nr]);
+}
+
+template<int Nr>
+static inline __m128i DecryptBlock(const uint8_t (*drk)[16], __m128i s) {
+    int r;
+
+    s ^= Load(drk[0]);
+    for(r = 1; r < Nr; r++) {
+        s = Substitute(s, vperm.decLo, vperm.decHi, vperm.decIo, vperm.decJo);
+        s = InvMixColumns(_mm_shuffle_epi8(s, Load(invShiftRows))) ^ Load(drk[r]);
+    }
+    s = Substitute(s, vperm.decLo, vperm.decHi, vperm.decIo, vperm.decJo);
+
+    return _mm_shuffle_epi8(s, Load(invShiftRows)) ^ Load(drk[Nr]);
+}
+
+template<int Nr>
+void EncryptBlocksVperm(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    size_t n;
+
+    for(n = 0; n < blocks; n++) {
+        _mm_storeu_si128((__m128i *)(out + 16 * n), EncryptBlock<Nr>(rk, _mm_loadu_si128((const __m128i *)(in + 16 * n))));
+    }
+}
+
+template<int Nr>
+void DecryptBlocksVperm(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks) {
+    size_t n;
+
+    for(n = 0; n < blocks; n++) {
+        _mm_storeu_si128((__m128i *)(out + 16 * n), DecryptBlock<Nr>(drk, _mm_loadu_si128((const __m128i *)(in + 16 * n))));
+    }
+}
+
+template<int Nr>
+void EncryptMultiKeyVperm(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count) {
+    size_t n;
+
+    for(n = 0; n < count; n++) {
+        _mm_storeu_si128((__m128i *)out[n], EncryptBlock<Nr>(ctxs[n]->rk, _mm_loadu_si128((const __m128i *)in[n])));
+    }
+}
+
+template void EncryptBlocksVperm<10>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksVperm<12>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptBlocksVperm<14>(const uint8_t (*rk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksVperm<10>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksVperm<12>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void DecryptBlocksVperm<14>(const uint8_t (*drk)[16], const uint8_t *in, uint8_t *out, size_t blocks);
+template void EncryptMultiKeyVperm<10>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyVperm<12>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+template void EncryptMultiKeyVperm<14>(const AesContext *const *ctxs, const uint8_t *const *in, uint8_t *const *out, size_t count);
+
+#pragma GCC pop_options
@@ -0,0 +1,71 @@
+/*
+ * Daemon protocol for the AES Encryption project
+ *
+ * Framing spoken by aesd over its Unix domain socket. A client sends
+ * requests back to back without waiting for replies; each request is a
+ * WireRequest followed by length payload bytes, and each reply a
+ * WireReply followed by length payload bytes. Replies on a connection come
+ * in request order and echo the request's tag. Integers are in the byte
+ * order of the machine, which client and daemon share.
+ *
+ * Keys are loaded into a table shared by every connection, under an id
+ * the client picks, and stay expanded until they are dropped or the
+ * daemon exits.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_WIRE_H
+#define AES_WIRE_H
+
+#include <stdint.h>
+
+/* Largest payload of a request; a larger one closes the connection */
+#define WIRE_MAX_PAYLOAD (1024 * 1024)
+
+enum WireMode {
+    /* Payload is a 16, 24 or 32-byte key to expand under keyId; empty reply */
+    WIRE_LOAD_KEY,
+    /* Forget keyId; empty reply */
+    WIRE_DROP_KEY,
+    /* Whole blocks; the reply payload is as long as the request's */
+    WIRE_ECB_ENCRYPT,
+    WIRE_ECB_DECRYPT,
+    /* Any length, keystream from counter block iv */
+    WIRE_CTR,
+    /* PKCS#7 padded CBC from iv; decryption takes whole blocks and replies with the unpadded plaintext */
+    WIRE_CBC_ENCRYPT,
+    WIRE_CBC_DECRYPT,
+    WIRE_MODES
+};
+
+enum WireStatus {
+    WIRE_OK,
+    /* No key under keyId */
+    WIRE_NO_KEY,
+    /* Unknown mode, or a payload length the mode does not accept */
+    WIRE_BAD_REQUEST,
+    /* CBC padding did not check out */
+    WIRE_BAD_PADDING
+};
+
+struct WireRequest {
+    uint32_t length;
+    uint32_t keyId;
+    /* Echoed in the reply */
+    uint64_t tag;
+    uint8_t mode;
+    uint8_t reserved[15];
+    uint8_t iv[16];
+};
+
+struct WireReply {
+    uint32_t length;
+    uint32_t status;
+    uint64_t tag;
+};
+
+static_assert(sizeof(WireRequest) == 48, "WireRequest has no padding");
+static_assert(sizeof(WireReply) == 16, "WireReply has no padding");
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * XTS mode for the AES Encryption project
+ *
+ * The tweak of block j of a sector is E(key 2, sector) * x^j in GF(2^128),
+ * kept as a little-endian 128-bit value. The first XTS_BATCH tweaks come
+ * from doubling; after that each of the XTS_BATCH tweaks in flight is
+ * multiplied by x^XTS_BATCH on its own, so the tweaks of a batch do not
+ * wait on each other. Blocks are whitened in a buffer that goes to the
+ * engine in one call and whitened again on the way out.
+ *
+ * AES Encryption
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "aes_xts.h"
+
+/* t * x: shift the 128-bit value left, folding the bit shifted out back in as x^7 + x^2 + x + 1 */
+static inline __m128i XtsDouble(__m128i t) {
+    __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x93);
+
+    return _mm_xor_si128(_mm_slli_epi32(t, 1), _mm_and_si128(carry, _mm_set_epi32(1, 1, 1, 0x87)));
+}
+
+/* t * x^16: shift left two bytes and fold the 16 bits shifted out, times x^7 + x^2 + x + 1, into the low 23 bits */
+static inline __m128i XtsAdvance(__m128i t) {
+    __m128i h = _mm_srli_si128(t, 14);
+    __m128i fold = _mm_xor_si128(_mm_xor_si128(h, _mm_slli_epi32(h, 1)), _mm_xor_si128(_mm_slli_epi32(h, 2), _mm_slli_epi32(h, 7)));
+
+    return _mm_xor_si128(_mm_slli_si128(t, 2), fold);
+}
+
+static_assert(XTS_BATCH == 16, "XtsAdvance() multiplies by x^16");
+
+/* Whiten n blocks with their tweaks, run them through the engine in one call, and whiten them again */
+static inline void XtsBlocks(const AesContext *ctx, bool decrypt, const __m128i *t, const uint8_t *in, uint8_t *out, size_t n) {
+    __m128i buffer[XTS_BATCH];
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        buffer[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + 16 * i)), t[i]);
+    }
+
+    if(decrypt) {
+        DecryptBlocks(ctx, (const uint8_t *)buffer, (uint8_t *)buffer, n);
+    }
+    else {
+        EncryptBlocks(ctx, (const uint8_t *)buffer, (uint8_t *)buffer, n);
+    }
+
+    for(i = 0; i < n; i++) {
+        _mm_storeu_si128((__m128i *)(out + 16 * i), _mm_xor_si128(buffer[i], t[i]));
+    }
+}
+
+static bool XtsCrypt(const XtsKey *key, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len, bool decrypt) {
+    alignas(16) uint8_t number[16];
+    alignas(16) uint8_t last[16];
+    alignas(16) uint8_t stolen[16];
+    __m128i t[XTS_BATCH];
+    __m128i first;
+    __m128i second;
+    size_t tail = len % 16;
+    size_t whole;
+    size_t done = 0;
+    size_t base = 0;
+    size_t n;
+    size_t p;
+    int i;
+
+    if(len < XTS_MIN_SECTOR) {
+        return false;
+    }
+
+    /* The sector number is a little-endian 128-bit value */
+    memset(number, 0, 16);
+    for(i = 0; i < 8; i++) {
+        number[i] = (uint8_t)(sector >> (8 * i));
+    }
+    EncryptBlocks(&key->tweak, number, number, 1);
+
+    t[0] = _mm_load_si128((const __m128i *)number);
+    for(i = 1; i < XTS_BATCH; i++) {
+        t[i] = XtsDouble(t[i - 1]);
+    }
+
+    /* With ciphertext stealing the last whole block goes with the partial one */
+    whole = len / 16 - (tail ? 1 : 0);
+    while(done < whole) {
+        n = whole - done < XTS_BATCH ? whole - done : XTS_BATCH;
+        XtsBlocks(&key->data, decrypt, t, in + 16 * done, out + 16 * done, n);
+        done += n;
+
+        if(n == XTS_BATCH) {
+            for(i = 0; i < XTS_BATCH; i++) {
+                t[i] = XtsAdvance(t[i]);
+            }
+            base += XTS_BATCH;
+        }
+    }
+
+    if(tail == 0) {
+        return true;
+    }
+
+    /* Tweaks of the last whole block and of the partial block */
+    p = whole - base;
+    first = t[p];
+    second = p + 1 < XTS_BATCH ? t[p + 1] : XtsDouble(t[p]);
+
+    in += 16 * whole;
+    out += 16 * whole;
+
+    /*
+     * Encryption: the last whole block's ciphertext donates its first tail
+     * bytes as the partial ciphertext block, and its remaining bytes pad
+     * the partial plaintext block, which becomes the last whole ciphertext
+     * block. Decryption undoes this with the two tweaks swapped. Input is
+     * read before output is written, so out may be in.
+     */
+    XtsBlocks(&key->data, decrypt, decrypt ? &second : &first, in, last, 1);
+    memcpy(stolen, in + 16, tail);
+    memcpy(stolen + tail, last + tail, 16 - tail);
+    memcpy(out + 16, last, tail);
+    XtsBlocks(&key->data, decrypt, decrypt ? &first : &second, stolen, out, 1);
+
+    return true;
+}
+
+bool XtsInitialize(XtsKey *key, const uint8_t *keyBytes, size_t len, AesEngine engine) {
+    if(len != 32 && len != 64) {
+        return false;
+    }
+
+    return InitializeContext(&key->data, keyBytes, len / 2, engine) && InitializeContext(&key->tweak, keyBytes + len / 2, len / 2, engine);
+}
+
+bool XtsEncrypt(const XtsKey *key, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len) {
+    return XtsCrypt(key, sector, in, out, len, false);
+}
+
+bool XtsDecrypt(const XtsKey *key, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len) {
+    return XtsCrypt(key, sector, in, out, len, true);
+}
+
+static bool XtsCryptSectors(const XtsKey *key, const XtsSector *sectors, size_t count, ThreadPool &pool, bool decrypt) {
+    size_t tasks = (count + XTS_TASK_SECTORS - 1) / XTS_TASK_SECTORS;
+    std::atomic<bool> ok(true);
+
+    pool.ParallelFor(tasks, [&](size_t task) {
+        size_t end = (task + 1) * XTS_TASK_SECTORS < count ? (task + 1) * XTS_TASK_SECTORS : count;
+        size_t i;
+
+        for(i = task * XTS_TASK_SECTORS; i < end; i++) {
+            if(!XtsCrypt(key, sectors[i].number, sectors[i].in, sectors[i].out, sectors[i].len, decrypt)) {
+                ok.store(false, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    return ok.load();
+}
+
+bool XtsEncryptSectors(const XtsKey *key, const XtsSector *sectors, size_t count, ThreadPool &pool) {
+    return XtsCryptSectors(key, sectors, count, pool, false);
+}
+
+bool XtsDecryptSectors(const XtsKey *key, const XtsSector *sectors, size_t count, ThreadPool &pool) {
+    return XtsCryptSectors(key, sectors, count, pool, true);
+}
@@ -0,0 +1,55 @@
+/*
+ * XTS mode for the AES Encryption project
+ *
+ * XTS-AES per IEEE 1619 for sector-based storage. Each sector is encrypted
+ * on its own under a tweak derived from its sector number, so any set of
+ * sectors can be processed in any order and on any thread. Sectors whose
+ * length is not a multiple of 16 use ciphertext stealing.
+ *
+ * AES Encryption
+ */
+
+#ifndef AES_XTS_H
+#define AES_XTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_engine.h"
+#include "aes_pool.h"
+
+/* Blocks whitened and sent to the engine per call; the tweaks for them are advanced together */
+#define XTS_BATCH 16
+
+/* Sectors handed to one worker at a time by the sector batch functions */
+#define XTS_TASK_SECTORS 16
+
+/* Shortest sector XTS can encrypt */
+#define XTS_MIN_SECTOR 16
+
+struct XtsKey {
+    /* Key 1 encrypts the data, key 2 the sector numbers */
+    AesContext data;
+    AesContext tweak;
+};
+
+/* One sector of a batch; out may be in */
+struct XtsSector {
+    uint64_t number;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+};
+
+/* Expand the two halves of a 32-byte (AES-128) or 64-byte (AES-256) XTS key; false for any other length */
+bool XtsInitialize(XtsKey *key, const uint8_t *keyBytes, size_t len, AesEngine engine = ENGINE_AUTO);
+
+/* Encrypt or decrypt one sector of len bytes, at least XTS_MIN_SECTOR; false if it is shorter */
+bool XtsEncrypt(const XtsKey *key, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len);
+bool XtsDecrypt(const XtsKey *key, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len);
+
+/* Encrypt or decrypt count sectors, XTS_TASK_SECTORS per task across the threads of pool; false if any is too short */
+bool XtsEncryptSectors(const XtsKey *key, const XtsSector *sectors, size_t count, ThreadPool &pool);
+bool XtsDecryptSectors(const XtsKey *key, const XtsSector *sectors, size_t count, ThreadPool &pool);
+
+#endif